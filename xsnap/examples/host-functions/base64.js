@@ -0,0 +1,35 @@
+// Measures the throughput of Base64.encode and Base64.decode, from 64 bytes
+// to 64 MB. Every result is printed as one line of JSON:
+//	{ "name", "size", "calls", "GBps" }
+// The size is the number of bytes, before encoding or after decoding.
+
+const sizes = [64, 1024, 16384, 65536, 1048576, 16777216, 67108864];
+const minimumTime = 100; // ms per case
+
+function run(name, size, argument, call) {
+	let calls = 1, elapsed = 0;
+	for (;;) {
+		const start = performance.now();
+		for (let i = 0; i < calls; i++)
+			call(argument);
+		elapsed = performance.now() - start;
+		if (elapsed >= minimumTime)
+			break;
+		calls *= (elapsed > 0) ? Math.min(16, Math.ceil(2 * minimumTime / elapsed)) : 16;
+	}
+	print(JSON.stringify({ name, size, calls, GBps: Math.round(size * calls / elapsed / 1e4) / 100 }));
+}
+
+const pattern = new Uint8Array(65536);
+for (let i = 0; i < pattern.length; i++)
+	pattern[i] = (i * 7919) & 0xFF;
+
+for (const size of sizes) {
+	const bytes = new Uint8Array(size);
+	for (let offset = 0; offset < size; offset += pattern.length)
+		bytes.set((size - offset < pattern.length) ? pattern.subarray(0, size - offset) : pattern, offset);
+	const string = Base64.encode(bytes.buffer);
+	run("Base64.encode", size, bytes.buffer, (it) => Base64.encode(it));
+	run("Base64.decode", size, string, (it) => Base64.decode(it));
+	gc();
+}
@@ -0,0 +1,86 @@
+// Measures the host functions that xsnap and xsnap-worker install, across
+// payload sizes. Every result is printed as one line of JSON:
+//	{ "name", "size", "calls", "ns" (per call), "computrons" (per call), "MBps" }
+// "loop" is the cost of the measuring loop itself, included in the others.
+// "print" writes lines of "x" to stdout: filter the results with grep "^{".
+
+const sizes = [16, 1024, 65536, 1048576];
+const minimumTime = 50; // ms per case
+
+function meter() {
+	// the computrons since the previous call, undefined without metering
+	return resetMeter(currentMeterLimit(), 0);
+}
+
+function run(name, size, prepare, call) {
+	let result;
+	try {
+		const argument = prepare(size);
+		call(argument);
+		let calls = 1, elapsed = 0, computrons;
+		for (;;) {
+			meter();
+			const start = performance.now();
+			for (let i = 0; i < calls; i++)
+				call(argument);
+			elapsed = performance.now() - start;
+			computrons = meter();
+			if (elapsed >= minimumTime)
+				break;
+			calls *= (elapsed > 0) ? Math.min(16, Math.ceil(2 * minimumTime / elapsed)) : 16;
+		}
+		result = {
+			name,
+			size,
+			calls,
+			ns: Math.round(elapsed * 1e6 / calls),
+			computrons: (computrons === undefined) ? null : Math.round(computrons / calls),
+			MBps: size ? Math.round(size * calls / elapsed / 1000) : null,
+		};
+	}
+	catch (e) {
+		result = { name, size, error: String(e) };
+	}
+	print(JSON.stringify(result));
+}
+
+function string(size) {
+	return "x".repeat(size);
+}
+
+function bytes(size) {
+	const array = new Uint8Array(size);
+	for (let i = 0; i < size; i++)
+		array[i] = 0x61 + (i % 26);
+	return array;
+}
+
+run("loop", 0, () => undefined, () => undefined);
+run("performance.now", 0, () => undefined, () => performance.now());
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+for (const size of sizes) {
+	run("TextEncoder.encode", size, string, (it) => encoder.encode(it));
+	run("TextEncoder.encodeInto", size, (size) => ({ string: string(size), buffer: new Uint8Array(size) }), (it) => encoder.encodeInto(it.string, it.buffer));
+	run("TextDecoder.decode", size, bytes, (it) => decoder.decode(it));
+	run("Base64.encode", size, (size) => bytes(size).buffer, (it) => Base64.encode(it));
+	run("Base64.decode", size, (size) => Base64.encode(bytes(size).buffer), (it) => Base64.decode(it));
+}
+
+// size is the number of properties of the object to harden
+for (const size of [0, 16, 1024]) {
+	run("harden", size, (size) => size, (size) => {
+		const object = {};
+		for (let i = 0; i < size; i++)
+			object[i] = {};
+		return harden(object);
+	});
+}
+
+for (const size of [16, 1024])
+	run("print", size, string, (it) => print(it));
+
+// under xsnap-worker, with a parent that answers at once, like xsnap-bench -e
+for (const size of sizes)
+	run("issueCommand", size, (size) => bytes(size).buffer, (it) => issueCommand(it));
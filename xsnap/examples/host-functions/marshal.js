@@ -0,0 +1,62 @@
+// Compares Marshal.encode and Marshal.decode with the JSON path of vats,
+// JSON.stringify then TextEncoder.encode, and TextDecoder.decode then
+// JSON.parse, on capdata deliveries: one message, a batch of 100 and a batch
+// of 10000. Every result is printed as one line of JSON:
+//	{ "name", "messages", "size" (bytes), "calls", "ns" (per call), "computrons" (per call) }
+// Computrons are null without metering: run with -l 1000000000000.
+
+const minimumTime = 100; // ms per case
+
+function meter() {
+	// the computrons since the previous call, undefined without metering
+	return resetMeter(currentMeterLimit(), 0);
+}
+
+function run(name, messages, size, argument, call) {
+	let calls = 1, elapsed = 0, computrons;
+	for (;;) {
+		meter();
+		const start = performance.now();
+		for (let i = 0; i < calls; i++)
+			call(argument);
+		elapsed = performance.now() - start;
+		computrons = meter();
+		if (elapsed >= minimumTime)
+			break;
+		calls *= (elapsed > 0) ? Math.min(16, Math.ceil(2 * minimumTime / elapsed)) : 16;
+	}
+	print(JSON.stringify({
+		name,
+		messages,
+		size,
+		calls,
+		ns: Math.round(elapsed * 1e6 / calls),
+		computrons: (computrons === undefined) ? null : Math.round(computrons / calls),
+	}));
+}
+
+function delivery(i) {
+	// what liveslots receives for a message to one of its objects
+	return ["message", `o+${i % 17}`, {
+		methargs: {
+			body: `#["transfer",[{"brand":"$0.Alleged: IST brand","value":"+${1000000 + i}"},"$1.Alleged: purse ${i}",{"memo":"payment ${i}","when":"+${1700000000 + i}"}]]`,
+			slots: ["o-50", `o-${100 + i}`],
+		},
+		result: `p-${200 + i}`,
+	}];
+}
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+for (const messages of [1, 100, 10000]) {
+	const value = [];
+	for (let i = 0; i < messages; i++)
+		value.push(delivery(i));
+	const json = encoder.encode(JSON.stringify(value));
+	const binary = Marshal.encode(value);
+	run("JSON.stringify+TextEncoder.encode", messages, json.length, value, (it) => encoder.encode(JSON.stringify(it)));
+	run("Marshal.encode", messages, binary.byteLength, value, (it) => Marshal.encode(it));
+	run("TextDecoder.decode+JSON.parse", messages, json.length, json, (it) => JSON.parse(decoder.decode(it)));
+	run("Marshal.decode", messages, binary.byteLength, binary, (it) => Marshal.decode(it));
+	gc();
+}
@@ -0,0 +1,38 @@
+// Measures the throughput of TextDecoder.prototype.decode and
+// TextEncoder.prototype.encode on 10 MB of JSON, like a large delivery,
+// in ASCII, with accented letters, and with emojis. Every result is printed
+// as one line of JSON:
+//	{ "name", "text", "size", "calls", "GBps" }
+// The size is the number of UTF-8 bytes.
+
+const size = 10 * 1024 * 1024;
+const minimumTime = 200; // ms per case
+
+function run(name, text, size, argument, call) {
+	let calls = 1, elapsed = 0;
+	for (;;) {
+		const start = performance.now();
+		for (let i = 0; i < calls; i++)
+			call(argument);
+		elapsed = performance.now() - start;
+		if (elapsed >= minimumTime)
+			break;
+		calls *= (elapsed > 0) ? Math.min(16, Math.ceil(2 * minimumTime / elapsed)) : 16;
+	}
+	print(JSON.stringify({ name, text, size, calls, GBps: Math.round(size * calls / elapsed / 1e4) / 100 }));
+}
+
+function payload(word) {
+	const item = JSON.stringify({ method: "deliver", args: { body: `#["${word}",{"@qclass":"bigint","digits":"12345"}]`, slots: ["o-5", "p+12"] } });
+	return "[" + Array(Math.ceil(size / (item.length + 1))).fill(item).join(",") + "]";
+}
+
+const decoder = new TextDecoder();
+const encoder = new TextEncoder();
+for (const [text, word] of [["ascii", "hello"], ["accents", "héllo wörld"], ["emojis", "hello \u{1F600}\u{1F680}"]]) {
+	const string = payload(word);
+	const bytes = encoder.encode(string);
+	run("TextDecoder.decode", text, bytes.length, bytes, (it) => decoder.decode(it));
+	run("TextEncoder.encode", text, bytes.length, string, (it) => encoder.encode(it));
+	gc();
+}
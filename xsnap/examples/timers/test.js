@@ -0,0 +1,29 @@
+const count = 100000;
+let ran = 0;
+let start = performance.now();
+for (let i = 0; i < count; i++) {
+	setImmediate(() => {
+		ran++;
+		if (ran === count) {
+			print(`${count} immediates: ${(performance.now() - start).toFixed(1)} ms`);
+			timeouts();
+		}
+	});
+}
+
+function timeouts() {
+	const order = [];
+	setTimeout(() => order.push(30), 30);
+	setTimeout(() => order.push(10), 10);
+	const cleared = setTimeout(() => order.push("cleared"), 20);
+	setTimeout(() => order.push(20), 20);
+	clearTimeout(cleared);
+	let ticks = 0;
+	const interval = setInterval(() => {
+		order.push(`tick ${++ticks}`);
+		if (ticks === 3) {
+			clearInterval(interval);
+			setTimeout(() => print(order.join(" ")), 0);
+		}
+	}, 15);
+}
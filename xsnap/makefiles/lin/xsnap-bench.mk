@@ -0,0 +1,53 @@
+% : %.c
+%.o : %.c
+
+GOAL ?= release
+NAME = xsnap-bench
+ifneq ($(VERBOSE),1)
+MAKEFLAGS += --silent
+endif
+
+BUILD_DIR = $(CURDIR)/../../build
+TLS_DIR = $(CURDIR)/../../sources
+
+BIN_DIR = $(BUILD_DIR)/bin/lin/$(GOAL)
+TMP_DIR = $(BUILD_DIR)/tmp/lin/$(GOAL)/$(NAME)
+
+C_OPTIONS = \
+	-I$(TLS_DIR)
+ifeq ($(GOAL),debug)
+	C_OPTIONS += -g -O0 -Wall -Wextra -Wno-unused-parameter
+else
+	C_OPTIONS += -O3
+endif
+
+LIBRARIES = -lm -lpthread
+
+OBJECTS = \
+	$(TMP_DIR)/xsnapTranscript.o \
+	$(TMP_DIR)/xsnap-bench.o
+
+VPATH += $(TLS_DIR)
+
+build: $(TMP_DIR) $(BIN_DIR) $(BIN_DIR)/$(NAME)
+
+$(TMP_DIR):
+	mkdir -p $(TMP_DIR)
+
+$(BIN_DIR):
+	mkdir -p $(BIN_DIR)
+
+$(BIN_DIR)/$(NAME): $(OBJECTS)
+	@echo "#" $(NAME) $(GOAL) ": cc" $(@F)
+	$(CC) $(OBJECTS) $(LIBRARIES) -o $@
+
+$(OBJECTS): $(TLS_DIR)/xsnapTranscript.h
+$(TMP_DIR)/%.o: %.c
+	@echo "#" $(NAME) $(GOAL) ": cc" $(<F)
+	$(CC) $< $(C_OPTIONS) -c -o $@
+
+clean:
+	rm -rf $(BUILD_DIR)/bin/lin/debug/$(NAME)
+	rm -rf $(BUILD_DIR)/bin/lin/release/$(NAME)
+	rm -rf $(BUILD_DIR)/tmp/lin/debug/$(NAME)
+	rm -rf $(BUILD_DIR)/tmp/lin/release/$(NAME)
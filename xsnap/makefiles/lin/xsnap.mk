@@ -105,7 +105,11 @@ OBJECTS = \
 	$(TMP_DIR)/textdecoder.o \
 	$(TMP_DIR)/textencoder.o \
 	$(TMP_DIR)/modBase64.o \
+	$(TMP_DIR)/xsnapBase64.o \
+	$(TMP_DIR)/xsnapMarshal.o \
 	$(TMP_DIR)/xsnapPlatform.o \
+	$(TMP_DIR)/xsnapText.o \
+	$(TMP_DIR)/xsnapTranscript.o \
 	$(TMP_DIR)/xsnap.o
 
 VPATH += $(SRC_DIR) $(TLS_DIR)
@@ -127,6 +131,7 @@ $(BIN_DIR)/$(NAME): $(OBJECTS)
 
 $(OBJECTS): $(TLS_DIR)/xsnap.h
 $(OBJECTS): $(TLS_DIR)/xsnapPlatform.h
+$(OBJECTS): $(TLS_DIR)/xsnapTranscript.h
 $(OBJECTS): $(PLT_DIR)/xsPlatform.h
 $(OBJECTS): $(SRC_DIR)/xsCommon.h
 $(OBJECTS): $(SRC_DIR)/xsAll.h
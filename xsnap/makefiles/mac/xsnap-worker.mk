@@ -2,7 +2,19 @@
 %.o : %.c
 
 GOAL ?= debug
+# UNMETERED=1 builds xsnap-worker-unmetered, without metering and xsbug
+# support, for query workers. It reads and writes the same snapshots.
+ifeq ($(UNMETERED),1)
+NAME = xsnap-worker-unmetered
+else
 NAME = xsnap-worker
+endif
+# PROFILE=1 adds the XS sampling profiler, for the p and pt commands, and
+# appends -profile to the name. Production workers are built without it,
+# since mxProfile adds work to every function call even when not profiling.
+ifeq ($(PROFILE),1)
+NAME := $(NAME)-profile
+endif
 ifneq ($(VERBOSE),1)
 MAKEFLAGS += --silent
 endif
@@ -34,8 +46,6 @@ C_OPTIONS = \
 	-DXSNAP_VERSION=\"$(XSNAP_VERSION)\" \
 	-DXSNAP_TEST_RECORD=0 \
 	-DmxLockdown=1 \
-	-DmxMetering=1 \
-	-DmxDebug=1 \
 	-UmxInstrument \
 	-DmxNoConsole=1 \
 	-DmxBoundsCheck=1 \
@@ -54,6 +64,12 @@ C_OPTIONS = \
 ifneq ("x$(SDKROOT)", "x")
 	C_OPTIONS += -isysroot $(SDKROOT)
 endif
+ifneq ($(UNMETERED),1)
+	C_OPTIONS += -DmxMetering=1 -DmxDebug=1
+endif
+ifeq ($(PROFILE),1)
+	C_OPTIONS += -DmxProfile=1
+endif
 ifeq ($(GOAL),debug)
 	C_OPTIONS += -g -O0 -Wall -Wextra -Wno-missing-field-initializers -Wno-unused-parameter
 else
@@ -123,7 +139,11 @@ OBJECTS = \
 	$(TMP_DIR)/textdecoder.o \
 	$(TMP_DIR)/textencoder.o \
 	$(TMP_DIR)/modBase64.o \
+	$(TMP_DIR)/xsnapBase64.o \
+	$(TMP_DIR)/xsnapMarshal.o \
 	$(TMP_DIR)/xsnapPlatform.o \
+	$(TMP_DIR)/xsnapText.o \
+	$(TMP_DIR)/xsnapTranscript.o \
 	$(TMP_DIR)/xsnap-worker.o
 
 VPATH += $(SRC_DIR) $(TLS_DIR)
@@ -145,6 +165,7 @@ $(BIN_DIR)/$(NAME): $(OBJECTS)
 
 $(OBJECTS): $(TLS_DIR)/xsnap.h
 $(OBJECTS): $(TLS_DIR)/xsnapPlatform.h
+$(OBJECTS): $(TLS_DIR)/xsnapTranscript.h
 $(OBJECTS): $(PLT_DIR)/xsPlatform.h
 $(OBJECTS): $(SRC_DIR)/xsCommon.h
 $(OBJECTS): $(SRC_DIR)/xsAll.h
@@ -0,0 +1,439 @@
+#include "xsnapTranscript.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Replays a transcript recorded by xsnap-worker -R against a worker, as its
+// parent: deliveries and scripts are sent on fd 3, issueCommand messages are
+// answered with the recorded replies, and snapshots are written where the
+// transcript wrote them. The measures are printed as one JSON object.
+// With -e, it evaluates a script instead, and answers every issueCommand
+// message with the message itself.
+
+typedef struct {
+	pid_t pid;
+	FILE* toWorker;
+	FILE* fromWorker;
+} BenchWorker;
+
+typedef struct {
+	double* values;
+	size_t count;
+	size_t capacity;
+	double total;
+} BenchSamples;
+
+static int fxAddSample(BenchSamples* samples, double value);
+static int fxEvaluate(BenchWorker* worker, char* path);
+static double fxPercentile(BenchSamples* samples, double percent);
+static void fxPrintSamples(FILE* file, char* name, BenchSamples* samples);
+static void fxPrintUsage();
+static int fxReadNetString(FILE* inStream, char** dest, size_t* len);
+static int fxRequest(BenchWorker* worker, TranscriptReader* reader, char command, void* data, size_t length, char** response, size_t* responseLength);
+static int fxStartWorker(BenchWorker* worker, char** argv);
+static double fxTime();
+static int fxWriteNetString(FILE* outStream, char prefix, void* buf, size_t length);
+
+int main(int argc, char* argv[])
+{
+	char* workerPath = "xsnap-worker";
+	char* snapshotPath = NULL;
+	char* outputPath = "xsnap-bench.xss";
+	char* transcriptPath = NULL;
+	char* scriptPath = NULL;
+	char** workerArgs;
+	int workerArgc = 0;
+	int argi;
+	TranscriptReader reader;
+	TranscriptRecord* record;
+	BenchWorker worker;
+	BenchSamples deliveries = { NULL, 0, 0, 0 };
+	BenchSamples snapshots = { NULL, 0, 0, 0 };
+	unsigned long long computrons = 0;
+	size_t errors = 0;
+	size_t residentSize = 0;
+	double gc = -1;
+	double start, stop;
+	double pause = 0, paused = 0;
+	int complete = 1;
+	int error, status = 0;
+	struct rusage usage;
+	long peakResidentSize;
+
+	workerArgs = calloc(argc + 4, sizeof(char*));
+	if (!workerArgs)
+		return 1;
+	for (argi = 1; argi < argc; argi++) {
+		if (!strcmp(argv[argi], "--")) {
+			for (argi++; argi < argc; argi++)
+				workerArgs[3 + workerArgc++] = argv[argi];
+			break;
+		}
+		if (!strcmp(argv[argi], "-h")) {
+			fxPrintUsage();
+			return 0;
+		}
+		else if (!strcmp(argv[argi], "-e") && (argi + 1 < argc))
+			scriptPath = argv[++argi];
+		else if (!strcmp(argv[argi], "-p") && (argi + 1 < argc))
+			pause = atof(argv[++argi]) / 1000;
+		else if (!strcmp(argv[argi], "-o") && (argi + 1 < argc))
+			outputPath = argv[++argi];
+		else if (!strcmp(argv[argi], "-r") && (argi + 1 < argc))
+			snapshotPath = argv[++argi];
+		else if (!strcmp(argv[argi], "-w") && (argi + 1 < argc))
+			workerPath = argv[++argi];
+		else if ((argv[argi][0] != '-') && !transcriptPath)
+			transcriptPath = argv[argi];
+		else {
+			fxPrintUsage();
+			return 1;
+		}
+	}
+	if (!transcriptPath == !scriptPath) {
+		fxPrintUsage();
+		return 1;
+	}
+	if (transcriptPath) {
+		error = fxOpenTranscriptReader(&reader, transcriptPath);
+		if (error) {
+			fprintf(stderr, "cannot read transcript %s: %s\n", transcriptPath, strerror(error));
+			return 1;
+		}
+	}
+	workerArgs[0] = workerPath;
+	if (snapshotPath) {
+		workerArgs[1] = "-r";
+		workerArgs[2] = snapshotPath;
+	}
+	else {
+		// no options before the ones given after --
+		memmove(workerArgs + 1, workerArgs + 3, workerArgc * sizeof(char*));
+		workerArgs[1 + workerArgc] = NULL;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	error = fxStartWorker(&worker, workerArgs);
+	if (error) {
+		fprintf(stderr, "cannot start %s: %s\n", workerPath, strerror(error));
+		return 1;
+	}
+	if (scriptPath)
+		return fxEvaluate(&worker, scriptPath);
+
+	start = fxTime();
+	while (!error && (record = fxReadTranscript(&reader))) {
+		char* response = NULL;
+		size_t responseLength = 0;
+		double before, after;
+		char command;
+		if (!memcmp(record->type, TRANSCRIPT_DELIVERY, 4))
+			command = '?';
+		else if (!memcmp(record->type, TRANSCRIPT_EVALUATE, 4))
+			command = 'e';
+		else if (!memcmp(record->type, TRANSCRIPT_SNAPSHOT, 4))
+			command = 'w';
+		else if (!memcmp(record->type, TRANSCRIPT_DROPPED, 4)) {
+			// the worker cannot be replayed past missing records
+			complete = 0;
+			break;
+		}
+		else
+			continue;
+		if (pause > 0) {
+			// idle time, like a parent between deliveries
+			struct timespec delay;
+			delay.tv_sec = (time_t)pause;
+			delay.tv_nsec = (long)((pause - (double)delay.tv_sec) * 1e9);
+			while (nanosleep(&delay, &delay) && (errno == EINTR))
+				;
+			paused += pause;
+		}
+		before = fxTime();
+		if (command == 'w')
+			error = fxRequest(&worker, &reader, command, outputPath, strlen(outputPath), &response, &responseLength);
+		else
+			error = fxRequest(&worker, &reader, command, record->data, record->length, &response, &responseLength);
+		after = fxTime();
+		if (error)
+			break;
+		if (response[0] != '.')
+			errors++;
+		else {
+			char* p = strstr(response, "\"compute\":");
+			if (p && (command != 'w'))
+				computrons += strtoull(p + 10, NULL, 10);
+			p = strstr(response, "\"residentSize\":");
+			if (p) {
+				size_t size = strtoull(p + 15, NULL, 10);
+				if (residentSize < size)
+					residentSize = size;
+			}
+		}
+		if (command == 'w')
+			error = fxAddSample(&snapshots, after - before);
+		else
+			error = fxAddSample(&deliveries, after - before);
+		free(response);
+	}
+	stop = fxTime();
+	if (!error) {
+		// a full collection of the final heap
+		char* response = NULL;
+		size_t responseLength = 0;
+		double before = fxTime();
+		error = fxRequest(&worker, &reader, 'e', "gc()", 4, &response, &responseLength);
+		if (!error && (response[0] == '.'))
+			gc = fxTime() - before;
+		free(response);
+	}
+	if (error)
+		fprintf(stderr, "cannot replay transcript %s: %s\n", transcriptPath, strerror(error));
+	fxWriteNetString(worker.toWorker, 'q', NULL, 0);
+	fclose(worker.toWorker);
+	if (wait4(worker.pid, &status, 0, &usage) < 0)
+		memset(&usage, 0, sizeof(usage));
+#if defined(__APPLE__)
+	peakResidentSize = usage.ru_maxrss;
+#else
+	peakResidentSize = usage.ru_maxrss * 1024;
+#endif
+	fclose(worker.fromWorker);
+	fxCloseTranscriptReader(&reader);
+	if (error)
+		return 1;
+
+	printf("{\"transcript\":\"%s\",", transcriptPath);
+	printf("\"complete\":%s,", complete ? "true" : "false");
+	printf("\"deliveries\":%zu,", deliveries.count);
+	printf("\"errors\":%zu,", errors);
+	printf("\"seconds\":%.6f,", stop - start - paused);
+	printf("\"deliveriesPerSecond\":%.1f,", (deliveries.total > 0) ? deliveries.count / deliveries.total : 0);
+	printf("\"computrons\":%llu,", computrons);
+	printf("\"computronsPerSecond\":%.0f,", (deliveries.total > 0) ? computrons / deliveries.total : 0);
+	fxPrintSamples(stdout, "latency", &deliveries);
+	printf(",");
+	fxPrintSamples(stdout, "snapshots", &snapshots);
+	if (gc >= 0)
+		printf(",\"gc\":%.3f", gc * 1000);
+	else
+		printf(",\"gc\":null");
+	printf(",\"residentSize\":%zu", residentSize);
+	printf(",\"peakResidentSize\":%ld", peakResidentSize);
+	printf(",\"exit\":%d}\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	free(deliveries.values);
+	free(snapshots.values);
+	free(workerArgs);
+	return 0;
+}
+
+int fxAddSample(BenchSamples* samples, double value)
+{
+	if (samples->count == samples->capacity) {
+		size_t capacity = samples->capacity ? 2 * samples->capacity : 1024;
+		double* values = realloc(samples->values, capacity * sizeof(double));
+		if (!values)
+			return ENOMEM;
+		samples->values = values;
+		samples->capacity = capacity;
+	}
+	samples->values[samples->count++] = value;
+	samples->total += value;
+	return 0;
+}
+
+int fxEvaluate(BenchWorker* worker, char* path)
+{
+	FILE* file = fopen(path, "rb");
+	char* script = NULL;
+	char* response = NULL;
+	size_t length = 0, responseLength = 0;
+	long size;
+	int error = 0, status = 0;
+	if (!file)
+		error = errno;
+	else if (fseek(file, 0, SEEK_END) || ((size = ftell(file)) < 0) || fseek(file, 0, SEEK_SET))
+		error = errno;
+	else if (!(script = malloc(size + 1)))
+		error = ENOMEM;
+	else if (size && (fread(script, size, 1, file) != 1))
+		error = EIO;
+	else
+		length = size;
+	if (file)
+		fclose(file);
+	if (!error)
+		error = fxRequest(worker, NULL, 'e', script, length, &response, &responseLength);
+	if (error)
+		fprintf(stderr, "cannot evaluate %s: %s\n", path, strerror(error));
+	else if (response[0] != '.') {
+		fprintf(stderr, "%.*s\n", (int)responseLength, response);
+		error = EINVAL;
+	}
+	free(response);
+	free(script);
+	fxWriteNetString(worker->toWorker, 'q', NULL, 0);
+	fclose(worker->toWorker);
+	waitpid(worker->pid, &status, 0);
+	fclose(worker->fromWorker);
+	return error ? 1 : 0;
+}
+
+static int fxCompareSamples(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+double fxPercentile(BenchSamples* samples, double percent)
+{
+	// nearest rank, on sorted samples
+	size_t rank = (size_t)ceil(percent / 100 * samples->count);
+	if (rank < 1)
+		rank = 1;
+	return samples->values[rank - 1];
+}
+
+void fxPrintSamples(FILE* file, char* name, BenchSamples* samples)
+{
+	// in milliseconds
+	fprintf(file, "\"%s\":{\"count\":%zu", name, samples->count);
+	if (samples->count) {
+		qsort(samples->values, samples->count, sizeof(double), fxCompareSamples);
+		fprintf(file, ",\"total\":%.3f", samples->total * 1000);
+		fprintf(file, ",\"mean\":%.3f", samples->total * 1000 / samples->count);
+		fprintf(file, ",\"p50\":%.3f", fxPercentile(samples, 50) * 1000);
+		fprintf(file, ",\"p95\":%.3f", fxPercentile(samples, 95) * 1000);
+		fprintf(file, ",\"p99\":%.3f", fxPercentile(samples, 99) * 1000);
+		fprintf(file, ",\"max\":%.3f", samples->values[samples->count - 1] * 1000);
+	}
+	fprintf(file, "}");
+}
+
+void fxPrintUsage()
+{
+	printf("xsnap-bench [-h] [-o <snapshot>] [-p <ms>] [-r <snapshot>] [-w <worker>] <transcript> [-- <worker options>]\n");
+	printf("xsnap-bench [-h] [-r <snapshot>] [-w <worker>] -e <script> [-- <worker options>]\n");
+	printf("\t-h: print this help message\n");
+	printf("\t-e <script>: evaluate the script, and answer issueCommand messages with themselves\n");
+	printf("\t-o <snapshot>: where the worker writes the snapshots of the transcript (default to xsnap-bench.xss)\n");
+	printf("\t-p <ms>: pause <ms> milliseconds before every record, like a parent between deliveries (default to 0)\n");
+	printf("\t-r <snapshot>: start the worker from the snapshot\n");
+	printf("\t-w <worker>: path of the worker (default to xsnap-worker)\n");
+	printf("\t<worker options>: more options for the worker\n");
+}
+
+int fxRequest(BenchWorker* worker, TranscriptReader* reader, char command, void* data, size_t length, char** response, size_t* responseLength)
+{
+	int error = fxWriteNetString(worker->toWorker, command, data, length);
+	while (!error) {
+		TranscriptRecord* record;
+		error = fxReadNetString(worker->fromWorker, response, responseLength);
+		if (error)
+			break;
+		if ((*response)[0] != '?')
+			return 0;
+		if (!reader) {
+			// issueCommand: answer with the message
+			error = fxWriteNetString(worker->toWorker, '/', *response + 1, *responseLength - 1);
+			free(*response);
+			*response = NULL;
+			continue;
+		}
+		// issueCommand: answer with the recorded reply
+		free(*response);
+		*response = NULL;
+		record = fxReadTranscript(reader);
+		if (record && !memcmp(record->type, TRANSCRIPT_COMMAND, 4))
+			record = fxReadTranscript(reader);
+		if (!record || memcmp(record->type, TRANSCRIPT_REPLY, 4))
+			return EINVAL;
+		error = fxWriteNetString(worker->toWorker, '/', record->data, record->length);
+	}
+	return error;
+}
+
+int fxStartWorker(BenchWorker* worker, char** argv)
+{
+	int toWorker[2], fromWorker[2];
+	if (pipe(toWorker))
+		return errno;
+	if (pipe(fromWorker)) {
+		close(toWorker[0]);
+		close(toWorker[1]);
+		return errno;
+	}
+	worker->pid = fork();
+	if (worker->pid < 0)
+		return errno;
+	if (worker->pid == 0) {
+		// out of the way of 3 and 4 first
+		int in = fcntl(toWorker[0], F_DUPFD, 10);
+		int out = fcntl(fromWorker[1], F_DUPFD, 10);
+		close(toWorker[0]);
+		close(toWorker[1]);
+		close(fromWorker[0]);
+		close(fromWorker[1]);
+		if ((in < 0) || (out < 0) || (dup2(in, 3) < 0) || (dup2(out, 4) < 0))
+			_exit(127);
+		close(in);
+		close(out);
+		execvp(argv[0], argv);
+		fprintf(stderr, "cannot exec %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+	close(toWorker[0]);
+	close(fromWorker[1]);
+	worker->toWorker = fdopen(toWorker[1], "wb");
+	worker->fromWorker = fdopen(fromWorker[0], "rb");
+	if (!worker->toWorker || !worker->fromWorker)
+		return errno;
+	return 0;
+}
+
+double fxTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+int fxReadNetString(FILE* inStream, char** dest, size_t* len)
+{
+	size_t length = 0;
+	char* buffer;
+	int c;
+	while ((c = fgetc(inStream)) != ':') {
+		if ((c < '0') || (c > '9'))
+			return (c == EOF) ? EPIPE : EINVAL;
+		length = (10 * length) + (c - '0');
+	}
+	buffer = malloc(length + 1);
+	if (!buffer)
+		return ENOMEM;
+	if ((length && (fread(buffer, length, 1, inStream) != 1)) || (fgetc(inStream) != ',')) {
+		free(buffer);
+		return EPIPE;
+	}
+	buffer[length] = 0;
+	*dest = buffer;
+	*len = length;
+	return 0;
+}
+
+int fxWriteNetString(FILE* outStream, char prefix, void* buf, size_t length)
+{
+	if ((fprintf(outStream, "%zu:%c", length + 1, prefix) < 0)
+			|| (length && (fwrite(buf, length, 1, outStream) != 1))
+			|| (fputc(',', outStream) == EOF)
+			|| fflush(outStream))
+		return errno ? errno : EPIPE;
+	return 0;
+}
@@ -1,4 +1,12 @@
 #include "xsnap.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#if mxMacOSX
+#include <mach/mach.h>
+#endif
 
 // XS heap-snapshot contents depend upon the availability of
 // __has_builtin (e.g. xsRun.c mxCase(XS_CODE_MULTIPLY) , around line
@@ -14,7 +22,7 @@
 #error "xsnap requires __has_builtin (gcc>=10, e.g. Ubuntu-22.04), see https://github.com/Agoric/agoric-sdk/issues/7829"
 #endif
 
-#define SNAPSHOT_SIGNATURE "xsnap 1"
+#define SNAPSHOT_SIGNATURE "xsnap 2"
 #ifndef XSNAP_VERSION
 # error "You must define XSNAP_VERSION in the right Makefile"
 #endif
@@ -23,23 +31,27 @@
 #define XSNAP_TEST_RECORD 1
 #endif
 
-#if XSNAP_TEST_RECORD
+#include "xsnapTranscript.h"
 enum {
-	mxTestRecordJS = 1,
-	mxTestRecordJSON = 2,
-	mxTestRecordParam = 4,
-	mxTestRecordReply = 8,
+	mxRecordJS = 1,
+	mxRecordJSON = 2,
+	mxRecordParam = 4,
+	mxRecordReply = 8,
+	mxRecordCommand = 16,
 };
-int gxTestRecordParamIndex = 0;
-int gxTestRecordReplyIndex = 0;
-static void fxTestRecordArgs(int argc, char* argv[]);
-static void fxTestRecord(int flags, void* buffer, size_t length);
-#endif
+static void fxRecord(int flags, void* buffer, size_t length);
+static int fxStartRecording(int argc, char* argv[]);
+static void fxStopRecording(void);
 
 static void xsBuildAgent(xsMachine* the);
 static void xsPrintUsage();
 
-// static void xs_clearTimer(xsMachine* the);
+static void xs_clearTimer(xsMachine* the);
+static void xs_console_debug(xsMachine* the);
+static void xs_console_error(xsMachine* the);
+static void xs_console_info(xsMachine* the);
+static void xs_console_log(xsMachine* the);
+static void xs_console_warn(xsMachine* the);
 static void xs_currentMeterLimit(xsMachine* the);
 static void xs_gc(xsMachine* the);
 static void xs_issueCommand(xsMachine* the);
@@ -47,16 +59,27 @@ static void xs_performance_now(xsMachine* the);
 static void xs_print(xsMachine* the);
 static void xs_resetMeter(xsMachine* the);
 static void xs_setImmediate(xsMachine* the);
-// static void xs_setInterval(xsMachine* the);
-// static void xs_setTimeout(xsMachine* the);
+static void xs_setInterval(xsMachine* the);
+static void xs_setTimeout(xsMachine* the);
 
 static int fxReadNetString(FILE *inStream, char** dest, size_t* len);
 static char* fxReadNetStringError(int code);
-static int fxWriteOkay(FILE* outStream, xsUnsignedValue meterIndex, xsMachine *the, char* buf, size_t len);
-static int fxWriteNetString(FILE* outStream, char* prefix, char* buf, size_t len);
+static int fxWriteNetString(FILE* outStream, char* label, char* prefix, char* buf, size_t len);
 static char* fxWriteNetStringError(int code);
 
 extern xsIntegerValue fxGetCurrentHeapCount(xsMachine* the);
+extern size_t fxGetCurrentHeapSize(xsMachine* the);
+extern size_t fxGetCommittedSpace(xsMachine* the);
+extern void fxReleaseFreeChunks(xsMachine* the, size_t keep);
+extern void fxReleaseFreeSlots(xsMachine* the, size_t keep);
+extern void fxRightSizeCreation(xsCreation* creation, size_t chunksSize, size_t heapSize, int headroom);
+extern void fxEnterMachineThread(xsMachine* the);
+extern int fxWriteHeapCensus(xsMachine* the, void* stream);
+#if mxMetering
+extern void fxStartComputronProfiling(xsMachine* the);
+extern void fxSampleComputrons(xsMachine* the, xsUnsignedValue index);
+extern int fxStopComputronProfiling(xsMachine* the, void* stream);
+#endif
 
 extern void xs_textdecoder(xsMachine *the);
 extern void xs_textdecoder_decode(xsMachine *the);
@@ -75,10 +98,24 @@ extern void xs_base64_encode(xsMachine *the);
 extern void xs_base64_decode(xsMachine *the);
 extern void modInstallBase64(xsMachine *the);
 
+extern void xsnap_base64_encode(xsMachine *the);
+extern void xsnap_base64_decode(xsMachine *the);
+extern void fxInstallBase64(xsMachine *the);
+
+extern void xsnap_textdecoder_decode(xsMachine *the);
+extern void xsnap_textencoder_encode(xsMachine *the);
+extern void fxInstallText(xsMachine *the);
+
+extern void xsnap_marshal_encode(xsMachine *the);
+extern void xsnap_marshal_decode(xsMachine *the);
+extern void fxInstallMarshal(xsMachine *the);
+
 // The order of the callbacks materially affects how they are introduced to
 // code that runs from a snapshot, so must be consistent in the face of
-// upgrade.
-#define mxSnapshotCallbackCount 18
+// upgrade. Adding callbacks changes the layout of snapshots, so it bumps
+// SNAPSHOT_SIGNATURE and the upgrade name printed by xsnap-worker -n.
+// "xsnap 2" added the timers (18-20), console (21-25) and Marshal (26-27).
+#define mxSnapshotCallbackCount 28
 xsCallback gxSnapshotCallbacks[mxSnapshotCallbackCount] = {
 	xs_issueCommand, // 0
 	xs_print, // 1
@@ -89,27 +126,38 @@ xsCallback gxSnapshotCallbacks[mxSnapshotCallbackCount] = {
 	xs_resetMeter, // 6
 
 	xs_textdecoder, // 7
-	xs_textdecoder_decode, // 8
+	xsnap_textdecoder_decode, // 8
 	xs_textdecoder_get_encoding, // 9
 	xs_textdecoder_get_ignoreBOM, // 10
 	xs_textdecoder_get_fatal, // 11
 
 	xs_textencoder, // 12
-	xs_textencoder_encode, // 13
+	xsnap_textencoder_encode, // 13
 	xs_textencoder_encodeInto, // 14
 
-	xs_base64_encode, // 15
-	xs_base64_decode, // 16
+	xsnap_base64_encode, // 15
+	xsnap_base64_decode, // 16
 
 	fx_harden, // 17
-	// fx_setInterval,
-	// fx_setTimeout,
-	// fx_clearTimer,
+
+	xs_setInterval, // 18
+	xs_setTimeout, // 19
+	xs_clearTimer, // 20
+
+	xs_console_debug, // 21
+	xs_console_error, // 22
+	xs_console_info, // 23
+	xs_console_log, // 24
+	xs_console_warn, // 25
+
+	xsnap_marshal_encode, // 26
+	xsnap_marshal_decode, // 27
 };
 
 typedef struct {
 	FILE *file;
 	int size;
+	xsSnapshotIndex* index;
 } SnapshotStream;
 
 static int fxSnapshotRead(void* stream, void* address, size_t size)
@@ -117,11 +165,91 @@ static int fxSnapshotRead(void* stream, void* address, size_t size)
 	return (fread(address, size, 1, stream) == 1) ? 0 : errno;
 }
 
+static int fxSnapshotWrite(void* stream, void* address, size_t size);
+
+static void fxInitializeSnapshot(xsSnapshot* snapshot)
+{
+	memset(snapshot, 0, sizeof(xsSnapshot));
+	snapshot->signature = SNAPSHOT_SIGNATURE;
+	snapshot->signatureLength = sizeof(SNAPSHOT_SIGNATURE) - 1;
+	snapshot->callbacks = gxSnapshotCallbacks;
+	snapshot->callbacksLength = mxSnapshotCallbackCount;
+	snapshot->read = fxSnapshotRead;
+	snapshot->write = fxSnapshotWrite;
+}
+
+// Restoring with headroom: the creation parameters read from the CREA atom
+// are shrunk to the sizes of the BLOC and HEAP atoms that follow it, plus
+// gxRestoreHeadroom percent. That requires peeking ahead, so seekable
+// streams only; pipes restore with the saved parameters. The machine then
+// grows, collects and writes snapshots differently than one restored with
+// the saved parameters, so -H is for workers that need not agree on results.
+static int gxRestoreHeadroom = -1;
+
+// The stream of a restore with headroom: where the reader is, relative to
+// the CREA atom, is kept with the file, so restores can run in parallel.
+typedef struct {
+	FILE* file;
+	int state; // 0: before the CREA atom, 1: in it, 2: after it
+} RestoreStream;
+
+// Indexing snapshots: when enabled, the atoms are indexed while the snapshot
+// is written, and an INDX atom follows the XS_M container, for tools to seek
+// to an atom. Snapshots are then no longer byte for byte what XS wrote.
+static xsBooleanValue gxIndexSnapshots = 0;
+
+static size_t fxSnapshotPeekAtom(FILE* file, char* type)
+{
+	unsigned char header[8];
+	if (fread(header, sizeof(header), 1, file) != 1)
+		return 0;
+	if (memcmp(header + 4, type, 4))
+		return 0;
+	return (((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3]) - sizeof(header);
+}
+
+static int fxSnapshotReadRightSized(void* stream, void* address, size_t size)
+{
+	RestoreStream* restoreStream = stream;
+	FILE* file = restoreStream->file;
+	int error = fxSnapshotRead(file, address, size);
+	if (error)
+		return error;
+	if (restoreStream->state == 0) {
+		if ((size == 8) && !memcmp((char*)address + 4, "CREA", 4))
+			restoreStream->state = 1;
+	}
+	else if (restoreStream->state == 1) {
+		restoreStream->state = 2;
+		if (size == sizeof(xsCreation)) {
+			// the BLOC atom follows the creation parameters, the profile ID and the tag
+			long position = ftell(file);
+			size_t chunksSize, heapSize;
+			if (position < 0)
+				return 0;
+			if (fseek(file, sizeof(xsIdentifier) + sizeof(xsIntegerValue), SEEK_CUR) == 0) {
+				chunksSize = fxSnapshotPeekAtom(file, "BLOC");
+				if (chunksSize && (fseek(file, (long)chunksSize, SEEK_CUR) == 0)) {
+					heapSize = fxSnapshotPeekAtom(file, "HEAP");
+					if (heapSize)
+						fxRightSizeCreation(address, chunksSize, heapSize, gxRestoreHeadroom);
+				}
+			}
+			clearerr(file);
+			if (fseek(file, position, SEEK_SET))
+				return errno;
+		}
+	}
+	return 0;
+}
+
 static int fxSnapshotWrite(void* stream, void* address, size_t size)
 {
 	SnapshotStream* snapshotStream = stream;
 	size_t written = fwrite(address, size, 1, snapshotStream->file);
 	snapshotStream->size += size * written;
+	if (snapshotStream->index && written)
+		xsIndexSnapshot(snapshotStream->index, address, size);
 	return (written == 1) ? 0 : errno;
 }
 
@@ -141,9 +269,9 @@ static xsIntegerValue xsnapInstrumentValues[xsnapInstrumentCount] = {
 #if mxMetering
 #define xsBeginCrank(_THE, _LIMIT) \
 	(xsSetCurrentMeter(_THE, 0), \
-	gxCurrentMeter = _LIMIT)
+	((MachineState*)xsGetContext(_THE))->currentMeter = _LIMIT)
 #define xsEndCrank(_THE) \
-	(gxCurrentMeter = 0, \
+	(((MachineState*)xsGetContext(_THE))->currentMeter = 0, \
 	fxGetCurrentMeter(_THE))
 #else
 	#define xsBeginCrank(_THE, _LIMIT)
@@ -151,20 +279,96 @@ static xsIntegerValue xsnapInstrumentValues[xsnapInstrumentCount] = {
 #endif
 
 static xsUnsignedValue gxCrankMeteringLimit = 0;
-static xsUnsignedValue gxCurrentMeter = 0;
-xsBooleanValue fxMeteringCallback(xsMachine* the, xsUnsignedValue index)
-{
-	if (gxCurrentMeter > 0 && index > gxCurrentMeter) {
-		// Just throw right out of the main loop and exit.
-		return 0;
-	}
-	// fprintf(stderr, "metering up to %d\n", index);
-	return 1;
-}
+static xsUnsignedValue gxMeteringInterval = 0;
 static xsBooleanValue gxMeteringPrint = 0;
 
-static FILE *fromParent;
-static FILE *toParent;
+// Computron profile: with -c, the computrons of every delivery are charged to
+// the functions running at each metering check, and the profile is written
+// to that path when the worker exits.
+static char* gxComputronProfilePath = NULL;
+
+// Recording: with -R, and by default in builds with XSNAP_TEST_RECORD, the
+// deliveries, the issueCommand messages and their replies are copied into a
+// ring buffer of gxRecordCapacity bytes, that a thread appends to a
+// transcript. When the buffer is full, records are dropped and the
+// transcript tells how many.
+static char* gxRecordPath = NULL;
+static size_t gxRecordCapacity = 16 * 1024 * 1024;
+static xsBooleanValue gxRecording = 0;
+static TranscriptRecorder gxRecorder;
+
+// Multi-machine mode: one process hosts many machines, created, addressed
+// and deleted by the parent with a machine id prefix on every netstring.
+static xsBooleanValue gxMultiMachine = 0;
+
+// Thread pool mode: with -T, machines run on that many threads.
+static int gxThreadCount = 0;
+
+// Zygote mode: with -Z, the worker creates or restores its machine once, then
+// forks a child with a copy-on-write copy of it for every request received on
+// a unix socket. The request carries the pipes of the child as SCM_RIGHTS.
+static char* gxZygotePath = NULL;
+
+// Control channel: with -C, a thread serves requests on that fd while
+// deliveries run, so the parent can query the worker or cancel a delivery
+// without waiting for its response. Deliveries register themselves as
+// running, under the mutex, only when there is a control channel.
+static int gxControlFD = -1;
+
+// Console: print and console.* append records to a buffer of the machine,
+// written in one batch when a command completes, before a response goes to
+// the parent, or when the buffer exceeds gxConsoleThreshold bytes. With -L,
+// records are lines of JSON written to that fd, with the level, the wall-clock
+// time, the meter index and the machine id; otherwise they are plain text on
+// stdout. The mutex keeps the batches of pool threads whole.
+static int gxConsoleFD = -1;
+static size_t gxConsoleThreshold = 64 * 1024;
+static pthread_mutex_t gxConsoleMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Deadline: with -D, a delivery that runs longer than that many milliseconds
+// of wall-clock time is aborted. The metering callback reads the monotonic
+// clock once every gxDeadlineStride calls, about every 10000 computrons.
+static xsUnsignedValue gxDeadline = 0;
+static xsUnsignedValue gxDeadlineStride = 1;
+static struct {
+	pthread_mutex_t mutex;
+	struct sxMachineState* running;
+	unsigned long long deliveries;
+	unsigned long long cancellations;
+	// the latest p or P request, applied by every machine when its next
+	// command starts, and how many such requests were received
+	char* profileRequest;
+	unsigned int profileRequests;
+} gxControl = {
+	PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, 0
+};
+
+static xsCreation gxCreation = {
+	32 * 1024 * 1024,	/* initialChunkSize */
+	4 * 1024 * 1024,	/* incrementalChunkSize */
+	256 * 1024,			/* initialHeapCount */
+	128 * 1024,			/* incrementalHeapCount */
+	4096,				/* stackCount */
+	32000, 				/* initialKeyCount */
+	8000,				/* incrementalKeyCount */
+	1993,				/* nameModulo */
+	127,				/* symbolModulo */
+	8192 * 1024,		/* parserBufferSize */
+	1993,				/* parserTableModulo */
+};
+
+// Idle-time collection: when non-zero, the worker collects garbage after a
+// command once the heap has grown by that many bytes since the last
+// collection. The decision depends only on the heap, never on timing or on
+// what the parent has sent, so workers that replay the same commands collect
+// at the same points.
+static size_t gxIdleCollectThreshold = 0;
+
+// Releasing free memory: when enabled, free chunk pages beyond the
+// hysteresis are returned to the OS after every delivery, and empty slot
+// segments after every collection the worker triggers itself.
+static xsBooleanValue gxReleaseFreeSpace = 0;
+static size_t gxReleaseHysteresis = 0;
 
 typedef enum {
 	E_UNKNOWN_ERROR = -1,
@@ -177,44 +381,232 @@ typedef enum {
 	E_UNHANDLED_EXCEPTION = 15,
 	E_NO_MORE_KEYS = 16,
 	E_TOO_MUCH_COMPUTATION = 17,
+	// not XS exits
+	E_CANCELLED = 20,
+	E_DEADLINE_EXCEEDED = 21,
 } ExitCode;
 
 // 250 syscalls
 #define MAX_TIMESTAMPS 502
-static struct timeval timestamps[MAX_TIMESTAMPS];
-static int num_timestamps;
-static unsigned int timestamps_overrun;
-static void resetTimestamps() {
-	timestamps_overrun = 0;
-	num_timestamps = 0;
+
+// Resource usage of the current delivery: thread CPU time and page faults
+// are sampled when the delivery is received and reported as deltas, while
+// the resident set size is reported as is.
+typedef struct {
+	unsigned long long cpuTime; // microseconds
+	unsigned long long minorFaults;
+	unsigned long long majorFaults;
+} txUsage;
+
+// Everything a delivery needs to know about its machine. The default mode
+// has one, multi-machine mode one per machine. Host functions and the
+// metering callback find it with xsGetContext.
+// A command queued for a machine by the thread pool reader.
+typedef struct sxCommand Command;
+struct sxCommand {
+	Command* next;
+	char* nsbuf;
+	char* command; // after the machine id
+	size_t length;
+	struct timeval received;
+};
+
+typedef struct sxMachineState MachineState;
+struct sxMachineState {
+	MachineState* next;
+	xsMachine* machine;
+	xsIntegerValue id;
+	char label[16]; // "<id> " in multi-machine mode, "" otherwise
+	FILE* fromParent;
+	FILE* toParent;
+	xsUnsignedValue crankMeteringLimit;
+	xsUnsignedValue currentMeter;
+	int error;
+	size_t idleCollectBaseline;
+	// the heap size when the last command completed: it shrinks only when XS collects
+	size_t releaseHeapSize;
+	txUsage deliveryUsage;
+	int num_timestamps;
+	unsigned int timestamps_overrun;
+	struct timeval timestamps[MAX_TIMESTAMPS];
+	// thread pool mode: the mutex protects the commands, the reply and the flags
+	pthread_mutex_t mutex;
+	pthread_cond_t replied;
+	Command* firstCommand;
+	char* reply;
+	size_t replyLength;
+	xsBooleanValue scheduled;
+	xsBooleanValue closed;
+	int thread;
+	// control channel: the deliveries that are running, and since when
+	MachineState* nextRunning;
+	struct timeval runningSince;
+	int cancelled;
+	struct timespec deadline;
+	xsUnsignedValue deadlineCount;
+	xsBooleanValue deadlineExceeded;
+	xsBooleanValue profiling;
+	// profiler started by the p command: 't' for time, 'c' for computrons
+	char profiler;
+	// the control profile requests this machine has seen
+	unsigned int profileRequests;
+	// console records not written yet
+	char* console;
+	size_t consoleLength;
+	size_t consoleSize;
+};
+
+static MachineState* fxNewMachineState(xsIntegerValue id);
+static void fxDeleteMachineState(MachineState* state);
+static void fxFlushConsole(MachineState* state);
+static void fxCreateMachine(MachineState* state);
+static int fxRestoreMachine(MachineState* state, char* path);
+static void fxSetUpMachine(MachineState* state);
+static xsUnsignedValue fxHandleCommand(MachineState* state, char command, char* nsbuf, size_t nslen);
+static void fxCompleteCommand(MachineState* state, xsUnsignedValue meterIndex);
+static void fxCollectIfIdle(MachineState* state);
+static void fxReleaseFreeSpace(MachineState* state);
+static void fxSetProfilerInterval(MachineState* state);
+static int fxWriteComputronProfile(MachineState* state, char* path);
+static char* fxBeginProfiler(MachineState* state, char* kind);
+static void fxEndProfiler(MachineState* state, FILE* stream);
+static void fxStartProfiler(MachineState* state, char* kind);
+static void fxStopProfiler(MachineState* state);
+static void fxWriteCensus(MachineState* state);
+static int fxExitCodeFromAbortStatus(MachineState* state, int status);
+static xsBooleanValue fxDeliver(MachineState* state, char* command, size_t nslen);
+static int fxRunMachines();
+static int fxRunMachinePool();
+static int fxReceiveFileDescriptors(int connection, char* command, int* fds);
+static void fxServeZygote(char* path);
+static void fxEnterDelivery(MachineState* state);
+static void fxApplyProfileRequest(MachineState* state, char* request);
+static void fxExitDelivery(MachineState* state);
+static void fxStartControl(int fd);
+static void* fxServeControl(void* it);
+static int fxWriteOkay(MachineState* state, xsUnsignedValue meterIndex, char* buf, size_t len);
+
+xsBooleanValue fxMeteringCallback(xsMachine* the, xsUnsignedValue index)
+{
+	MachineState* state = xsGetContext(the);
+#if mxMetering
+	if (state->profiling)
+		fxSampleComputrons(the, index);
+#endif
+	if (state->currentMeter > 0 && index > state->currentMeter) {
+		// Just throw right out of the main loop and exit.
+		return 0;
+	}
+	if (__atomic_load_n(&state->cancelled, __ATOMIC_RELAXED)) {
+		// cancelled on the control channel
+		return 0;
+	}
+	if (gxDeadline && (++state->deadlineCount >= gxDeadlineStride)) {
+		struct timespec now;
+		state->deadlineCount = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec > state->deadline.tv_sec) || ((now.tv_sec == state->deadline.tv_sec) && (now.tv_nsec >= state->deadline.tv_nsec))) {
+			state->deadlineExceeded = 1;
+			return 0;
+		}
+	}
+	// fprintf(stderr, "metering up to %d\n", index);
+	return 1;
+}
+
+static void resetTimestamps(MachineState* state) {
+	state->timestamps_overrun = 0;
+	state->num_timestamps = 0;
 	// on 64-bit platforms, 'struct timeval' usually needs 8+8=16 bytes
 	//printf("sizeof(time_t): %ld\n", sizeof(time_t));
 	//printf("sizeof(time_suseconts_t): %ld\n", sizeof(suseconds_t));
 }
-static void recordTimestamp() {
-	if (num_timestamps < MAX_TIMESTAMPS) {
-		gettimeofday(&(timestamps[num_timestamps]), NULL);
-		num_timestamps += 1;
+static void recordTimestamp(MachineState* state) {
+	if (state->num_timestamps < MAX_TIMESTAMPS) {
+		gettimeofday(&(state->timestamps[state->num_timestamps]), NULL);
+		state->num_timestamps += 1;
 	} else {
-		timestamps_overrun = 1;
+		state->timestamps_overrun = 1;
+	}
+}
+
+static void sampleUsage(txUsage* usage) {
+	struct timespec ts;
+	struct rusage ru;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		usage->cpuTime = ((unsigned long long)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	else
+		usage->cpuTime = 0;
+#ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+#else
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#endif
+		usage->minorFaults = ru.ru_minflt;
+		usage->majorFaults = ru.ru_majflt;
+	}
+	else {
+		usage->minorFaults = 0;
+		usage->majorFaults = 0;
 	}
 }
+static void recordUsage(MachineState* state) {
+	sampleUsage(&(state->deliveryUsage));
+}
+#if mxLinux
+// /proc/self/statm, opened once per process: every response reads it again
+static int gxResidentFD = -1;
+static size_t gxResidentPageSize = 0;
+#endif
+static void openResidentSize() {
+#if mxLinux
+	// /proc/self is the process that opens it: forked workers open it again
+	if (gxResidentFD >= 0)
+		close(gxResidentFD);
+	gxResidentFD = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+	gxResidentPageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+static size_t residentSize() {
+#if mxLinux
+	unsigned long pages = 0, resident = 0;
+	char buffer[128];
+	ssize_t length;
+	if (gxResidentFD < 0)
+		return 0;
+	length = pread(gxResidentFD, buffer, sizeof(buffer) - 1, 0);
+	if (length <= 0)
+		return 0;
+	buffer[length] = 0;
+	if (sscanf(buffer, "%lu %lu", &pages, &resident) != 2)
+		return 0;
+	return (size_t)resident * gxResidentPageSize;
+#elif mxMacOSX
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+		return (size_t)info.resident_size;
+	return 0;
+#else
+	return 0;
+#endif
+}
 
 // 2^64 is 18446744073709551616 , which is 20 characters long
 #define DIGITS_FOR_64 20
 // [AA.AA,BB.BB,CC.CC]\0
-static char timestampBuffer[1 + MAX_TIMESTAMPS * (DIGITS_FOR_64 + 1 + 6 + 1) + 1];
+#define TIMESTAMP_BUFFER_SIZE (1 + MAX_TIMESTAMPS * (DIGITS_FOR_64 + 1 + 6 + 1) + 1)
 // over provisioning by considering all "sec" values as the max printed length.
 // While the last timestamps does not have a trailing comma, the payload ends
 // with both a closing square bracket and a null byte.
 
-static char *renderTimestamps() {
-	// return pointer to static string buffer with '[NN.NN,NN.NN]', or NULL
+static char *renderTimestamps(MachineState* state, char* timestampBuffer) {
+	// return pointer to timestampBuffer with '[NN.NN,NN.NN]', or NULL
 	int size, i, wrote;
 	char *p = timestampBuffer;
-	size = sizeof(timestampBuffer); // holds all numbers, commas, and \0
+	size = TIMESTAMP_BUFFER_SIZE; // holds all numbers, commas, and \0
 	*(p++) = '['; size--;
-	for (i = 0; i < num_timestamps; i++) {
+	for (i = 0; i < state->num_timestamps; i++) {
 		// snprintf() returns "the number of characters that would have
 		// been printed if the size were unlimited, not including the
 		// final \0". It writes at most size-1 characters, then writes
@@ -225,8 +617,8 @@ static char *renderTimestamps() {
 		// the expected number of bits behind the variadic args reference.
 		// We do the same for tv_sec out of an outrageous abundance of caution.
 		wrote = snprintf(p, size, "%lu.%06lu",
-						 (unsigned long)timestamps[i].tv_sec,
-						 (unsigned long)timestamps[i].tv_usec);
+						 (unsigned long)state->timestamps[i].tv_sec,
+						 (unsigned long)state->timestamps[i].tv_usec);
 		if (wrote > size) {
 			return NULL;
 		}
@@ -235,7 +627,7 @@ static char *renderTimestamps() {
 		if (size < 2) { // 2 is enough for "]\0", but 1 is not
 			return NULL;
 		}
-		if (i+1 < num_timestamps) {
+		if (i+1 < state->num_timestamps) {
 			// 2 is also enough for a comma
 			*(p++) = ','; size--;
 		}
@@ -259,36 +651,84 @@ int main(int argc, char* argv[])
 	int interval = 0;
 	int parserBufferSize = 8192 * 1024;
 
-	xsSnapshot snapshot = {
-		SNAPSHOT_SIGNATURE,
-		sizeof(SNAPSHOT_SIGNATURE) - 1,
-		gxSnapshotCallbacks,
-		mxSnapshotCallbackCount,
-		fxSnapshotRead,
-		fxSnapshotWrite,
-		NULL,
-		0,
-		NULL,
-		NULL,
-		NULL,
-		0,
-		NULL
-	};
-
+	MachineState* state;
 	xsMachine* machine;
-	char *path;
-
-#if XSNAP_TEST_RECORD
-	fxTestRecordArgs(argc, argv);
-#endif
 
+	openResidentSize();
 	for (argi = 1; argi < argc; argi++) {
 		if (argv[argi][0] != '-')
 			continue;
 		if (!strcmp(argv[argi], "-h")) {
 			xsPrintUsage();
 			return 0;
-		} else if (!strcmp(argv[argi], "-i")) {
+		}
+		else if (!strcmp(argv[argi], "-b")) {
+			argi++;
+			if ((argi < argc) && (atoi(argv[argi]) > 0))
+				gxRecordCapacity = (size_t)1024 * atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-c")) {
+#if mxMetering
+			argi++;
+			if (argi < argc)
+				gxComputronProfilePath = argv[argi];
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+#else
+			fprintf(stderr, "%s flag not implemented; mxMetering is not enabled\n", argv[argi]);
+			return E_BAD_USAGE;
+#endif
+		}
+		else if (!strcmp(argv[argi], "-C")) {
+			argi++;
+			if (argi < argc)
+				gxControlFD = atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-D")) {
+#if mxMetering
+			argi++;
+			if ((argi < argc) && (atoi(argv[argi]) > 0))
+				gxDeadline = atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+#else
+			fprintf(stderr, "%s flag not implemented; mxMetering is not enabled\n", argv[argi]);
+			return E_BAD_USAGE;
+#endif
+		}
+		else if (!strcmp(argv[argi], "-g")) {
+			argi++;
+			if (argi < argc)
+				gxIdleCollectThreshold = (size_t)1024 * atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-H")) {
+			argi++;
+			if (argi < argc)
+				gxRestoreHeadroom = atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-I"))
+			gxIndexSnapshots = 1;
+		else if (!strcmp(argv[argi], "-i")) {
 			argi++;
 			if (argi < argc)
 				interval = atoi(argv[argi]);
@@ -297,6 +737,17 @@ int main(int argc, char* argv[])
 				return E_BAD_USAGE;
 			}
 		}
+		else if (!strcmp(argv[argi], "-k")) {
+			argi++;
+			if (argi < argc) {
+				gxReleaseFreeSpace = 1;
+				gxReleaseHysteresis = (size_t)1024 * atoi(argv[argi]);
+			}
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
 		else if (!strcmp(argv[argi], "-l")) {
 #if mxMetering
 			argi++;
@@ -311,6 +762,17 @@ int main(int argc, char* argv[])
 			return E_BAD_USAGE;
 #endif
 		}
+		else if (!strcmp(argv[argi], "-L")) {
+			argi++;
+			if (argi < argc)
+				gxConsoleFD = atoi(argv[argi]);
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-M"))
+			gxMultiMachine = 1;
 		else if (!strcmp(argv[argi], "-p"))
 			gxMeteringPrint = 1;
 		else if (!strcmp(argv[argi], "-r")) {
@@ -322,6 +784,15 @@ int main(int argc, char* argv[])
 				return E_BAD_USAGE;
 			}
 		}
+		else if (!strcmp(argv[argi], "-R")) {
+			argi++;
+			if (argi < argc)
+				gxRecordPath = argv[argi];
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
 		else if (!strcmp(argv[argi], "-s")) {
 			argi++;
 			if (argi < argc)
@@ -331,6 +802,26 @@ int main(int argc, char* argv[])
 				return E_BAD_USAGE;
 			}
 		}
+		else if (!strcmp(argv[argi], "-T")) {
+			argi++;
+			if ((argi < argc) && (atoi(argv[argi]) > 0)) {
+				gxThreadCount = atoi(argv[argi]);
+				gxMultiMachine = 1;
+			}
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
+		else if (!strcmp(argv[argi], "-Z")) {
+			argi++;
+			if (argi < argc)
+				gxZygotePath = argv[argi];
+			else {
+				xsPrintUsage();
+				return E_BAD_USAGE;
+			}
+		}
 		else if (!strcmp(argv[argi], "-v")) {
 			char version[16];
 			xsVersion(version, sizeof(version));
@@ -338,72 +829,98 @@ int main(int argc, char* argv[])
 			return E_SUCCESS;
 		}
 		else if (!strcmp(argv[argi], "-n")) {
-			printf("agoric-upgrade-10\n");
+			printf("agoric-upgrade-11\n");
 			return E_SUCCESS;
 		} else {
 			xsPrintUsage();
 			return E_BAD_USAGE;
 		}
 	}
-	xsCreation _creation = {
-		32 * 1024 * 1024,	/* initialChunkSize */
-		4 * 1024 * 1024,	/* incrementalChunkSize */
-		256 * 1024,			/* initialHeapCount */
-		128 * 1024,			/* incrementalHeapCount */
-		4096,				/* stackCount */
-		32000, 				/* initialKeyCount */
-		8000,				/* incrementalKeyCount */
-		1993,				/* nameModulo */
-		127,				/* symbolModulo */
-		parserBufferSize,	/* parserBufferSize */
-		1993,				/* parserTableModulo */
-	};
-	xsCreation* creation = &_creation;
+	gxCreation.parserBufferSize = parserBufferSize;
 
 	if (gxCrankMeteringLimit) {
 		if (interval == 0)
 			interval = 1;
 	}
+	if (gxControlFD >= 0) {
+		if (gxZygotePath) {
+			fprintf(stderr, "-C cannot be used with -Z\n");
+			return E_BAD_USAGE;
+		}
+		// cancellation is checked by the metering callback
+		if (interval == 0)
+			interval = 10000;
+		fxStartControl(gxControlFD);
+	}
+	if (gxComputronProfilePath) {
+		if (gxMultiMachine || gxZygotePath) {
+			fprintf(stderr, "-c cannot be used with -M, -T or -Z\n");
+			return E_BAD_USAGE;
+		}
+		// sample at every metering check
+		if (interval == 0)
+			interval = 1;
+	}
+	if (gxRecordPath) {
+		if (gxMultiMachine || gxZygotePath) {
+			fprintf(stderr, "-R cannot be used with -M, -T or -Z\n");
+			return E_BAD_USAGE;
+		}
+		if (fxStartRecording(argc, argv))
+			return E_IO_ERROR;
+	}
+#if XSNAP_TEST_RECORD
+	else if (!gxMultiMachine && !gxZygotePath)
+		fxStartRecording(argc, argv);
+#endif
+	if (gxDeadline) {
+		// the deadline is checked by the metering callback
+		if (interval == 0)
+			interval = 10000;
+		gxDeadlineStride = (interval < 10000) ? 10000 / interval : 1;
+	}
+	gxMeteringInterval = interval;
 	xsInitializeSharedCluster();
-	if (argr) {
-		char *path = argv[argr];
-		if (path[0] == '@') {
-			int fd = atoi(path + 1);
-			int tmpfd = dup(fd);
-			if (tmpfd < 0) {
-				snapshot.stream = NULL;
-			} else {
-				snapshot.stream = fdopen(tmpfd, "rb");
-			}
-		} else {
-			snapshot.stream = fopen(path, "rb");
+	if (gxMultiMachine) {
+		if (argr) {
+			fprintf(stderr, "-r cannot be used with -M, restore machines with the c command\n");
+			return E_BAD_USAGE;
 		}
-		if (snapshot.stream) {
-			machine = xsReadSnapshot(&snapshot, "xsnap", NULL);
-			fclose(snapshot.stream);
+		if (gxZygotePath) {
+			fprintf(stderr, "-Z cannot be used with -M\n");
+			return E_BAD_USAGE;
 		}
-		else
-			snapshot.error = errno;
-		if (snapshot.error) {
-			fprintf(stderr, "cannot read snapshot %s: %s\n", argv[argr], strerror(snapshot.error));
+		error = gxThreadCount ? fxRunMachinePool() : fxRunMachines();
+		fxTerminateSharedCluster();
+		return error;
+	}
+	state = fxNewMachineState(0);
+	if (argr) {
+		error = fxRestoreMachine(state, argv[argr]);
+		if (error) {
+			fprintf(stderr, "cannot read snapshot %s: %s\n", argv[argr], strerror(error));
 			return E_IO_ERROR;
 		}
 	}
-	else {
-		machine = xsCreateMachine(creation, "xsnap", NULL);
-		xsBuildAgent(machine);
+	else
+		fxCreateMachine(state);
+	machine = state->machine;
+#if mxMetering
+	if (gxComputronProfilePath) {
+		fxStartComputronProfiling(machine);
+		state->profiling = 1;
 	}
-	if (!(fromParent = fdopen(3, "rb"))) {
+#endif
+	if (gxZygotePath)
+		fxServeZygote(gxZygotePath); // returns in children only
+	if (!(state->fromParent = fdopen(3, "rb"))) {
 		fprintf(stderr, "fdopen(3) from parent failed\n");
 		c_exit(E_IO_ERROR);
 	}
-	if (!(toParent = fdopen(4, "wb"))) {
+	if (!(state->toParent = fdopen(4, "wb"))) {
 		fprintf(stderr, "fdopen(4) to parent failed\n");
 		c_exit(E_IO_ERROR);
 	}
-#if mxInstrument
-	xsDescribeInstrumentation(machine, xsnapInstrumentCount, xsnapInstrumentNames, xsnapInstrumentUnits);
-#endif
 	xsBeginMetering(machine, fxMeteringCallback, interval);
 	{
 		fd_set rfds;
@@ -426,18 +943,18 @@ int main(int argc, char* argv[])
 			}
 			#endif
 			// By default, use the infinite meter.
-			gxCurrentMeter = 0;
+			state->currentMeter = 0;
 
 			xsUnsignedValue meterIndex = 0;
 			char* nsbuf;
 			size_t nslen;
-			resetTimestamps();
-			int readError = fxReadNetString(fromParent, &nsbuf, &nslen);
-			recordTimestamp(); // after delivery received from parent
-			int writeError = 0;
+			resetTimestamps(state);
+			int readError = fxReadNetString(state->fromParent, &nsbuf, &nslen);
+			recordTimestamp(state); // after delivery received from parent
+			recordUsage(state);
 
 			if (readError != 0) {
-				if (feof(fromParent)) {
+				if (feof(state->fromParent)) {
 					break;
 				} else {
 					fprintf(stderr, "%s\n", fxReadNetStringError(readError));
@@ -446,200 +963,17 @@ int main(int argc, char* argv[])
 			}
 			char command = *nsbuf;
 			// fprintf(stderr, "command: len %d %c arg: %s\n", nslen, command, nsbuf + 1);
-			switch(command) {
-			case 'R': // isReady
-				fxWriteNetString(toParent, ".", "", 0);
-				break;
-			case '?':
-			case 'e':
-				xsBeginCrank(machine, gxCrankMeteringLimit);
-				char* response = NULL;
-				xsIntegerValue responseLength = 0;
-				error = 0;
-				xsBeginHost(machine);
-				{
-					xsVars(3);
-					xsTry {
-						if (command == '?') {
-							#if XSNAP_TEST_RECORD
-								fxTestRecord(mxTestRecordJSON | mxTestRecordParam, nsbuf + 1, nslen - 1);
-							#endif
-							// TODO: can we avoid a copy?
-							xsVar(0) = xsArrayBuffer(nsbuf + 1, nslen - 1);
-							xsVar(1) = xsCall1(xsGlobal, xsID("handleCommand"), xsVar(0));
-						} else {
-							#if XSNAP_TEST_RECORD
-								fxTestRecord(mxTestRecordJS | mxTestRecordParam, nsbuf + 1, nslen - 1);
-							#endif
-							xsVar(0) = xsStringBuffer(nsbuf + 1, nslen - 1);
-							xsVar(1) = xsCall1(xsGlobal, xsID("eval"), xsVar(0));
-						}
-					}
-					xsCatch {
-						if (xsTypeOf(xsException) != xsUndefinedType) {
-							// fprintf(stderr, "%c: %s\n", command, xsToString(xsException));
-							error = E_UNHANDLED_EXCEPTION;
-							xsVar(1) = xsException;
-							xsException = xsUndefined;
-						}
-					}
-				}
-				fxRunLoop(machine);
-				meterIndex = xsEndCrank(machine);
-				{
-					if (error) {
-						response = xsToString(xsVar(1));
-						responseLength = strlen(response);
-					} else {
-						// fprintf(stderr, "report: %d %s\n", xsTypeOf(report), xsToString(report));
-						xsTry {
-							if (xsTypeOf(xsVar(1)) == xsReferenceType && xsHas(xsVar(1), xsID("result"))) {
-								xsVar(2) = xsGet(xsVar(1), xsID("result"));
-							} else {
-								xsVar(2) = xsVar(1);
-							}
-							// fprintf(stderr, "result: %d %s\n", xsTypeOf(result), xsToString(result));
-							if (xsIsInstanceOf(xsVar(2), xsArrayBufferPrototype)) {
-								responseLength = xsGetArrayBufferLength(xsVar(2));
-								response = xsToArrayBuffer(xsVar(2));
-							}
-						}
-						xsCatch {
-							if (xsTypeOf(xsException) != xsUndefinedType) {
-								fprintf(stderr, "%c computing response %d", command, xsTypeOf(xsVar(1)));
-								fprintf(stderr, " %d:", xsTypeOf(xsVar(2)));
-								fprintf(stderr, " %s:", xsToString(xsVar(2)));
-								fprintf(stderr, " %s\n", xsToString(xsException));
-								xsException = xsUndefined;
-							}
-						}
-					}
-				}
-				xsEndHost(machine);
-				if (error) {
-						writeError = fxWriteNetString(toParent, "!", response, responseLength);
-						// fprintf(stderr, "error: %d, writeError: %d %s\n", error, writeError, response);
-				} else {
-						// fprintf(stderr, "response of %d bytes\n", responseLength);
-						writeError = fxWriteOkay(toParent, meterIndex, machine, response, responseLength);
-				}
-				if (writeError != 0) {
-					fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
-					c_exit(E_IO_ERROR);
-				}
-				break;
-			case 's':
-			case 'm':
-				xsBeginCrank(machine, gxCrankMeteringLimit);
-				path = nsbuf + 1;
-				xsBeginHost(machine);
-				{
-					xsVars(1);
-					xsTry {
-						// ISSUE: realpath necessary? realpath(x, x) doesn't seem to work.
-						if (command == 'm')
-							xsRunModuleFile(path);
-						else
-							xsRunProgramFile(path);
-					}
-					xsCatch {
-						if (xsTypeOf(xsException) != xsUndefinedType) {
-							fprintf(stderr, "%s\n", xsToString(xsException));
-							error = E_UNHANDLED_EXCEPTION;
-							xsException = xsUndefined;
-						}
-					}
-				}
-				xsEndHost(machine);
-				fxRunLoop(machine);
-				meterIndex = xsEndCrank(machine);
-				if (error == 0) {
-					int writeError = fxWriteOkay(toParent, meterIndex, machine, "", 0);
-					if (writeError != 0) {
-						fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
-						c_exit(E_IO_ERROR);
-					}
-				} else {
-					// TODO: dynamically build error message including Exception message.
-					int writeError = fxWriteNetString(toParent, "!", "", 0);
-					if (writeError != 0) {
-						fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
-						c_exit(E_IO_ERROR);
-					}
-				}
-				break;
-
-			case 'w':
-			#if XSNAP_TEST_RECORD
-				fxTestRecord(mxTestRecordParam, nsbuf + 1, nslen - 1);
-			#endif
-				path = nsbuf + 1;
-				SnapshotStream stream;
-				if (path[0] == '@') {
-					int fd = atoi(path + 1);
-					int tmpfd = dup(fd);
-					if (tmpfd < 0) {
-						stream.file = NULL;
-					} else {
-						stream.file = fdopen(tmpfd, "ab");
-					}
-				} else {
-					stream.file = fopen(path, "wb");
-				}
-				stream.size = 0;
-				if (stream.file) {
-					snapshot.stream = &stream;
-					fxWriteSnapshot(machine, &snapshot);
-					snapshot.stream = NULL;
-					fclose(stream.file);
-				}
-				else
-					snapshot.error = errno;
-				if (snapshot.error) {
-					fprintf(stderr, "cannot write snapshot %s: %s\n",
-							path, strerror(snapshot.error));
-					c_exit(E_IO_ERROR);
-				}
-				if (snapshot.error == 0) {
-					// Allows us to format up to 999,999,999,999 bytes (1TiB - 1)
-					char fsize[13];
-					int fsizeLength = snprintf(fsize, sizeof(fsize), "%d", stream.size);
-					int writeError = fxWriteOkay(toParent, meterIndex, machine, fsize, fsizeLength);
-					if (writeError != 0) {
-						fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
-						c_exit(E_IO_ERROR);
-					}
-				} else {
-					// TODO: dynamically build error message including Exception message.
-					int writeError = fxWriteNetString(toParent, "!", "", 0);
-					if (writeError != 0) {
-						fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
-						c_exit(E_IO_ERROR);
-					}
-				}
-				break;
-			case 'q':
+			if (command == 'q')
 				done = 1;
-				break;
-
-			// We reserve some prefix characters to avoid/detect/debug confusion,
-			// all of which are explicitly rejected, just like unknown commands. Do not
-			// reuse these for new commands.
-			case '/': // downstream response to upstream issueCommand()
-			case '.': // upstream good response to downstream execute/eval
-			case '!': // upstream error response to downstream execute/eval
-			default:
-				// note: the nsbuf we receive from fxReadNetString is null-terminated
-				fprintf(stderr, "Unexpected prefix '%c' in command '%s'\n", command, nsbuf);
-				c_exit(E_IO_ERROR);
-				break;
+			else {
+				fxEnterDelivery(state);
+				meterIndex = fxHandleCommand(state, command, nsbuf, nslen);
+				fxExitDelivery(state);
 			}
 			free(nsbuf);
-#if mxInstrument
-			xsnapInstrumentValues[0] = (xsIntegerValue)meterIndex;
-			xsSampleInstrumentation(machine, xsnapInstrumentCount, xsnapInstrumentValues);
-#endif
+			fxCompleteCommand(state, meterIndex);
 		}
+		error = state->error;
 		xsBeginHost(machine);
 		{
 			if (xsTypeOf(xsException) != xsUndefinedType) {
@@ -650,52 +984,1284 @@ int main(int argc, char* argv[])
 		xsEndHost(machine);
 	}
 	xsEndMetering(machine);
-	if (machine->abortStatus) {
-		switch (machine->abortStatus) {
-		case xsNotEnoughMemoryExit:
-			error = E_NOT_ENOUGH_MEMORY;
+#if mxMetering
+	if (gxComputronProfilePath)
+		fxWriteComputronProfile(state, gxComputronProfilePath);
+#endif
+	if (machine->abortStatus)
+		error = fxExitCodeFromAbortStatus(state, machine->abortStatus);
+	fxFlushConsole(state);
+	if (error != E_SUCCESS) {
+		c_exit(error);
+	}
+	fxDeleteMachineState(state);
+	fxTerminateSharedCluster();
+	return E_SUCCESS;
+}
+
+static int fxExitCodeFromAbortStatus(MachineState* state, int status)
+{
+	if ((status == xsTooMuchComputationExit) && state->cancelled)
+		return E_CANCELLED;
+	if ((status == xsTooMuchComputationExit) && state->deadlineExceeded)
+		return E_DEADLINE_EXCEEDED;
+	switch (status) {
+	case xsNotEnoughMemoryExit:
+		return E_NOT_ENOUGH_MEMORY;
+	case xsStackOverflowExit:
+		return E_STACK_OVERFLOW;
+	case xsNoMoreKeysExit:
+		return E_NO_MORE_KEYS;
+	case xsTooMuchComputationExit:
+		return E_TOO_MUCH_COMPUTATION;
+	default:
+		return E_UNKNOWN_ERROR;
+	}
+}
+
+static MachineState* fxNewMachineState(xsIntegerValue id)
+{
+	MachineState* state = calloc(1, sizeof(MachineState));
+	if (!state) {
+		fprintf(stderr, "cannot allocate machine state\n");
+		c_exit(E_NOT_ENOUGH_MEMORY);
+	}
+	state->id = id;
+	if (gxMultiMachine)
+		snprintf(state->label, sizeof(state->label), "%d ", id);
+	state->crankMeteringLimit = gxCrankMeteringLimit;
+	// profile requests made before the machine existed are not for it
+	pthread_mutex_lock(&gxControl.mutex);
+	state->profileRequests = gxControl.profileRequests;
+	pthread_mutex_unlock(&gxControl.mutex);
+	return state;
+}
+
+static void fxDeleteMachineState(MachineState* state)
+{
+	fxFlushConsole(state);
+	if (state->machine)
+		xsDeleteMachine(state->machine);
+	free(state->console);
+	free(state);
+}
+
+static void fxSetUpMachine(MachineState* state)
+{
+	xsMachine* machine = state->machine;
+	// a delivery runs until its timers are done: advance time rather than wait for it
+	xsUseVirtualTimers(machine, 1);
+#if mxInstrument
+	xsDescribeInstrumentation(machine, xsnapInstrumentCount, xsnapInstrumentNames, xsnapInstrumentUnits);
+#endif
+	state->idleCollectBaseline = fxGetCurrentHeapSize(machine);
+	state->releaseHeapSize = state->idleCollectBaseline;
+}
+
+static void fxCreateMachine(MachineState* state)
+{
+	state->machine = xsCreateMachine(&gxCreation, "xsnap", state);
+	xsBuildAgent(state->machine);
+	fxSetUpMachine(state);
+}
+
+static int fxRestoreMachine(MachineState* state, char* path)
+{
+	xsSnapshot snapshot;
+	fxInitializeSnapshot(&snapshot);
+	if (path[0] == '@') {
+		int fd = atoi(path + 1);
+		int tmpfd = dup(fd);
+		if (tmpfd < 0) {
+			snapshot.stream = NULL;
+		} else {
+			snapshot.stream = fdopen(tmpfd, "rb");
+		}
+	} else {
+		snapshot.stream = fopen(path, "rb");
+	}
+	if (snapshot.stream) {
+		if (gxRestoreHeadroom >= 0) {
+			RestoreStream restoreStream = { snapshot.stream, 0 };
+			snapshot.stream = &restoreStream;
+			snapshot.read = fxSnapshotReadRightSized;
+			state->machine = xsReadSnapshot(&snapshot, "xsnap", state);
+			snapshot.stream = restoreStream.file;
+		}
+		else
+			state->machine = xsReadSnapshot(&snapshot, "xsnap", state);
+		fclose(snapshot.stream);
+	}
+	else
+		snapshot.error = errno;
+	if (snapshot.error)
+		return snapshot.error;
+	fxSetUpMachine(state);
+	return 0;
+}
+
+static xsUnsignedValue fxHandleCommand(MachineState* state, char command, char* nsbuf, size_t nslen)
+{
+	xsMachine* machine = state->machine;
+	xsUnsignedValue meterIndex = 0;
+	int writeError = 0;
+	char *path;
+	switch(command) {
+	case 'R': // isReady
+		fxWriteNetString(state->toParent, state->label, ".", "", 0);
+		break;
+	case '?':
+	case 'e':
+	case 't':
+		xsBeginCrank(machine, state->crankMeteringLimit);
+		fxSetProfilerInterval(state);
+		char* response = NULL;
+		xsIntegerValue responseLength = 0;
+		state->error = 0;
+		xsBeginHost(machine);
+		{
+			xsVars(3);
+			xsTry {
+				if (command == '?') {
+					if (gxRecording)
+						fxRecord(mxRecordJSON | mxRecordParam, nsbuf + 1, nslen - 1);
+					// TODO: can we avoid a copy?
+					xsVar(0) = xsArrayBuffer(nsbuf + 1, nslen - 1);
+					xsVar(1) = xsCall1(xsGlobal, xsID("handleCommand"), xsVar(0));
+				} else if (command == 't') {
+					// advance the virtual clock, the run loop below runs the timeouts due by then
+					xsAdvanceVirtualTimers(machine, strtod(nsbuf + 1, NULL));
+				} else {
+					if (gxRecording)
+						fxRecord(mxRecordJS | mxRecordParam, nsbuf + 1, nslen - 1);
+					xsVar(0) = xsStringBuffer(nsbuf + 1, nslen - 1);
+					xsVar(1) = xsCall1(xsGlobal, xsID("eval"), xsVar(0));
+				}
+			}
+			xsCatch {
+				if (xsTypeOf(xsException) != xsUndefinedType) {
+					// fprintf(stderr, "%c: %s\n", command, xsToString(xsException));
+					state->error = E_UNHANDLED_EXCEPTION;
+					xsVar(1) = xsException;
+					xsException = xsUndefined;
+				}
+			}
+		}
+		fxRunLoop(machine);
+		meterIndex = xsEndCrank(machine);
+		{
+			if (state->error) {
+				response = xsToString(xsVar(1));
+				responseLength = strlen(response);
+			} else {
+				// fprintf(stderr, "report: %d %s\n", xsTypeOf(report), xsToString(report));
+				xsTry {
+					if (xsTypeOf(xsVar(1)) == xsReferenceType && xsHas(xsVar(1), xsID("result"))) {
+						xsVar(2) = xsGet(xsVar(1), xsID("result"));
+					} else {
+						xsVar(2) = xsVar(1);
+					}
+					// fprintf(stderr, "result: %d %s\n", xsTypeOf(result), xsToString(result));
+					if (xsIsInstanceOf(xsVar(2), xsArrayBufferPrototype)) {
+						responseLength = xsGetArrayBufferLength(xsVar(2));
+						response = xsToArrayBuffer(xsVar(2));
+					}
+				}
+				xsCatch {
+					if (xsTypeOf(xsException) != xsUndefinedType) {
+						fprintf(stderr, "%c computing response %d", command, xsTypeOf(xsVar(1)));
+						fprintf(stderr, " %d:", xsTypeOf(xsVar(2)));
+						fprintf(stderr, " %s:", xsToString(xsVar(2)));
+						fprintf(stderr, " %s\n", xsToString(xsException));
+						xsException = xsUndefined;
+					}
+				}
+			}
+		}
+		xsEndHost(machine);
+		fxFlushConsole(state);
+		if (state->error) {
+				writeError = fxWriteNetString(state->toParent, state->label, "!", response, responseLength);
+				// fprintf(stderr, "error: %d, writeError: %d %s\n", state->error, writeError, response);
+		} else {
+				// fprintf(stderr, "response of %d bytes\n", responseLength);
+				writeError = fxWriteOkay(state, meterIndex, response, responseLength);
+		}
+		if (writeError != 0) {
+			fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			c_exit(E_IO_ERROR);
+		}
+		break;
+	case 's':
+	case 'm':
+		xsBeginCrank(machine, state->crankMeteringLimit);
+		fxSetProfilerInterval(state);
+		path = nsbuf + 1;
+		xsBeginHost(machine);
+		{
+			xsVars(1);
+			xsTry {
+				// ISSUE: realpath necessary? realpath(x, x) doesn't seem to work.
+				if (command == 'm')
+					xsRunModuleFile(path);
+				else
+					xsRunProgramFile(path);
+			}
+			xsCatch {
+				if (xsTypeOf(xsException) != xsUndefinedType) {
+					fprintf(stderr, "%s\n", xsToString(xsException));
+					state->error = E_UNHANDLED_EXCEPTION;
+					xsException = xsUndefined;
+				}
+			}
+		}
+		xsEndHost(machine);
+		fxRunLoop(machine);
+		meterIndex = xsEndCrank(machine);
+		if (state->error == 0) {
+			int writeError = fxWriteOkay(state, meterIndex, "", 0);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+		} else {
+			// TODO: dynamically build error message including Exception message.
+			int writeError = fxWriteNetString(state->toParent, state->label, "!", "", 0);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+		}
+		break;
+
+	case 'w':
+		if (xsCountTimers(machine)) {
+			// timers live outside the heap and would be lost, see xsnap-worker.md
+			int writeError = fxWriteNetString(state->toParent, state->label, "!", "pending timers", 14);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
 			break;
-		case xsStackOverflowExit:
-			error = E_STACK_OVERFLOW;
+		}
+		if (gxRecording)
+			fxRecord(mxRecordParam, nsbuf + 1, nslen - 1);
+		path = nsbuf + 1;
+		xsSnapshot snapshot;
+		SnapshotStream stream;
+		xsSnapshotIndex index;
+		fxInitializeSnapshot(&snapshot);
+		if (path[0] == '@') {
+			int fd = atoi(path + 1);
+			int tmpfd = dup(fd);
+			if (tmpfd < 0) {
+				stream.file = NULL;
+			} else {
+				stream.file = fdopen(tmpfd, "ab");
+			}
+		} else {
+			stream.file = fopen(path, "wb");
+		}
+		stream.size = 0;
+		stream.index = NULL;
+		if (gxIndexSnapshots) {
+			memset(&index, 0, sizeof(index));
+			stream.index = &index;
+		}
+		if (stream.file) {
+			snapshot.stream = &stream;
+			fxWriteSnapshot(machine, &snapshot);
+			if ((snapshot.error == 0) && stream.index) {
+				stream.index = NULL;
+				snapshot.error = xsWriteSnapshotIndex(&index, fxSnapshotWrite, &stream);
+			}
+			snapshot.stream = NULL;
+			fclose(stream.file);
+		}
+		else
+			snapshot.error = errno;
+		if (snapshot.error) {
+			fprintf(stderr, "cannot write snapshot %s: %s\n",
+					path, strerror(snapshot.error));
+			c_exit(E_IO_ERROR);
+		}
+		if (snapshot.error == 0) {
+			// fxWriteSnapshot collects garbage first
+			state->idleCollectBaseline = fxGetCurrentHeapSize(machine);
+			fxReleaseFreeSpace(state);
+			// Allows us to format up to 999,999,999,999 bytes (1TiB - 1)
+			char fsize[13];
+			int fsizeLength = snprintf(fsize, sizeof(fsize), "%d", stream.size);
+			int writeError = fxWriteOkay(state, meterIndex, fsize, fsizeLength);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+		} else {
+			// TODO: dynamically build error message including Exception message.
+			int writeError = fxWriteNetString(state->toParent, state->label, "!", "", 0);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+		}
+		break;
+
+	case 'h':
+		fxWriteCensus(state);
+		break;
+	case 'p':
+		fxStartProfiler(state, nsbuf + 1);
+		break;
+	case 'P':
+		fxStopProfiler(state);
+		break;
+
+	// We reserve some prefix characters to avoid/detect/debug confusion,
+	// all of which are explicitly rejected, just like unknown commands. Do not
+	// reuse these for new commands.
+	case '/': // downstream response to upstream issueCommand()
+	case '.': // upstream good response to downstream execute/eval
+	case '!': // upstream error response to downstream execute/eval
+	default:
+		// note: the nsbuf we receive from fxReadNetString is null-terminated
+		fprintf(stderr, "Unexpected prefix '%c' in command '%s'\n", command, nsbuf);
+		c_exit(E_IO_ERROR);
+		break;
+	}
+	fxFlushConsole(state);
+	return meterIndex;
+}
+
+static void fxCompleteCommand(MachineState* state, xsUnsignedValue meterIndex)
+{
+#if mxInstrument
+	xsnapInstrumentValues[0] = (xsIntegerValue)meterIndex;
+	xsSampleInstrumentation(state->machine, xsnapInstrumentCount, xsnapInstrumentValues);
+#endif
+	fxCollectIfIdle(state);
+	if (gxReleaseFreeSpace) {
+		size_t current = fxGetCurrentHeapSize(state->machine);
+		// Free space appears only when XS collects, so scan for it only then. A
+		// collection that the delivery outgrew waits for the next one.
+		if (current < state->releaseHeapSize)
+			fxReleaseFreeSpace(state);
+		else
+			state->releaseHeapSize = current;
+	}
+}
+
+static xsBooleanValue fxDeliver(MachineState* state, char* command, size_t nslen)
+{
+	xsMachine* machine = state->machine;
+	xsUnsignedValue meterIndex = 0;
+	// By default, use the infinite meter.
+	state->currentMeter = 0;
+	fxEnterDelivery(state);
+	xsBeginMetering(machine, fxMeteringCallback, gxMeteringInterval);
+	{
+		meterIndex = fxHandleCommand(state, *command, command, nslen);
+	}
+	xsEndMetering(machine);
+	fxExitDelivery(state);
+	if (machine->abortStatus) {
+		// the machine is gone, as the whole process is in the default mode
+		char code[8];
+		int writeError;
+		snprintf(code, sizeof(code), "%d", fxExitCodeFromAbortStatus(state, machine->abortStatus));
+		fxFlushConsole(state);
+		xsDeleteMachine(machine);
+		state->machine = NULL;
+		writeError = fxWriteNetString(state->toParent, state->label, "x", code, strlen(code));
+		if (writeError != 0) {
+			fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			c_exit(E_IO_ERROR);
+		}
+		return 0;
+	}
+	fxCompleteCommand(state, meterIndex);
+	return 1;
+}
+
+static int fxRunMachines()
+{
+	FILE* fromParent;
+	FILE* toParent;
+	MachineState* first = NULL;
+	char done = 0;
+	if (!(fromParent = fdopen(3, "rb"))) {
+		fprintf(stderr, "fdopen(3) from parent failed\n");
+		c_exit(E_IO_ERROR);
+	}
+	if (!(toParent = fdopen(4, "wb"))) {
+		fprintf(stderr, "fdopen(4) to parent failed\n");
+		c_exit(E_IO_ERROR);
+	}
+	while (!done) {
+		MachineState* state;
+		MachineState** address;
+		xsIntegerValue id;
+		char label[16];
+		char* message = NULL;
+		char* nsbuf;
+		char* command;
+		size_t nslen;
+		int writeError = 0;
+		int readError = fxReadNetString(fromParent, &nsbuf, &nslen);
+		if (readError != 0) {
+			if (feof(fromParent)) {
+				break;
+			} else {
+				fprintf(stderr, "%s\n", fxReadNetStringError(readError));
+				c_exit(E_IO_ERROR);
+			}
+		}
+		if ((*nsbuf < '0') || ('9' < *nsbuf)) {
+			// commands to the process itself are not prefixed
+			if (*nsbuf == 'R')
+				writeError = fxWriteNetString(toParent, "", ".", "", 0);
+			else if (*nsbuf == 'q')
+				done = 1;
+			else {
+				fprintf(stderr, "Unexpected prefix '%c' in command '%s'\n", *nsbuf, nsbuf);
+				c_exit(E_IO_ERROR);
+			}
+			free(nsbuf);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+			continue;
+		}
+		id = (xsIntegerValue)strtol(nsbuf, &command, 10);
+		if (*command != ' ') {
+			fprintf(stderr, "Missing machine id in command '%s'\n", nsbuf);
+			c_exit(E_IO_ERROR);
+		}
+		command++;
+		nslen -= command - nsbuf;
+		snprintf(label, sizeof(label), "%d ", id);
+		address = &first;
+		while ((state = *address) && (state->id != id))
+			address = &(state->next);
+		switch (*command) {
+		case 'c': // create, or restore if the body is a snapshot path
+			if (state) {
+				message = "machine exists";
+				break;
+			}
+			state = fxNewMachineState(id);
+			state->fromParent = fromParent;
+			state->toParent = toParent;
+			if (nslen > 1) {
+				int error = fxRestoreMachine(state, command + 1);
+				if (error) {
+					message = strerror(error);
+					fxDeleteMachineState(state);
+					break;
+				}
+			}
+			else
+				fxCreateMachine(state);
+			state->next = first;
+			first = state;
+			writeError = fxWriteNetString(toParent, label, ".", "", 0);
 			break;
-		case xsNoMoreKeysExit:
-			error = E_NO_MORE_KEYS;
+		case 'd': // delete
+			if (!state) {
+				message = "no such machine";
+				break;
+			}
+			*address = state->next;
+			fxDeleteMachineState(state);
+			writeError = fxWriteNetString(toParent, label, ".", "", 0);
 			break;
-		case xsTooMuchComputationExit:
-			error = E_TOO_MUCH_COMPUTATION;
+		case 'q': // only the process quits
+			message = "q takes no machine id";
 			break;
 		default:
-			error = E_UNKNOWN_ERROR;
+			if (!state) {
+				message = "no such machine";
+				break;
+			}
+			resetTimestamps(state);
+			recordTimestamp(state); // after delivery received from parent
+			recordUsage(state);
+			if (!fxDeliver(state, command, nslen)) {
+				*address = state->next;
+				fxDeleteMachineState(state);
+			}
 			break;
 		}
+		if (message)
+			writeError = fxWriteNetString(toParent, label, "!", message, strlen(message));
+		free(nsbuf);
+		if (writeError != 0) {
+			fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			c_exit(E_IO_ERROR);
+		}
 	}
-	if (error != E_SUCCESS) {
-		c_exit(error);
+	while (first) {
+		MachineState* state = first;
+		first = state->next;
+		fxDeleteMachineState(state);
 	}
-	xsDeleteMachine(machine);
-	fxTerminateSharedCluster();
 	return E_SUCCESS;
 }
 
+// Thread pool: with -T, the main thread only reads commands and queues them
+// on their machine. A machine with queued commands is a task; each pool
+// thread pops tasks from the tail of its own deque and, when that is empty,
+// steals from the head of the others. A machine runs on one thread at a time
+// and keeps its commands in order, so it stays deterministic.
+
+typedef struct {
+	pthread_mutex_t mutex;
+	MachineState** tasks;
+	int head;
+	int count;
+	int size;
+} TaskDeque;
+
+static struct {
+	pthread_t* threads;
+	TaskDeque* deques;
+	pthread_mutex_t mutex;
+	pthread_cond_t available;
+	int pending;
+	xsBooleanValue stopping;
+	int next;
+	pthread_mutex_t machinesMutex;
+	MachineState* firstMachine;
+} gxPool = {
+	NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL
+};
+
+static void fxPoolPush(int index, MachineState* state)
+{
+	TaskDeque* deque = &gxPool.deques[index];
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count == deque->size) {
+		int size = deque->size ? 2 * deque->size : 64, i;
+		MachineState** tasks = malloc(size * sizeof(MachineState*));
+		if (!tasks) {
+			fprintf(stderr, "cannot allocate task deque\n");
+			c_exit(E_NOT_ENOUGH_MEMORY);
+		}
+		for (i = 0; i < deque->count; i++)
+			tasks[i] = deque->tasks[(deque->head + i) % deque->size];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->head = 0;
+		deque->size = size;
+	}
+	deque->tasks[(deque->head + deque->count) % deque->size] = state;
+	deque->count++;
+	pthread_mutex_unlock(&deque->mutex);
+	pthread_mutex_lock(&gxPool.mutex);
+	gxPool.pending++;
+	pthread_cond_signal(&gxPool.available);
+	pthread_mutex_unlock(&gxPool.mutex);
+}
+
+static MachineState* fxPoolPop(int index, xsBooleanValue steal)
+{
+	TaskDeque* deque = &gxPool.deques[index];
+	MachineState* state = NULL;
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count) {
+		deque->count--;
+		if (steal) {
+			state = deque->tasks[deque->head];
+			deque->head = (deque->head + 1) % deque->size;
+		}
+		else
+			state = deque->tasks[(deque->head + deque->count) % deque->size];
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return state;
+}
+
+static MachineState* fxPoolTake(int index)
+{
+	MachineState* state;
+	int i;
+	pthread_mutex_lock(&gxPool.mutex);
+	while (!gxPool.pending) {
+		if (gxPool.stopping) {
+			pthread_mutex_unlock(&gxPool.mutex);
+			return NULL;
+		}
+		pthread_cond_wait(&gxPool.available, &gxPool.mutex);
+	}
+	gxPool.pending--;
+	pthread_mutex_unlock(&gxPool.mutex);
+	// one of the queued tasks is ours
+	for (;;) {
+		if ((state = fxPoolPop(index, 0)))
+			return state;
+		for (i = 1; i < gxThreadCount; i++) {
+			if ((state = fxPoolPop((index + i) % gxThreadCount, 1)))
+				return state;
+		}
+	}
+}
+
+static xsBooleanValue fxPoolRemove(MachineState* state)
+{
+	MachineState** address;
+	pthread_mutex_lock(&gxPool.machinesMutex);
+	pthread_mutex_lock(&state->mutex);
+	if (state->firstCommand) {
+		// queued since the machine was deleted, maybe to create it again
+		pthread_mutex_unlock(&state->mutex);
+		pthread_mutex_unlock(&gxPool.machinesMutex);
+		return 0;
+	}
+	address = &gxPool.firstMachine;
+	while (*address != state)
+		address = &((*address)->next);
+	*address = state->next;
+	pthread_mutex_unlock(&state->mutex);
+	pthread_mutex_unlock(&gxPool.machinesMutex);
+	pthread_mutex_destroy(&state->mutex);
+	pthread_cond_destroy(&state->replied);
+	fxDeleteMachineState(state);
+	return 1;
+}
+
+static xsBooleanValue fxPoolRun(MachineState* state, Command* command)
+{
+	char* message = NULL;
+	int writeError = 0;
+	switch (*command->command) {
+	case 'c':
+		if (state->machine) {
+			message = "machine exists";
+			break;
+		}
+		if (command->length > 1) {
+			int error = fxRestoreMachine(state, command->command + 1);
+			if (error) {
+				writeError = fxWriteNetString(state->toParent, state->label, "!", strerror(error), strlen(strerror(error)));
+				break;
+			}
+		}
+		else
+			fxCreateMachine(state);
+		writeError = fxWriteNetString(state->toParent, state->label, ".", "", 0);
+		break;
+	case 'd':
+		if (state->machine) {
+			xsDeleteMachine(state->machine);
+			state->machine = NULL;
+			writeError = fxWriteNetString(state->toParent, state->label, ".", "", 0);
+		}
+		else
+			message = "no such machine";
+		break;
+	default:
+		if (!state->machine) {
+			message = "no such machine";
+			break;
+		}
+		resetTimestamps(state);
+		state->timestamps[0] = command->received;
+		state->num_timestamps = 1;
+		recordUsage(state);
+		fxDeliver(state, command->command, command->length);
+		break;
+	}
+	if (message)
+		writeError = fxWriteNetString(state->toParent, state->label, "!", message, strlen(message));
+	if (writeError != 0) {
+		fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+		c_exit(E_IO_ERROR);
+	}
+	return state->machine ? 1 : 0;
+}
+
+static void* fxPoolThread(void* it)
+{
+	int index = (int)(intptr_t)it;
+	MachineState* state;
+	Command* command;
+	xsBooleanValue alive;
+	int previous;
+	while ((state = fxPoolTake(index))) {
+		// the reader reads the thread under the mutex too, to push the machine there
+		pthread_mutex_lock(&state->mutex);
+		command = state->firstCommand;
+		state->firstCommand = command->next;
+		previous = state->thread;
+		state->thread = index;
+		pthread_mutex_unlock(&state->mutex);
+		if (state->machine && (previous != index))
+			fxEnterMachineThread(state->machine);
+		alive = fxPoolRun(state, command);
+		free(command->nsbuf);
+		free(command);
+		if (!alive && fxPoolRemove(state))
+			continue;
+		pthread_mutex_lock(&state->mutex);
+		if (state->firstCommand) {
+			pthread_mutex_unlock(&state->mutex);
+			fxPoolPush(index, state);
+		}
+		else {
+			state->scheduled = 0;
+			pthread_mutex_unlock(&state->mutex);
+		}
+	}
+	return NULL;
+}
+
+static int fxRunMachinePool()
+{
+	FILE* fromParent;
+	FILE* toParent;
+	pthread_attr_t attributes;
+	MachineState* state;
+	int i;
+	char done = 0;
+	if (!(fromParent = fdopen(3, "rb"))) {
+		fprintf(stderr, "fdopen(3) from parent failed\n");
+		c_exit(E_IO_ERROR);
+	}
+	if (!(toParent = fdopen(4, "wb"))) {
+		fprintf(stderr, "fdopen(4) to parent failed\n");
+		c_exit(E_IO_ERROR);
+	}
+	gxPool.threads = calloc(gxThreadCount, sizeof(pthread_t));
+	gxPool.deques = calloc(gxThreadCount, sizeof(TaskDeque));
+	if (!gxPool.threads || !gxPool.deques) {
+		fprintf(stderr, "cannot allocate thread pool\n");
+		c_exit(E_NOT_ENOUGH_MEMORY);
+	}
+	pthread_attr_init(&attributes);
+	// as deep as the usual main thread stack: secondary threads default to less
+	pthread_attr_setstacksize(&attributes, 8 * 1024 * 1024);
+	for (i = 0; i < gxThreadCount; i++) {
+		pthread_mutex_init(&gxPool.deques[i].mutex, NULL);
+		if (pthread_create(&gxPool.threads[i], &attributes, fxPoolThread, (void*)(intptr_t)i)) {
+			fprintf(stderr, "cannot create thread: %s\n", strerror(errno));
+			c_exit(E_UNKNOWN_ERROR);
+		}
+	}
+	pthread_attr_destroy(&attributes);
+	while (!done) {
+		Command* command;
+		xsIntegerValue id;
+		char label[16];
+		char* nsbuf;
+		char* p;
+		size_t nslen;
+		xsBooleanValue schedule = 0;
+		int thread = 0;
+		int writeError = 0;
+		int readError = fxReadNetString(fromParent, &nsbuf, &nslen);
+		if (readError != 0) {
+			if (feof(fromParent)) {
+				break;
+			} else {
+				fprintf(stderr, "%s\n", fxReadNetStringError(readError));
+				c_exit(E_IO_ERROR);
+			}
+		}
+		if ((*nsbuf < '0') || ('9' < *nsbuf)) {
+			// commands to the process itself are not prefixed
+			if (*nsbuf == 'R')
+				writeError = fxWriteNetString(toParent, "", ".", "", 0);
+			else if (*nsbuf == 'q')
+				done = 1;
+			else {
+				fprintf(stderr, "Unexpected prefix '%c' in command '%s'\n", *nsbuf, nsbuf);
+				c_exit(E_IO_ERROR);
+			}
+			free(nsbuf);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+			continue;
+		}
+		id = (xsIntegerValue)strtol(nsbuf, &p, 10);
+		if (*p != ' ') {
+			fprintf(stderr, "Missing machine id in command '%s'\n", nsbuf);
+			c_exit(E_IO_ERROR);
+		}
+		p++;
+		nslen -= p - nsbuf;
+		if (*p == 'q') {
+			// only the process quits
+			snprintf(label, sizeof(label), "%d ", id);
+			writeError = fxWriteNetString(toParent, label, "!", "q takes no machine id", 21);
+			free(nsbuf);
+			if (writeError != 0) {
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+				c_exit(E_IO_ERROR);
+			}
+			continue;
+		}
+		pthread_mutex_lock(&gxPool.machinesMutex);
+		state = gxPool.firstMachine;
+		while (state && (state->id != id))
+			state = state->next;
+		if (!state && (*p == 'c')) {
+			state = fxNewMachineState(id);
+			state->fromParent = fromParent;
+			state->toParent = toParent;
+			state->thread = gxPool.next;
+			gxPool.next = (gxPool.next + 1) % gxThreadCount;
+			pthread_mutex_init(&state->mutex, NULL);
+			pthread_cond_init(&state->replied, NULL);
+			state->next = gxPool.firstMachine;
+			gxPool.firstMachine = state;
+		}
+		if (!state) {
+			pthread_mutex_unlock(&gxPool.machinesMutex);
+			snprintf(label, sizeof(label), "%d ", id);
+			writeError = fxWriteNetString(toParent, label, "!", "no such machine", 15);
+			free(nsbuf);
+		}
+		else if (*p == '/') {
+			// the response to an issueCommand, for the thread waiting for it
+			pthread_mutex_lock(&state->mutex);
+			pthread_mutex_unlock(&gxPool.machinesMutex);
+			if (state->reply) {
+				fprintf(stderr, "Unexpected response '%s'\n", nsbuf);
+				c_exit(E_IO_ERROR);
+			}
+			state->reply = nsbuf;
+			state->replyLength = nslen + (p - nsbuf);
+			pthread_cond_signal(&state->replied);
+			pthread_mutex_unlock(&state->mutex);
+		}
+		else {
+			command = malloc(sizeof(Command));
+			if (!command) {
+				fprintf(stderr, "cannot allocate command\n");
+				c_exit(E_NOT_ENOUGH_MEMORY);
+			}
+			command->next = NULL;
+			command->nsbuf = nsbuf;
+			command->command = p;
+			command->length = nslen;
+			gettimeofday(&command->received, NULL);
+			pthread_mutex_lock(&state->mutex);
+			pthread_mutex_unlock(&gxPool.machinesMutex);
+			if (state->firstCommand) {
+				Command* last = state->firstCommand;
+				while (last->next)
+					last = last->next;
+				last->next = command;
+			}
+			else
+				state->firstCommand = command;
+			if (!state->scheduled) {
+				state->scheduled = 1;
+				schedule = 1;
+			}
+			thread = state->thread;
+			pthread_mutex_unlock(&state->mutex);
+			if (schedule)
+				fxPoolPush(thread, state);
+		}
+		if (writeError != 0) {
+			fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			c_exit(E_IO_ERROR);
+		}
+	}
+	// no more responses: wake up machines waiting for one
+	pthread_mutex_lock(&gxPool.machinesMutex);
+	for (state = gxPool.firstMachine; state; state = state->next) {
+		pthread_mutex_lock(&state->mutex);
+		state->closed = 1;
+		pthread_cond_signal(&state->replied);
+		pthread_mutex_unlock(&state->mutex);
+	}
+	pthread_mutex_unlock(&gxPool.machinesMutex);
+	pthread_mutex_lock(&gxPool.mutex);
+	gxPool.stopping = 1;
+	pthread_cond_broadcast(&gxPool.available);
+	pthread_mutex_unlock(&gxPool.mutex);
+	for (i = 0; i < gxThreadCount; i++)
+		pthread_join(gxPool.threads[i], NULL);
+	while ((state = gxPool.firstMachine)) {
+		gxPool.firstMachine = state->next;
+		pthread_mutex_destroy(&state->mutex);
+		pthread_cond_destroy(&state->replied);
+		fxDeleteMachineState(state);
+	}
+	for (i = 0; i < gxThreadCount; i++) {
+		pthread_mutex_destroy(&gxPool.deques[i].mutex);
+		free(gxPool.deques[i].tasks);
+	}
+	free(gxPool.deques);
+	free(gxPool.threads);
+	return E_SUCCESS;
+}
+
+static int fxReceiveFileDescriptors(int connection, char* command, int* fds)
+{
+	struct msghdr message;
+	struct iovec vector;
+	union {
+		struct cmsghdr header;
+		char buffer[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct cmsghdr* header;
+	memset(&message, 0, sizeof(message));
+	vector.iov_base = command;
+	vector.iov_len = 1;
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+	if (recvmsg(connection, &message, 0) != 1)
+		return EIO;
+	header = CMSG_FIRSTHDR(&message);
+	if (!header || (header->cmsg_level != SOL_SOCKET) || (header->cmsg_type != SCM_RIGHTS))
+		return (*command == 'q') ? 0 : EINVAL;
+	if (header->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+		// do not leak what was sent anyway
+		int* received = (int*)CMSG_DATA(header);
+		size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		while (count--)
+			close(*received++);
+		return EINVAL;
+	}
+	memcpy(fds, CMSG_DATA(header), 2 * sizeof(int));
+	return 0;
+}
+
+static void fxServeZygote(char* path)
+{
+	struct sockaddr_un address;
+	int server;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		c_exit(E_BAD_USAGE);
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(errno));
+		c_exit(E_IO_ERROR);
+	}
+	unlink(path);
+	if (bind(server, (struct sockaddr*)&address, sizeof(address)) || listen(server, 64)) {
+		fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+		c_exit(E_IO_ERROR);
+	}
+	// children are not waited for: let the system reap them
+	signal(SIGCHLD, SIG_IGN);
+	for (;;) {
+		FILE* stream;
+		char command = 0;
+		char response[16];
+		char* prefix = ".";
+		int fds[2];
+		int error, writeError;
+		pid_t pid;
+		int connection = accept(server, NULL, NULL);
+		if (connection < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "accept failed: %s\n", strerror(errno));
+			c_exit(E_IO_ERROR);
+		}
+		error = fxReceiveFileDescriptors(connection, &command, fds);
+		if (!error && (command == 'q')) {
+			close(connection);
+			break;
+		}
+		if (!error && (command != 'f')) {
+			close(fds[0]);
+			close(fds[1]);
+			error = EINVAL;
+		}
+		if (!error) {
+			pid = fork();
+			if (pid == 0) {
+#if mxLinux
+				// the child reads its own resident size, not the zygote's
+				if (gxResidentFD >= 0) {
+					close(gxResidentFD);
+					gxResidentFD = -1;
+				}
+#endif
+				// move the pipes out of the way, then to fd 3 and fd 4
+				int fromParent = fcntl(fds[0], F_DUPFD, 5);
+				int toParent = fcntl(fds[1], F_DUPFD, 5);
+				close(connection);
+				close(server);
+				close(fds[0]);
+				close(fds[1]);
+				if ((fromParent < 0) || (toParent < 0) || (dup2(fromParent, 3) < 0) || (dup2(toParent, 4) < 0)) {
+					fprintf(stderr, "cannot install pipes: %s\n", strerror(errno));
+					c_exit(E_IO_ERROR);
+				}
+				close(fromParent);
+				close(toParent);
+				openResidentSize();
+				signal(SIGCHLD, SIG_DFL);
+				return;
+			}
+			if (pid < 0)
+				error = errno;
+			close(fds[0]);
+			close(fds[1]);
+		}
+		if (error) {
+			prefix = "!";
+			snprintf(response, sizeof(response), "%d", error);
+		}
+		else
+			snprintf(response, sizeof(response), "%d", (int)pid);
+		stream = fdopen(connection, "wb");
+		if (stream) {
+			writeError = fxWriteNetString(stream, "", prefix, response, strlen(response));
+			if (writeError != 0)
+				fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			fclose(stream);
+		}
+		else
+			close(connection);
+	}
+	close(server);
+	unlink(path);
+	c_exit(E_SUCCESS);
+}
+
+static void fxEnterDelivery(MachineState* state)
+{
+	if (gxDeadline) {
+		clock_gettime(CLOCK_MONOTONIC, &state->deadline);
+		state->deadline.tv_sec += gxDeadline / 1000;
+		state->deadline.tv_nsec += (long)(gxDeadline % 1000) * 1000000;
+		if (state->deadline.tv_nsec >= 1000000000) {
+			state->deadline.tv_sec++;
+			state->deadline.tv_nsec -= 1000000000;
+		}
+		state->deadlineCount = 0;
+		state->deadlineExceeded = 0;
+	}
+	char* request = NULL;
+	if (gxControlFD < 0)
+		return;
+	pthread_mutex_lock(&gxControl.mutex);
+	__atomic_store_n(&state->cancelled, 0, __ATOMIC_RELAXED);
+	gettimeofday(&state->runningSince, NULL);
+	state->nextRunning = gxControl.running;
+	gxControl.running = state;
+	if (state->profileRequests != gxControl.profileRequests) {
+		state->profileRequests = gxControl.profileRequests;
+		request = strdup(gxControl.profileRequest);
+	}
+	pthread_mutex_unlock(&gxControl.mutex);
+	if (request) {
+		fxApplyProfileRequest(state, request);
+		free(request);
+	}
+}
+
+static void fxApplyProfileRequest(MachineState* state, char* request)
+{
+	// on the thread of the machine, between commands
+	char path[PATH_MAX];
+	FILE* stream;
+	if (*request == 'p') {
+		char* error = fxBeginProfiler(state, request + 1);
+		if (error)
+			fprintf(stderr, "control: %s%s\n", state->label, error);
+		return;
+	}
+	if (!state->profiler)
+		return;
+	if (gxMultiMachine)
+		snprintf(path, sizeof(path), "%s.%d", request + 1, state->id);
+	else
+		snprintf(path, sizeof(path), "%s", request + 1);
+	stream = fopen(path, "w");
+	if (!stream) {
+		// the machine goes on profiling until a request names a path it can write
+		fprintf(stderr, "cannot write profile %s: %s\n", path, strerror(errno));
+		return;
+	}
+	fxEndProfiler(state, stream);
+	if (fclose(stream))
+		fprintf(stderr, "cannot write profile %s: %s\n", path, strerror(errno));
+}
+
+static void fxExitDelivery(MachineState* state)
+{
+	MachineState** address;
+	if (gxControlFD < 0)
+		return;
+	pthread_mutex_lock(&gxControl.mutex);
+	address = &gxControl.running;
+	while (*address != state)
+		address = &((*address)->nextRunning);
+	*address = state->nextRunning;
+	// too late to cancel: the delivery has a response
+	if (!state->machine || !state->machine->abortStatus)
+		__atomic_store_n(&state->cancelled, 0, __ATOMIC_RELAXED);
+	gxControl.deliveries++;
+	pthread_mutex_unlock(&gxControl.mutex);
+}
+
+static void fxStartControl(int fd)
+{
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, fxServeControl, (void*)(intptr_t)fd)) {
+		fprintf(stderr, "cannot create control thread: %s\n", strerror(errno));
+		c_exit(E_UNKNOWN_ERROR);
+	}
+	pthread_detach(thread);
+}
+
+// Requests, as netstrings:
+// "s": respond "." and a JSON object with the process usage and the running deliveries
+// "x": cancel the running deliveries, "x<id>" the running delivery of machine <id>;
+//		respond "." and the number of deliveries cancelled
+// "p<kind>": start the profiler of every machine when its next command starts,
+//		as the p command does; respond "."
+// "P<path>": stop the profiler of every machine when its next command starts,
+//		writing the profile to <path>, or <path>.<id> in the multi-machine modes;
+//		respond "."
+static void* fxServeControl(void* it)
+{
+	int fd = (int)(intptr_t)it;
+	FILE* fromControl = fdopen(fd, "rb");
+	FILE* toControl = fdopen(dup(fd), "wb");
+	if (!fromControl || !toControl) {
+		fprintf(stderr, "fdopen(%d) control failed\n", fd);
+		c_exit(E_IO_ERROR);
+	}
+	for (;;) {
+		char* nsbuf;
+		size_t nslen;
+		char* response = NULL;
+		size_t length = 0;
+		char* prefix = ".";
+		int writeError;
+		int readError = fxReadNetString(fromControl, &nsbuf, &nslen);
+		if (readError != 0) {
+			// the parent is still served on fd 3
+			if (!feof(fromControl))
+				fprintf(stderr, "control: %s\n", fxReadNetStringError(readError));
+			break;
+		}
+		switch (nslen ? *nsbuf : 0) {
+		case 's': {
+			struct timeval now;
+			struct rusage usage;
+			MachineState* state;
+			FILE* stream = open_memstream(&response, &length);
+			if (!stream) {
+				fprintf(stderr, "cannot allocate control response\n");
+				c_exit(E_NOT_ENOUGH_MEMORY);
+			}
+			gettimeofday(&now, NULL);
+			getrusage(RUSAGE_SELF, &usage);
+			pthread_mutex_lock(&gxControl.mutex);
+			fprintf(stream, "{\"deliveries\":%llu,\"cancellations\":%llu,\"cpuTime\":%llu,\"residentSize\":%zu,\"running\":[",
+				gxControl.deliveries, gxControl.cancellations,
+				(unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+					+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec,
+				residentSize());
+			for (state = gxControl.running; state; state = state->nextRunning) {
+				long long elapsed = (long long)(now.tv_sec - state->runningSince.tv_sec) * 1000000 + (now.tv_usec - state->runningSince.tv_usec);
+				fprintf(stream, "%s{\"id\":%d,\"elapsed\":%lld}", (state == gxControl.running) ? "" : ",", state->id, elapsed);
+			}
+			pthread_mutex_unlock(&gxControl.mutex);
+			fprintf(stream, "]}");
+			fclose(stream);
+		} break;
+#if mxMetering
+		case 'x': {
+			MachineState* state;
+			xsBooleanValue any = (nslen == 1);
+			xsIntegerValue id = any ? 0 : (xsIntegerValue)strtol(nsbuf + 1, NULL, 10);
+			int count = 0;
+			pthread_mutex_lock(&gxControl.mutex);
+			for (state = gxControl.running; state; state = state->nextRunning) {
+				if (any || (state->id == id)) {
+					__atomic_store_n(&state->cancelled, 1, __ATOMIC_RELAXED);
+					count++;
+				}
+			}
+			gxControl.cancellations += count;
+			pthread_mutex_unlock(&gxControl.mutex);
+			response = malloc(16);
+			if (!response) {
+				fprintf(stderr, "cannot allocate control response\n");
+				c_exit(E_NOT_ENOUGH_MEMORY);
+			}
+			length = snprintf(response, 16, "%d", count);
+		} break;
+#endif
+		case 'p':
+		case 'P': {
+			char* request;
+			if ((*nsbuf == 'P') && (nslen == 1)) {
+				prefix = "!";
+				response = strdup("missing path");
+				length = response ? strlen(response) : 0;
+				break;
+			}
+			request = strdup(nsbuf);
+			if (!request) {
+				fprintf(stderr, "cannot allocate control request\n");
+				c_exit(E_NOT_ENOUGH_MEMORY);
+			}
+			pthread_mutex_lock(&gxControl.mutex);
+			free(gxControl.profileRequest);
+			gxControl.profileRequest = request;
+			gxControl.profileRequests++;
+			pthread_mutex_unlock(&gxControl.mutex);
+		} break;
+		default:
+			prefix = "!";
+			response = strdup("unknown request");
+			length = response ? strlen(response) : 0;
+			break;
+		}
+		free(nsbuf);
+		writeError = fxWriteNetString(toControl, "", prefix, response ? response : "", length);
+		free(response);
+		if (writeError != 0) {
+			fprintf(stderr, "control: %s\n", fxWriteNetStringError(writeError));
+			break;
+		}
+	}
+	fclose(fromControl);
+	fclose(toControl);
+	return NULL;
+}
+
 void xsBuildAgent(xsMachine* machine)
 {
 	xsBeginHost(machine);
 	xsVars(1);
 	
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearImmediate"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearImmediate"), xsResult, xsDontEnum);
 	xsResult = xsNewHostFunction(xs_setImmediate, 1);
 	xsDefine(xsGlobal, xsID("setImmediate"), xsResult, xsDontEnum);
 	
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearInterval"), xsResult, xsDontEnum);
-// 	xsResult = xsNewHostFunction(xs_setInterval, 1);
-// 	xsDefine(xsGlobal, xsID("setInterval"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearInterval"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_setInterval, 1);
+	xsDefine(xsGlobal, xsID("setInterval"), xsResult, xsDontEnum);
 	
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearTimeout"), xsResult, xsDontEnum);
-// 	xsResult = xsNewHostFunction(xs_setTimeout, 1);
-// 	xsDefine(xsGlobal, xsID("setTimeout"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearTimeout"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_setTimeout, 1);
+	xsDefine(xsGlobal, xsID("setTimeout"), xsResult, xsDontEnum);
 	
 	xsResult = xsNewHostFunction(xs_gc, 1);
 	xsDefine(xsGlobal, xsID("gc"), xsResult, xsDontEnum);
@@ -715,30 +2281,239 @@ void xsBuildAgent(xsMachine* machine)
 	xsResult = xsNewHostFunction(xs_resetMeter, 1);
 	xsDefine(xsGlobal, xsID("resetMeter"), xsResult, xsDontEnum);
 
-	modInstallTextDecoder(the);
-	modInstallTextEncoder(the);
-	modInstallBase64(the);
+	fxInstallText(the);
+	fxInstallBase64(the);
+	fxInstallMarshal(the);
 
  	xsResult = xsNewHostFunction(fx_harden, 1);
  	xsDefine(xsGlobal, xsID("harden"), xsResult, xsDontEnum);
 
-// 	xsResult = xsNewObject();
-// 	xsVar(0) = xsNewHostFunction(fx_print, 0);
-// 	xsDefine(xsResult, xsID("log"), xsVar(0), xsDontEnum);
-// 	xsDefine(xsGlobal, xsID("console"), xsResult, xsDontEnum);
+	xsResult = xsNewObject();
+	xsVar(0) = xsNewHostFunction(xs_console_debug, 0);
+	xsDefine(xsResult, xsID("debug"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_error, 0);
+	xsDefine(xsResult, xsID("error"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_info, 0);
+	xsDefine(xsResult, xsID("info"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_log, 0);
+	xsDefine(xsResult, xsID("log"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_warn, 0);
+	xsDefine(xsResult, xsID("warn"), xsVar(0), xsDontEnum);
+	xsDefine(xsGlobal, xsID("console"), xsResult, xsDontEnum);
 
 	xsEndHost(machine);
 }
 
 void xsPrintUsage()
 {
-	printf("xsnap [-h] [-i <interval>] [-l <limit>] [-s <size>] [-m] [-r <snapshot>] [-s] [-v]\n");
+	printf("xsnap [-h] [-b <size>] [-c <path>] [-C <fd>] [-D <ms>] [-g <size>] [-H <percent>] [-i <interval>] [-I] [-k <size>] [-l <limit>] [-L <fd>] [-M] [-s <size>] [-m] [-r <snapshot>] [-R <path>] [-s] [-T <threads>] [-v] [-Z <path>]\n");
 	printf("\t-h: print this help message\n");
+	printf("\t-b <size>: buffer up to <size> kB of records for -R (default to 16384)\n");
+	printf("\t-c <path>: write a profile of the computrons spent by each function to <path> at exit\n");
+	printf("\t-C <fd>: serve control requests on <fd> (see documentation)\n");
+	printf("\t-D <ms>: abort deliveries that run longer than <ms> milliseconds (default to none)\n");
+	printf("\t-g <size>: collect garbage between deliveries after the heap grows by <size> kB (default to never)\n");
+	printf("\t-H <percent>: restore the heap sized to the snapshot plus <percent> headroom (default to the saved sizes)\n");
 	printf("\t-i <interval>: metering interval (default to 1)\n");
+	printf("\t-I: append an index of the atoms to written snapshots\n");
+	printf("\t-k <size>: return free heap memory beyond <size> kB to the OS (default to never)\n");
 	printf("\t-l <limit>: metering limit (default to none)\n");
+	printf("\t-L <fd>: write print and console records to <fd> as lines of JSON (default to plain text on stdout)\n");
+	printf("\t-M: host many machines, addressed by id (see documentation)\n");
 	printf("\t-s <size>: parser buffer size, in kB (default to 8192)\n");
 	printf("\t-r <snapshot>: read snapshot to create the XS machine\n");
+	printf("\t-R <path>: record deliveries and replies to the transcript at <path>\n");
+	printf("\t-T <threads>: like -M, but run machines on a pool of <threads> threads\n");
 	printf("\t-v: print XS version\n");
+	printf("\t-Z <path>: fork a worker for every request on the unix socket at <path> (see documentation)\n");
+}
+
+void fxCollectIfIdle(MachineState* state)
+{
+	xsMachine* the = state->machine;
+	size_t current;
+	if (!gxIdleCollectThreshold)
+		return;
+	current = fxGetCurrentHeapSize(the);
+	if (current < state->idleCollectBaseline) {
+		// XS collected during the delivery
+		state->idleCollectBaseline = current;
+		return;
+	}
+	if (current - state->idleCollectBaseline < gxIdleCollectThreshold)
+		return;
+	// Outside of a crank: the meter is reset by the next xsBeginCrank.
+	xsBeginHost(the);
+	{
+		xsCollectGarbage();
+	}
+	xsEndHost(the);
+	state->idleCollectBaseline = fxGetCurrentHeapSize(the);
+	fxReleaseFreeSpace(state);
+}
+
+void fxReleaseFreeSpace(MachineState* state)
+{
+	// after a collection: return the empty slot segments and the free chunk pages
+	if (!gxReleaseFreeSpace)
+		return;
+	fxReleaseFreeSlots(state->machine, gxReleaseHysteresis);
+	fxReleaseFreeChunks(state->machine, gxReleaseHysteresis);
+	state->releaseHeapSize = fxGetCurrentHeapSize(state->machine);
+}
+
+void fxSetProfilerInterval(MachineState* state)
+{
+#if mxMetering
+	// the computron profiler samples at every regular check, or at every
+	// opportunity: set again whenever metering or the meter index is reset
+	if (state->profiler == 'c')
+		xsSetMeterInterval(state->machine, gxMeteringInterval ? gxMeteringInterval : 1);
+#endif
+}
+
+int fxWriteComputronProfile(MachineState* state, char* path)
+{
+	int error = 0;
+#if mxMetering
+	FILE* stream = fopen(path, "w");
+	state->profiling = 0;
+	if (stream) {
+		error = fxStopComputronProfiling(state->machine, stream);
+		if (fclose(stream) && !error)
+			error = errno;
+	}
+	else {
+		error = errno;
+		fxStopComputronProfiling(state->machine, NULL);
+	}
+	if (error)
+		fprintf(stderr, "cannot write profile %s: %s\n", path, strerror(error));
+#endif
+	return error;
+}
+
+char* fxBeginProfiler(MachineState* state, char* kind)
+{
+	char* error = NULL;
+	if (state->profiler || state->profiling)
+		error = "already profiling";
+	else if (!strcmp(kind, "") || !strcmp(kind, "t")) {
+#ifdef mxProfile
+		fxStartProfiling(state->machine);
+		state->profiler = 't';
+#else
+		error = "mxProfile is not enabled";
+#endif
+	}
+	else if (!strcmp(kind, "c")) {
+#if mxMetering
+		fxStartComputronProfiling(state->machine);
+		state->profiling = 1;
+		state->profiler = 'c';
+		fxSetProfilerInterval(state);
+#else
+		error = "mxMetering is not enabled";
+#endif
+	}
+	else
+		error = "unknown profiler";
+	return error;
+}
+
+void fxEndProfiler(MachineState* state, FILE* stream)
+{
+	xsMachine* machine = state->machine;
+	if (state->profiler == 't') {
+#ifdef mxProfile
+		fxStopProfiling(machine, stream);
+#endif
+	}
+#if mxMetering
+	else {
+		state->profiling = 0;
+		fxStopComputronProfiling(machine, stream);
+		// back to the interval the worker was launched with
+		xsSetMeterInterval(machine, gxMeteringInterval);
+	}
+#endif
+	state->profiler = 0;
+}
+
+void fxStartProfiler(MachineState* state, char* kind)
+{
+	char* error = fxBeginProfiler(state, kind);
+	int writeError;
+	if (error)
+		writeError = fxWriteNetString(state->toParent, state->label, "!", error, strlen(error));
+	else
+		writeError = fxWriteNetString(state->toParent, state->label, ".", "", 0);
+	if (writeError != 0) {
+		fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+		c_exit(E_IO_ERROR);
+	}
+}
+
+void fxStopProfiler(MachineState* state)
+{
+	char* profile = NULL;
+	size_t profileLength = 0;
+	int writeError;
+	FILE* stream;
+	if (!state->profiler) {
+		writeError = fxWriteNetString(state->toParent, state->label, "!", "not profiling", 13);
+		if (writeError != 0) {
+			fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+			c_exit(E_IO_ERROR);
+		}
+		return;
+	}
+	stream = open_memstream(&profile, &profileLength);
+	if (!stream) {
+		fprintf(stderr, "cannot allocate profile\n");
+		c_exit(E_NOT_ENOUGH_MEMORY);
+	}
+	fxEndProfiler(state, stream);
+	if (fclose(stream)) {
+		fprintf(stderr, "cannot allocate profile\n");
+		c_exit(E_NOT_ENOUGH_MEMORY);
+	}
+	writeError = fxWriteNetString(state->toParent, state->label, ".", profile, profileLength);
+	free(profile);
+	if (writeError != 0) {
+		fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+		c_exit(E_IO_ERROR);
+	}
+}
+
+void fxWriteCensus(MachineState* state)
+{
+	xsMachine* machine = state->machine;
+	char* census = NULL;
+	size_t censusLength = 0;
+	int error, writeError;
+	FILE* stream = open_memstream(&census, &censusLength);
+	if (!stream) {
+		fprintf(stderr, "cannot allocate census\n");
+		c_exit(E_NOT_ENOUGH_MEMORY);
+	}
+	error = fxWriteHeapCensus(machine, stream);
+	if (fclose(stream) && !error)
+		error = errno;
+	// fxWriteHeapCensus collects garbage first
+	state->idleCollectBaseline = fxGetCurrentHeapSize(machine);
+	fxReleaseFreeSpace(state);
+	if (error) {
+		char* message = strerror(error);
+		writeError = fxWriteNetString(state->toParent, state->label, "!", message, strlen(message));
+	}
+	else
+		writeError = fxWriteNetString(state->toParent, state->label, ".", census, censusLength);
+	free(census);
+	if (writeError != 0) {
+		fprintf(stderr, "%s\n", fxWriteNetStringError(writeError));
+		c_exit(E_IO_ERROR);
+	}
 }
 
 void xs_clearTimer(xsMachine* the)
@@ -749,7 +2524,8 @@ void xs_clearTimer(xsMachine* the)
 void xs_currentMeterLimit(xsMachine* the)
 {
 #if mxMetering
-	xsResult = xsInteger(gxCurrentMeter);
+	MachineState* state = xsGetContext(the);
+	xsResult = xsInteger(state->currentMeter);
 #endif
 }
 
@@ -765,32 +2541,213 @@ void xs_performance_now(xsMachine *the)
 	xsResult = xsNumber((double)(tv.tv_sec * 1000.0) + ((double)(tv.tv_usec) / 1000.0));
 }
 
-void xs_print(xsMachine* the)
+static void fxAppendConsole(xsMachine* the, MachineState* state, char* buffer, size_t length)
+{
+	if (state->consoleLength + length > state->consoleSize) {
+		size_t size = state->consoleSize ? state->consoleSize : 4096;
+		char* console;
+		while (size < state->consoleLength + length)
+			size *= 2;
+		console = realloc(state->console, size);
+		if (!console)
+			xsUnknownError("not enough memory for the console");
+		state->console = console;
+		state->consoleSize = size;
+	}
+	memcpy(state->console + state->consoleLength, buffer, length);
+	state->consoleLength += length;
+}
+
+// Append a CESU-8 string as the contents of a JSON string, in UTF-8.
+static void fxAppendConsoleJSON(xsMachine* the, MachineState* state, char* string)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char* p = (unsigned char*)string;
+	unsigned char* q = p;
+	unsigned char c;
+	while ((c = *q)) {
+		char buffer[6];
+		size_t length, size;
+		if ((c == '"') || (c == '\\')) {
+			buffer[0] = '\\';
+			buffer[1] = (char)c;
+			length = 2;
+			size = 1;
+		}
+		else if (c < 0x20) {
+			memcpy(buffer, "\\u00", 4);
+			buffer[4] = hex[c >> 4];
+			buffer[5] = hex[c & 15];
+			length = 6;
+			size = 1;
+		}
+		else if ((c == 0xC0) && (q[1] == 0x80)) {
+			memcpy(buffer, "\\u0000", 6);
+			length = 6;
+			size = 2;
+		}
+		else if ((c == 0xED) && (q[1] >= 0xA0) && q[2]) {
+			if ((q[1] < 0xB0) && (q[3] == 0xED) && (q[4] >= 0xB0) && q[5]) {
+				unsigned int character = 0x10000 + ((((q[1] & 0x0F) << 6) | (q[2] & 0x3F)) << 10) + (((q[4] & 0x0F) << 6) | (q[5] & 0x3F));
+				buffer[0] = (char)(0xF0 | (character >> 18));
+				buffer[1] = (char)(0x80 | ((character >> 12) & 0x3F));
+				buffer[2] = (char)(0x80 | ((character >> 6) & 0x3F));
+				buffer[3] = (char)(0x80 | (character & 0x3F));
+				length = 4;
+				size = 6;
+			}
+			else {
+				// lone surrogate
+				memcpy(buffer, "\xEF\xBF\xBD", 3);
+				length = 3;
+				size = 3;
+			}
+		}
+		else {
+			q++;
+			continue;
+		}
+		fxAppendConsole(the, state, (char*)p, q - p);
+		fxAppendConsole(the, state, buffer, length);
+		q += size;
+		p = q;
+	}
+	fxAppendConsole(the, state, (char*)p, q - p);
+}
+
+static void fxConsole(xsMachine* the, char* level)
 {
+	MachineState* state = xsGetContext(the);
 	xsIntegerValue c = xsToInteger(xsArgc), i;
+	size_t start;
+	char buffer[256];
+	xsUnsignedValue meter = 0;
 #if mxMetering
-	if (gxMeteringPrint)
-		fprintf(stdout, "[%u] ", xsGetCurrentMeter(the));
+	meter = xsGetCurrentMeter(the);
 #endif
+	// toString methods run before anything is appended, so the console calls
+	// they make write their own records, and start is still valid below
 	for (i = 0; i < c; i++) {
-		if (i)
-			fprintf(stdout, " ");
-		fprintf(stdout, "%s", xsToString(xsArg(i)));
+		if (xsTypeOf(xsArg(i)) != xsStringType)
+			xsArg(i) = xsCall1(xsString(""), xsID("concat"), xsArg(i));
 	}
-	fprintf(stdout, "\n");
+	start = state->consoleLength;
+	xsTry {
+		if (gxConsoleFD >= 0) {
+			c_timeval tv;
+			c_gettimeofday(&tv, NULL);
+			snprintf(buffer, sizeof(buffer), "{\"level\":\"%s\",\"time\":%.3f,\"meter\":%u,",
+				level, (double)(tv.tv_sec * 1000.0) + ((double)(tv.tv_usec) / 1000.0), meter);
+			fxAppendConsole(the, state, buffer, strlen(buffer));
+			if (gxMultiMachine) {
+				snprintf(buffer, sizeof(buffer), "\"machine\":%d,", state->id);
+				fxAppendConsole(the, state, buffer, strlen(buffer));
+			}
+			fxAppendConsole(the, state, "\"message\":\"", 11);
+			for (i = 0; i < c; i++) {
+				if (i)
+					fxAppendConsole(the, state, " ", 1);
+				fxAppendConsoleJSON(the, state, xsToString(xsArg(i)));
+			}
+			fxAppendConsole(the, state, "\"}\n", 3);
+		}
+		else {
+#if mxMetering
+			if (gxMeteringPrint) {
+				snprintf(buffer, sizeof(buffer), "[%u] ", meter);
+				fxAppendConsole(the, state, buffer, strlen(buffer));
+			}
+#endif
+			for (i = 0; i < c; i++) {
+				char* string;
+				if (i)
+					fxAppendConsole(the, state, " ", 1);
+				string = xsToString(xsArg(i));
+				fxAppendConsole(the, state, string, strlen(string));
+			}
+			fxAppendConsole(the, state, "\n", 1);
+		}
+	}
+	xsCatch {
+		// not enough memory, no partial record
+		state->consoleLength = start;
+		xsThrow(xsException);
+	}
+	if (state->consoleLength >= gxConsoleThreshold)
+		fxFlushConsole(state);
+}
+
+static void fxFlushConsole(MachineState* state)
+{
+	char* buffer = state->console;
+	size_t length = state->consoleLength;
+	if (length == 0)
+		return;
+	pthread_mutex_lock(&gxConsoleMutex);
+	if (gxConsoleFD >= 0) {
+		while (length > 0) {
+			ssize_t count = write(gxConsoleFD, buffer, length);
+			if (count < 0) {
+				if (errno == EINTR)
+					continue;
+				// the records are lost, not the delivery
+				fprintf(stderr, "cannot write console: %s\n", strerror(errno));
+				break;
+			}
+			buffer += count;
+			length -= count;
+		}
+	}
+	else {
+		fwrite(buffer, 1, length, stdout);
 		fflush(stdout);
+	}
+	pthread_mutex_unlock(&gxConsoleMutex);
+	state->consoleLength = 0;
+}
+
+void xs_console_debug(xsMachine* the)
+{
+	fxConsole(the, "debug");
+}
+
+void xs_console_error(xsMachine* the)
+{
+	fxConsole(the, "error");
+}
+
+void xs_console_info(xsMachine* the)
+{
+	fxConsole(the, "info");
+}
+
+void xs_console_log(xsMachine* the)
+{
+	fxConsole(the, "log");
+}
+
+void xs_console_warn(xsMachine* the)
+{
+	fxConsole(the, "warn");
+}
+
+void xs_print(xsMachine* the)
+{
+	fxConsole(the, "log");
 }
 
 void xs_resetMeter(xsMachine* the)
 {
 #if mxMetering
+	MachineState* state = xsGetContext(the);
 	xsIntegerValue argc = xsToInteger(xsArgc);
 	if (argc < 2) {
 		xsTypeError("expected newMeterLimit, newMeterIndex");
 	}
 	xsResult = xsInteger(xsGetCurrentMeter(the));
-	gxCurrentMeter = xsToInteger(xsArg(0));
+	state->currentMeter = xsToInteger(xsArg(0));
 	xsSetCurrentMeter(the, xsToInteger(xsArg(1)));
+	fxSetProfilerInterval(state);
 #endif
 }
 
@@ -801,12 +2758,12 @@ void xs_setImmediate(xsMachine* the)
 
 void xs_setInterval(xsMachine* the)
 {
-	xsSetTimer(xsToNumber(xsArg(1)), 1);
+	xsSetTimer((xsToInteger(xsArgc) > 1) ? xsToNumber(xsArg(1)) : 0, 1);
 }
 
 void xs_setTimeout(xsMachine* the)
 {
-	xsSetTimer(xsToNumber(xsArg(1)), 0);
+	xsSetTimer((xsToInteger(xsArgc) > 1) ? xsToNumber(xsArg(1)) : 0, 0);
 }
 
 
@@ -854,10 +2811,15 @@ static char* fxReadNetStringError(int code)
 	}
 }
 
-static int fxWriteOkay(FILE* outStream, xsUnsignedValue meterIndex, xsMachine *the, char* buf, size_t length)
+static int fxWriteOkay(MachineState* state, xsUnsignedValue meterIndex, char* buf, size_t length)
 {
-	recordTimestamp(); // before sending delivery-result to parent
-	char *tsbuf = renderTimestamps();
+	xsMachine* the = state->machine;
+	fxFlushConsole(state);
+	recordTimestamp(state); // before sending delivery-result to parent
+	txUsage usage;
+	sampleUsage(&usage);
+	char timestampBuffer[TIMESTAMP_BUFFER_SIZE];
+	char *tsbuf = renderTimestamps(state, timestampBuffer);
 	if (!tsbuf) {
 		// rendering overrun error, send empty list
 		tsbuf = "[]";
@@ -867,31 +2829,43 @@ static int fxWriteOkay(FILE* outStream, xsUnsignedValue meterIndex, xsMachine *t
 				  "\"currentHeapCount\":%u,"
 				  "\"compute\":%u,"
 				  "\"allocate\":%u,"
+				  "\"committed\":%zu,"
+				  "\"cpuTime\":%llu,"
+				  "\"minorFaults\":%llu,"
+				  "\"majorFaults\":%llu,"
+				  "\"residentSize\":%zu,"
 				  "\"timestamps\":%s}"
 				  "\1" // separate meter info from result
 				  );
 	char numeral64[] = "12345678901234567890"; // big enough for 64bit numeral
-	char prefix[8 + sizeof fmt + 8 * sizeof numeral64 + sizeof timestampBuffer];
+	char prefix[8 + sizeof fmt + 12 * sizeof numeral64 + TIMESTAMP_BUFFER_SIZE];
 	// Prepend the meter usage to the reply.
 	snprintf(prefix, sizeof(prefix), fmt,
 			 fxGetCurrentHeapCount(the),
-			 meterIndex, the->allocatedSpace, tsbuf);
-	return fxWriteNetString(outStream, prefix, buf, length);
+			 meterIndex, the->allocatedSpace, fxGetCommittedSpace(the),
+			 usage.cpuTime - state->deliveryUsage.cpuTime,
+			 usage.minorFaults - state->deliveryUsage.minorFaults,
+			 usage.majorFaults - state->deliveryUsage.majorFaults,
+			 residentSize(), tsbuf);
+	return fxWriteNetString(state->toParent, state->label, prefix, buf, length);
 }
 
-static int fxWriteNetString(FILE* outStream, char* prefix, char* buf, size_t length)
+static int fxWriteNetString(FILE* outStream, char* label, char* prefix, char* buf, size_t length)
 {
-	if (fprintf(outStream, "%lu:%s", length + strlen(prefix), prefix) < 1) {
-		return 1;
+	int error = 0;
+	// pool threads share the stream: write whole netstrings
+	flockfile(outStream);
+	if (fprintf(outStream, "%lu:%s%s", length + strlen(label) + strlen(prefix), label, prefix) < 1) {
+		error = 1;
 	} else if (fwrite(buf, 1, length, outStream) < length) {
-		return 2;
+		error = 2;
 	} else if (fputc(',', outStream) == EOF) {
-		return 3;
+		error = 3;
 	} else if (fflush(outStream) < 0) {
-		return 4;
+		error = 4;
 	}
-
-	return 0;
+	funlockfile(outStream);
+	return error;
 }
 
 static char* fxWriteNetStringError(int code)
@@ -913,12 +2887,18 @@ static void xs_issueCommand(xsMachine *the)
 		xsTypeError("expected ArrayBuffer");
 	}
 
+	MachineState* state = xsGetContext(the);
 	size_t length = xsGetArrayBufferLength(xsArg(0));
 	char* buf = xsToArrayBuffer(xsArg(0));
+	size_t labelLength = strlen(state->label);
   
-	recordTimestamp(); // before sending command to parent
+	recordTimestamp(state); // before sending command to parent
+
+	if (gxRecording)
+		fxRecord(mxRecordJSON | mxRecordCommand, buf, length);
 
-	int writeError = fxWriteNetString(toParent, "?", buf, length);
+	fxFlushConsole(state);
+	int writeError = fxWriteNetString(state->toParent, state->label, "?", buf, length);
 
 	if (writeError != 0) {
 		xsUnknownError(fxWriteNetStringError(writeError));
@@ -926,77 +2906,115 @@ static void xs_issueCommand(xsMachine *the)
 
 	// read netstring
 	size_t len;
-	int readError = fxReadNetString(fromParent, &buf, &len);
-	if (readError != 0) {
-		xsUnknownError(fxReadNetStringError(readError));
+	if (gxThreadCount) {
+		// the reader thread passes the reply along
+		pthread_mutex_lock(&state->mutex);
+		while (!state->reply && !state->closed)
+			pthread_cond_wait(&state->replied, &state->mutex);
+		buf = state->reply;
+		len = state->replyLength;
+		state->reply = NULL;
+		pthread_mutex_unlock(&state->mutex);
+		if (!buf) {
+			xsUnknownError("No more command replies.");
+		}
+	}
+	else {
+		int readError = fxReadNetString(state->fromParent, &buf, &len);
+		if (readError != 0) {
+			xsUnknownError(fxReadNetStringError(readError));
+		}
 	}
-	recordTimestamp(); // after command-result received from parent
+	recordTimestamp(state); // after command-result received from parent
 
-#if XSNAP_TEST_RECORD
-	fxTestRecord(mxTestRecordJSON | mxTestRecordReply, buf, len);
-#endif
-	char command = *buf;
-	if (len == 0 || command != '/') {
+	// in multi-machine mode, the reply must be addressed to this machine
+	if (len <= labelLength || strncmp(buf, state->label, labelLength)) {
+		xsUnknownError("Received unexpected command reply.");
+	}
+	char command = *(buf + labelLength);
+	if (command != '/') {
 		xsUnknownError("Received unexpected command reply.");
 	}
 
-	xsResult = xsArrayBuffer(buf + 1, len - 1);
+	if (gxRecording)
+		fxRecord(mxRecordJSON | mxRecordReply, buf + labelLength + 1, len - labelLength - 1);
+	xsResult = xsArrayBuffer(buf + labelLength + 1, len - labelLength - 1);
 	free(buf);
 }
 
-#if XSNAP_TEST_RECORD
-
-static char directory[PATH_MAX];
-void fxTestRecordArgs(int argc, char* argv[])
+int fxStartRecording(int argc, char* argv[])
 {
-	struct timeval tv;
-	struct tm* tm_info;
-	gettimeofday(&tv, NULL);
 	char path[PATH_MAX];
-	FILE* file;
-	mkdir("xsnap-tests", 0755);
-	tm_info = localtime(&tv.tv_sec);
-	strftime(path, sizeof(path), "%Y-%m-%d-%H-%M-%S", tm_info);
-	sprintf(directory, "xsnap-tests/%s-%3.3d", path, tv.tv_usec / 1000);
-	mkdir(directory, 0755);
-	sprintf(path, "%s/args.sh", directory);
-	file = fopen(path, "w");
-	if (file) {
-		int argi;
-		for (argi = 0; argi < argc; argi++)
-			fprintf(file, " %s", argv[argi]);
-		fprintf(file, "\n");
-		fclose(file);
+	char* recordPath = gxRecordPath;
+	size_t length = 0;
+	char* args;
+	int argi, error;
+	if (!recordPath) {
+		// XSNAP_TEST_RECORD: a transcript for every run
+		struct timeval tv;
+		struct tm* tm_info;
+		char date[64];
+		gettimeofday(&tv, NULL);
+		mkdir("xsnap-tests", 0755);
+		tm_info = localtime(&tv.tv_sec);
+		strftime(date, sizeof(date), "%Y-%m-%d-%H-%M-%S", tm_info);
+		snprintf(path, sizeof(path), "xsnap-tests/%s-%3.3d.xst", date, (int)(tv.tv_usec / 1000));
+		recordPath = path;
 	}
+	error = fxStartTranscriptRecorder(&gxRecorder, recordPath, gxRecordCapacity);
+	if (error) {
+		fprintf(stderr, "cannot record to %s: %s\n", recordPath, strerror(error));
+		return error;
+	}
+	gxRecording = 1;
+	atexit(fxStopRecording);
+	for (argi = 0; argi < argc; argi++)
+		length += 1 + strlen(argv[argi]);
+	args = malloc(length + 1);
+	if (args) {
+		args[0] = 0;
+		for (argi = 0; argi < argc; argi++) {
+			strcat(args, " ");
+			strcat(args, argv[argi]);
+		}
+		fxRecordTranscript(&gxRecorder, TRANSCRIPT_ARGUMENTS, args, length);
+		free(args);
+	}
+	return 0;
 }
 
-void fxTestRecord(int flags, void* buffer, size_t length)
+void fxStopRecording(void)
 {
-	char path[PATH_MAX];
-	FILE* file;
-	if (flags & mxTestRecordParam) {
-		sprintf(path, "%s/param-%d", directory, gxTestRecordReplyIndex);
-		gxTestRecordReplyIndex++;
-	}
-	else {
-		sprintf(path, "%s/reply-%d", directory, gxTestRecordParamIndex);
-		gxTestRecordParamIndex++;
+	size_t dropped = gxRecorder.dropped;
+	int error;
+	if (!gxRecording)
+		return;
+	gxRecording = 0;
+	error = fxStopTranscriptRecorder(&gxRecorder);
+	if (error)
+		fprintf(stderr, "cannot record: %s\n", strerror(error));
+	if (dropped)
+		fprintf(stderr, "recording dropped %zu records\n", dropped);
+}
+
+void fxRecord(int flags, void* buffer, size_t length)
+{
+	char* type;
+	if (flags & mxRecordParam) {
+		if (flags & mxRecordJS)
+			type = TRANSCRIPT_EVALUATE;
+		else if (flags & mxRecordJSON)
+			type = TRANSCRIPT_DELIVERY;
+		else
+			type = TRANSCRIPT_SNAPSHOT;
 	}
-	if (flags & mxTestRecordJS)
-		strcat(path, ".js");
-	else if (flags & mxTestRecordJSON)
-		strcat(path, ".json");
+	else if (flags & mxRecordCommand)
+		type = TRANSCRIPT_COMMAND;
 	else
-		strcat(path, ".txt");
-	file = fopen(path, "wb");
-	if (file) {
-		fwrite(buffer, 1, length, file);
-		fclose(file);
-	}
+		type = TRANSCRIPT_REPLY;
+	fxRecordTranscript(&gxRecorder, type, buffer, length);
 }
 
-#endif
-
 // Local Variables:
 // tab-width: 4
 // c-basic-offset: 4
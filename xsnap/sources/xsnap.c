@@ -1,14 +1,25 @@
 #include "xsnap.h"
+#include "xsnapTranscript.h"
 
-#define SNAPSHOT_SIGNATURE "xsnap 1"
+#define SNAPSHOT_SIGNATURE "xsnap 2"
 
 extern void fxDumpSnapshot(xsMachine* the, xsSnapshot* snapshot);
+extern void fxCensusSnapshot(xsMachine* the, xsSnapshot* snapshot, void* stream);
+extern int fxDiffSnapshots(char* pathA, char* pathB, void* stream, xsBooleanValue* differ);
 
 static void xsBuildAgent(xsMachine* the);
+static int xsPrintSnapshotIndex(char* path, char* type);
 static void xsPrintUsage();
 static void xsReplay(xsMachine* machine);
-
-//static void xs_clearTimer(xsMachine* the);
+static int xsReplayTranscript(xsMachine* machine, char* path);
+static void xsReplaySnapshot(xsMachine* machine, char* buffer);
+
+static void xs_clearTimer(xsMachine* the);
+static void xs_console_debug(xsMachine* the);
+static void xs_console_error(xsMachine* the);
+static void xs_console_info(xsMachine* the);
+static void xs_console_log(xsMachine* the);
+static void xs_console_warn(xsMachine* the);
 static void xs_currentMeterLimit(xsMachine* the);
 static void xs_gc(xsMachine* the);
 static void xs_issueCommand(xsMachine* the);
@@ -17,8 +28,8 @@ static void xs_performance_now(xsMachine* the);
 static void xs_print(xsMachine* the);
 static void xs_resetMeter(xsMachine* the);
 static void xs_setImmediate(xsMachine* the);
-//static void xs_setInterval(xsMachine* the);
-//static void xs_setTimeout(xsMachine* the);
+static void xs_setInterval(xsMachine* the);
+static void xs_setTimeout(xsMachine* the);
 
 extern void xs_textdecoder(xsMachine *the);
 extern void xs_textdecoder_decode(xsMachine *the);
@@ -37,10 +48,24 @@ extern void xs_base64_encode(xsMachine *the);
 extern void xs_base64_decode(xsMachine *the);
 extern void modInstallBase64(xsMachine *the);
 
+extern void xsnap_base64_encode(xsMachine *the);
+extern void xsnap_base64_decode(xsMachine *the);
+extern void fxInstallBase64(xsMachine *the);
+
+extern void xsnap_textdecoder_decode(xsMachine *the);
+extern void xsnap_textencoder_encode(xsMachine *the);
+extern void fxInstallText(xsMachine *the);
+
+extern void xsnap_marshal_encode(xsMachine *the);
+extern void xsnap_marshal_decode(xsMachine *the);
+extern void fxInstallMarshal(xsMachine *the);
+
 // The order of the callbacks materially affects how they are introduced to
 // code that runs from a snapshot, so must be consistent in the face of
-// upgrade.
-#define mxSnapshotCallbackCount 18
+// upgrade. Adding callbacks changes the layout of snapshots, so it bumps
+// SNAPSHOT_SIGNATURE and the upgrade name printed by xsnap-worker -n.
+// "xsnap 2" added the timers (18-20), console (21-25) and Marshal (26-27).
+#define mxSnapshotCallbackCount 28
 xsCallback gxSnapshotCallbacks[mxSnapshotCallbackCount] = {
 	xs_issueCommand, // 0
 	xs_print, // 1
@@ -51,22 +76,32 @@ xsCallback gxSnapshotCallbacks[mxSnapshotCallbackCount] = {
 	xs_resetMeter, // 6
 
 	xs_textdecoder, // 7
-	xs_textdecoder_decode, // 8
+	xsnap_textdecoder_decode, // 8
 	xs_textdecoder_get_encoding, // 9
 	xs_textdecoder_get_ignoreBOM, // 10
 	xs_textdecoder_get_fatal, // 11
 
 	xs_textencoder, // 12
-	xs_textencoder_encode, // 13
+	xsnap_textencoder_encode, // 13
 	xs_textencoder_encodeInto, // 14
 
-	xs_base64_encode, // 15
-	xs_base64_decode, // 16
+	xsnap_base64_encode, // 15
+	xsnap_base64_decode, // 16
 
 	fx_harden, // 17
-	// fx_setInterval,
-	// fx_setTimeout,
-	// fx_clearTimer,
+
+	xs_setInterval, // 18
+	xs_setTimeout, // 19
+	xs_clearTimer, // 20
+
+	xs_console_debug, // 21
+	xs_console_error, // 22
+	xs_console_info, // 23
+	xs_console_log, // 24
+	xs_console_warn, // 25
+
+	xsnap_marshal_encode, // 26
+	xsnap_marshal_decode, // 27
 };
 
 static int xsSnapshopRead(void* stream, void* address, size_t size)
@@ -98,9 +133,12 @@ int main(int argc, char* argv[])
 {
 	int argi;
 	int argd = 0;
+	int argo = 0;
 	int argp = 0;
 	int argr = 0;
+	int argt = 0;
 	int argw = 0;
+	int argx = 0;
 	int error = 0;
 	int interval = 0;
 	int option = 0;
@@ -146,7 +184,17 @@ int main(int argc, char* argv[])
 	for (argi = 1; argi < argc; argi++) {
 		if (argv[argi][0] != '-')
 			continue;
-		if (!strcmp(argv[argi], "-d")) {
+		if (!strcmp(argv[argi], "-c")) {
+			argi++;
+			if (argi < argc)
+				argd = argi;
+			else {
+				xsPrintUsage();
+				return 1;
+			}
+			option = 6;
+		}
+		else if (!strcmp(argv[argi], "-d")) {
 			argi++;
 			if (argi < argc)
 				argd = argi;
@@ -180,6 +228,18 @@ int main(int argc, char* argv[])
 		}
 		else if (!strcmp(argv[argi], "-m"))
 			option = 2;
+		else if (!strcmp(argv[argi], "-o")) {
+			argi++;
+			if (argi < argc)
+				argo = argi;
+			else {
+				xsPrintUsage();
+				return 1;
+			}
+			if ((argi + 1 < argc) && (argv[argi + 1][0] != '-'))
+				argi++;
+			option = 8;
+		}
 		else if (!strcmp(argv[argi], "-p")) {
 			profiling = 1;
 			argi++;
@@ -201,8 +261,11 @@ int main(int argc, char* argv[])
 		}
 		else if (!strcmp(argv[argi], "-s"))
 			option = 3;
-		else if (!strcmp(argv[argi], "-t"))
+		else if (!strcmp(argv[argi], "-t")) {
+			if ((argi + 1 < argc) && (argv[argi + 1][0] != '-'))
+				argt = ++argi;
 			option = 4;
+		}
 		else if (!strcmp(argv[argi], "-v")) {
 			xsVersion(path, sizeof(path));
 			printf("XS %s\n", path);
@@ -216,11 +279,42 @@ int main(int argc, char* argv[])
 				return 1;
 			}
 		}
+		else if (!strcmp(argv[argi], "-x")) {
+			argi += 2;
+			if (argi < argc)
+				argx = argi - 1;
+			else {
+				xsPrintUsage();
+				return 1;
+			}
+			option = 7;
+		}
 		else {
 			xsPrintUsage();
 			return 1;
 		}
 	}
+	if (option == 7) {
+		xsBooleanValue differ;
+		error = fxDiffSnapshots(argv[argx], argv[argx + 1], stdout, &differ);
+		if (error) {
+			fprintf(stderr, "cannot diff snapshots %s %s: %s\n", argv[argx], argv[argx + 1], strerror(error));
+			return 1;
+		}
+		return differ ? 1 : 0;
+	}
+	if (option == 8) {
+		char* type = ((argo + 1 < argc) && (argv[argo + 1][0] != '-')) ? argv[argo + 1] : NULL;
+		error = xsPrintSnapshotIndex(argv[argo], type);
+		if (error) {
+			if (type)
+				fprintf(stderr, "cannot read atom %s of snapshot %s: %s\n", type, argv[argo], strerror(error));
+			else
+				fprintf(stderr, "cannot index snapshot %s: %s\n", argv[argo], strerror(error));
+			return 1;
+		}
+		return 0;
+	}
 	if (gxMeteringLimit) {
 		if (interval == 0)
 			interval = 1;
@@ -260,9 +354,32 @@ int main(int argc, char* argv[])
 				return 1;
 			}
 		}
+		else if (option == 6) {
+			snapshot.stream = fopen(argv[argd], "rb");
+			if (snapshot.stream) {
+				fxCensusSnapshot(machine, &snapshot, stdout);
+				fclose(snapshot.stream);
+			}
+			else
+				snapshot.error = errno;
+			if (snapshot.error) {
+				fprintf(stderr, "cannot census snapshot %s: %s\n", argv[argd], strerror(snapshot.error));
+				return 1;
+			}
+		}
 		else if (option == 4) {
 			fprintf(stderr, "%p\n", machine);
-			xsReplay(machine);
+			if (argt) {
+				error = xsReplayTranscript(machine, argv[argt]);
+				if (error) {
+					// -1: already reported
+					if (error > 0)
+						fprintf(stderr, "cannot replay transcript %s: %s\n", argv[argt], strerror(error));
+					return 1;
+				}
+			}
+			else
+				xsReplay(machine);
 		}
 		else {
 			xsBeginHost(machine);
@@ -340,20 +457,20 @@ void xsBuildAgent(xsMachine* machine)
 	xsBeginHost(machine);
 	xsVars(1);
 	
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearImmediate"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearImmediate"), xsResult, xsDontEnum);
 	xsResult = xsNewHostFunction(xs_setImmediate, 1);
 	xsDefine(xsGlobal, xsID("setImmediate"), xsResult, xsDontEnum);
 	
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearInterval"), xsResult, xsDontEnum);
-// 	xsResult = xsNewHostFunction(xs_setInterval, 1);
-// 	xsDefine(xsGlobal, xsID("setInterval"), xsResult, xsDontEnum);
-
-// 	xsResult = xsNewHostFunction(xs_clearTimer, 1);
-// 	xsDefine(xsGlobal, xsID("clearTimeout"), xsResult, xsDontEnum);
-// 	xsResult = xsNewHostFunction(xs_setTimeout, 1);
-// 	xsDefine(xsGlobal, xsID("setTimeout"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearInterval"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_setInterval, 1);
+	xsDefine(xsGlobal, xsID("setInterval"), xsResult, xsDontEnum);
+
+	xsResult = xsNewHostFunction(xs_clearTimer, 1);
+	xsDefine(xsGlobal, xsID("clearTimeout"), xsResult, xsDontEnum);
+	xsResult = xsNewHostFunction(xs_setTimeout, 1);
+	xsDefine(xsGlobal, xsID("setTimeout"), xsResult, xsDontEnum);
 	
 	xsResult = xsNewHostFunction(xs_gc, 1);
 	xsDefine(xsGlobal, xsID("gc"), xsResult, xsDontEnum);
@@ -373,9 +490,22 @@ void xsBuildAgent(xsMachine* machine)
 	xsResult = xsNewHostFunction(xs_resetMeter, 1);
 	xsDefine(xsGlobal, xsID("resetMeter"), xsResult, xsDontEnum);
 
-	modInstallTextDecoder(the);
-	modInstallTextEncoder(the);
-	modInstallBase64(the);
+	fxInstallText(the);
+	fxInstallBase64(the);
+	fxInstallMarshal(the);
+
+	xsResult = xsNewObject();
+	xsVar(0) = xsNewHostFunction(xs_console_debug, 0);
+	xsDefine(xsResult, xsID("debug"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_error, 0);
+	xsDefine(xsResult, xsID("error"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_info, 0);
+	xsDefine(xsResult, xsID("info"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_log, 0);
+	xsDefine(xsResult, xsID("log"), xsVar(0), xsDontEnum);
+	xsVar(0) = xsNewHostFunction(xs_console_warn, 0);
+	xsDefine(xsResult, xsID("warn"), xsVar(0), xsDontEnum);
+	xsDefine(xsGlobal, xsID("console"), xsResult, xsDontEnum);
 // 	
  	xsResult = xsNewHostFunction(fx_harden, 1);
  	xsDefine(xsGlobal, xsID("harden"), xsResult, xsDontEnum);
@@ -389,19 +519,63 @@ void xsBuildAgent(xsMachine* machine)
 	xsEndHost(machine);
 }
 
+int xsPrintSnapshotIndex(char* path, char* type)
+{
+	FILE* file = fopen(path, "rb");
+	xsSnapshotIndex index;
+	xsSnapshotAtom* atom;
+	char buffer[65536];
+	size_t offset, size;
+	int error, i;
+	if (!file)
+		return errno;
+	error = xsReadSnapshotIndex(file, &index);
+	if (error)
+		;
+	else if (type) {
+		atom = (strlen(type) == 4) ? xsFindSnapshotAtom(&index, type) : NULL;
+		if (atom) {
+			// the data of the atom, without its header
+			for (offset = 0; !error && (offset < atom->size - 8); offset += size) {
+				size = atom->size - 8 - offset;
+				if (size > sizeof(buffer))
+					size = sizeof(buffer);
+				error = xsReadSnapshotAtom(file, atom, offset, buffer, size);
+				if (!error && (fwrite(buffer, size, 1, stdout) != 1))
+					error = errno;
+			}
+		}
+		else
+			error = ENOENT;
+	}
+	else {
+		printf("%s\n", index.indexed ? "indexed" : "not indexed");
+		for (i = 0; i < index.count; i++) {
+			atom = &index.atoms[i];
+			printf("%.4s %zu %zu\n", atom->type, atom->offset, atom->size);
+		}
+	}
+	fclose(file);
+	return error;
+}
+
 void xsPrintUsage()
 {
 	printf("xsnap [-h] [-e] [i <interval] [l <limit] [-m] [-r <snapshot>] [-s] [-v] [-w <snapshot>] strings...\n");
+	printf("\t-c <snapshot>: print a JSON census of the snapshot heap to stdout\n");
 	printf("\t-d <snapshot>: dump snapshot to stderr\n");
 	printf("\t-e: eval strings\n");
 	printf("\t-h: print this help message\n");
 	printf("\t-i <interval>: metering interval (default to 1)\n");
 	printf("\t-l <limit>: metering limit (default to none)\n");
 	printf("\t-m: strings are paths to modules\n");
+	printf("\t-o <snapshot> [<atom>]: print the type, offset and size of the atoms of the snapshot, or write the data of the atom to stdout\n");
 	printf("\t-r <snapshot>: read snapshot to create the XS machine\n");
 	printf("\t-s: strings are paths to scripts\n");
+	printf("\t-t [<transcript>]: replay the transcript, or the numbered files of the current directory\n");
 	printf("\t-v: print XS version\n");
 	printf("\t-w <snapshot>: write snapshot of the XS machine at exit\n");
+	printf("\t-x <snapshot> <snapshot>: print the first differing slots of two snapshots, compared position by position, exit with 1 if they differ\n");
 	printf("without -e, -m, -s:\n");
 	printf("\tif the extension is .mjs, strings are paths to modules\n");
 	printf("\telse strings are paths to scripts\n");
@@ -461,33 +635,12 @@ void xsReplay(xsMachine* machine)
 // 							xsEndHost(machine);
 // 							fclose(file);
 							char buffer[1024];
-							char* slash;
-							xsSnapshot snapshot = {
-								SNAPSHOT_SIGNATURE,
-								sizeof(SNAPSHOT_SIGNATURE) - 1,
-								gxSnapshotCallbacks,
-								mxSnapshotCallbackCount,
-								xsSnapshopRead,
-								xsSnapshopWrite,
-								NULL,
-								0,
-								NULL,
-								NULL,
-								NULL,
-								0,
-								NULL
-							};
+							if (length >= sizeof(buffer))
+								length = sizeof(buffer) - 1;
 							length = fread(buffer, 1, length, file);
 							buffer[length] = 0;
 							fclose(file);
-							slash = c_strrchr(buffer, '/');
-							if (slash) slash++;
-							else slash = buffer;
-							snapshot.stream = fopen(slash, "wb");
-							if (snapshot.stream) {
-								xsWriteSnapshot(machine, &snapshot);
-								fclose(snapshot.stream);
-							}
+							xsReplaySnapshot(machine, buffer);
 						}
 						else
 							fclose(file);
@@ -518,6 +671,87 @@ void xs_gc(xsMachine* the)
 	xsCollectGarbage();
 }
 
+// Replaying a transcript: records are read in order from the mapped file.
+// The commands that the machine issues are compared with the recorded ones,
+// and the recorded replies are returned. A transcript with gaps, where the
+// recorder dropped records, is refused before anything runs.
+static TranscriptReader gxTranscript;
+
+int xsReplayTranscript(xsMachine* machine, char* path)
+{
+	TranscriptRecord* record;
+	size_t index;
+	int error = fxOpenTranscriptReader(&gxTranscript, path);
+	if (error)
+		return error;
+	for (index = 0; index < gxTranscript.count; index++) {
+		if (!c_memcmp(gxTranscript.records[index].type, TRANSCRIPT_DROPPED, 4)) {
+			fprintf(stderr, "cannot replay transcript %s: the recorder dropped records before record %zu\n", path, index);
+			fxCloseTranscriptReader(&gxTranscript);
+			return -1;
+		}
+	}
+	while ((record = fxReadTranscript(&gxTranscript))) {
+		fprintf(stderr, "### %05d %.4s\n", gxStep, record->type);
+		gxStep++;
+		if (!c_memcmp(record->type, TRANSCRIPT_EVALUATE, 4)) {
+			xsBeginHost(machine);
+			xsResult = xsStringBuffer((xsStringValue)record->data, (xsIntegerValue)record->length);
+			xsCall1(xsGlobal, xsID("eval"), xsResult);
+			fxRunLoop(machine);
+			xsEndHost(machine);
+		}
+		else if (!c_memcmp(record->type, TRANSCRIPT_DELIVERY, 4)) {
+			xsBeginHost(machine);
+			xsResult = xsArrayBuffer(record->data, (xsIntegerValue)record->length);
+			xsCall1(xsGlobal, xsID("handleCommand"), xsResult);
+			fxRunLoop(machine);
+			xsEndHost(machine);
+		}
+		else if (!c_memcmp(record->type, TRANSCRIPT_SNAPSHOT, 4)) {
+			char buffer[1024];
+			size_t length = (record->length < sizeof(buffer)) ? record->length : sizeof(buffer) - 1;
+			c_memcpy(buffer, record->data, length);
+			buffer[length] = 0;
+			xsReplaySnapshot(machine, buffer);
+		}
+		else if (!c_memcmp(record->type, TRANSCRIPT_ARGUMENTS, 4))
+			fprintf(stderr, "###%.*s\n", (int)record->length, (char*)record->data);
+		else
+			fprintf(stderr, "### unexpected %.4s\n", record->type);
+	}
+	fxCloseTranscriptReader(&gxTranscript);
+	return 0;
+}
+
+void xsReplaySnapshot(xsMachine* machine, char* buffer)
+{
+	char* slash;
+	xsSnapshot snapshot = {
+		SNAPSHOT_SIGNATURE,
+		sizeof(SNAPSHOT_SIGNATURE) - 1,
+		gxSnapshotCallbacks,
+		mxSnapshotCallbackCount,
+		xsSnapshopRead,
+		xsSnapshopWrite,
+		NULL,
+		0,
+		NULL,
+		NULL,
+		NULL,
+		0,
+		NULL
+	};
+	slash = c_strrchr(buffer, '/');
+	if (slash) slash++;
+	else slash = buffer;
+	snapshot.stream = fopen(slash, "wb");
+	if (snapshot.stream) {
+		xsWriteSnapshot(machine, &snapshot);
+		fclose(snapshot.stream);
+	}
+}
+
 void xs_issueCommand(xsMachine* the)
 {
 	char path[C_PATH_MAX];
@@ -527,6 +761,25 @@ void xs_issueCommand(xsMachine* the)
 	size_t argLength;
 	void* argData;
 	
+	if (gxTranscript.records) {
+		TranscriptRecord* record = fxReadTranscript(&gxTranscript);
+		if (!record || c_memcmp(record->type, TRANSCRIPT_COMMAND, 4))
+			xsUnknownError("no command at %05d", gxStep);
+		argLength = xsGetArrayBufferLength(xsArg(0));
+		argData = xsToArrayBuffer(xsArg(0));
+		if ((record->length != argLength) || c_memcmp(record->data, argData, argLength))
+			fprintf(stderr, "### %05d CMND %.*s\n", gxStep, (int)argLength, (char*)argData);
+		else
+			fprintf(stderr, "### %05d CMND\n", gxStep);
+		gxStep++;
+		record = fxReadTranscript(&gxTranscript);
+		if (!record || c_memcmp(record->type, TRANSCRIPT_REPLY, 4))
+			xsUnknownError("no reply at %05d", gxStep);
+		fprintf(stderr, "### %05d RPLY\n", gxStep);
+		gxStep++;
+		xsResult = xsArrayBuffer(record->data, (xsIntegerValue)record->length);
+		return;
+	}
 	sprintf(path, "%05d-command.dat", gxStep);
 	gxStep++;
 	
@@ -576,12 +829,12 @@ void xs_lockdown(xsMachine *the)
 	xsResult = xsGet(xsGlobal, xsID("TextEncoder"));
 	xsCall1(xsGlobal, xsID("harden"), xsResult);
 	
-// 	xsResult = xsGet(xsGlobal, xsID("clearImmediate"));
-// 	xsCall1(xsGlobal, xsID("harden"), xsResult);
-// 	xsResult = xsGet(xsGlobal, xsID("clearInterval"));
-// 	xsCall1(xsGlobal, xsID("harden"), xsResult);
-// 	xsResult = xsGet(xsGlobal, xsID("clearTimeout"));
-// 	xsCall1(xsGlobal, xsID("harden"), xsResult);
+	xsResult = xsGet(xsGlobal, xsID("clearImmediate"));
+	xsCall1(xsGlobal, xsID("harden"), xsResult);
+	xsResult = xsGet(xsGlobal, xsID("clearInterval"));
+	xsCall1(xsGlobal, xsID("harden"), xsResult);
+	xsResult = xsGet(xsGlobal, xsID("clearTimeout"));
+	xsCall1(xsGlobal, xsID("harden"), xsResult);
 	xsResult = xsGet(xsGlobal, xsID("currentMeterLimit"));
 	xsCall1(xsGlobal, xsID("harden"), xsResult);
 	xsResult = xsGet(xsGlobal, xsID("gc"));
@@ -604,10 +857,10 @@ void xs_lockdown(xsMachine *the)
 	xsCall1(xsGlobal, xsID("harden"), xsResult);
 	xsResult = xsGet(xsGlobal, xsID("setImmediate"));
 	xsCall1(xsGlobal, xsID("harden"), xsResult);
-// 	xsResult = xsGet(xsGlobal, xsID("setInterval"));
-// 	xsCall1(xsGlobal, xsID("harden"), xsResult);
-// 	xsResult = xsGet(xsGlobal, xsID("setTimeout"));
-// 	xsCall1(xsGlobal, xsID("harden"), xsResult);
+	xsResult = xsGet(xsGlobal, xsID("setInterval"));
+	xsCall1(xsGlobal, xsID("harden"), xsResult);
+	xsResult = xsGet(xsGlobal, xsID("setTimeout"));
+	xsCall1(xsGlobal, xsID("harden"), xsResult);
 }
 #endif
 
@@ -618,23 +871,28 @@ void xs_performance_now(xsMachine *the)
 	xsResult = xsNumber((double)(tv.tv_sec * 1000.0) + ((double)(tv.tv_usec) / 1000.0));
 }
 
-void xs_print(xsMachine* the)
+static void fxPrint(xsMachine* the, FILE* file)
 {
 	xsIntegerValue c = xsToInteger(xsArgc), i;
-	xsStringValue string, p, q;
+	xsStringValue string, p, q, buffer, r;
+	size_t size = 16;
 	xsVars(1);
 	xsVar(0) = xsGet(xsGlobal, xsID("String"));
 	for (i = 0; i < c; i++) {
 		xsArg(i) = xsCallFunction1(xsVar(0), xsUndefined, xsArg(i));
+		size += c_strlen(xsToString(xsArg(i))) + 1;
 	}
+	// the UTF-8 output is never longer than the CESU-8 strings
+	buffer = r = c_malloc(size);
+	if (!buffer)
+		xsUnknownError("not enough memory");
 #ifdef mxMetering
 	if (gxMeteringPrint)
-		fprintf(stdout, "[%u] ", xsGetCurrentMeter(the));
+		r += snprintf(r, 16, "[%u] ", xsGetCurrentMeter(the));
 #endif
 	for (i = 0; i < c; i++) {
 		if (i)
-			fprintf(stdout, " ");
-		xsArg(i) = xsCallFunction1(xsVar(0), xsUndefined, xsArg(i));
+			*r++ = ' ';
 		p = string = xsToString(xsArg(i));
 	#if mxCESU8
 		for (;;) {
@@ -644,44 +902,67 @@ void xs_print(xsMachine* the)
 			if (character == C_EOF)
 				break;
 			if (character == 0) {
-				if (p > string) {
-					char c = *p;
-					*p = 0;
-					fprintf(stdout, "%s", string);
-					*p = c;
-				}
+				c_memcpy(r, string, p - string);
+				r += p - string;
 				string = q;
 			}
 			else if ((0x0000D800 <= character) && (character <= 0x0000DBFF)) {
-				xsStringValue r = q;
+				xsStringValue s = q;
 				xsIntegerValue surrogate;
-				q = fxUTF8Decode(r, &surrogate);
+				q = fxUTF8Decode(s, &surrogate);
 				if ((0x0000DC00 <= surrogate) && (surrogate <= 0x0000DFFF)) {
-					char buffer[5];
 					character = (xsIntegerValue)(0x00010000 + ((character & 0x03FF) << 10) + (surrogate & 0x03FF));
-					if (p > string) {
-						char c = *p;
-						*p = 0;
-						fprintf(stdout, "%s", string);
-						*p = c;
-					}
-					p = fxUTF8Encode(buffer, character);
-					*p = 0;
-					fprintf(stdout, "%s", buffer);
+					c_memcpy(r, string, p - string);
+					r += p - string;
+					r = fxUTF8Encode(r, character);
 					string = q;
 				}
 				else {
-					p = r;
+					p = s;
 					character = surrogate;
 					goto again;
 				}
 			}
 			p = q;
 		}
-	#endif	
-		fprintf(stdout, "%s", string);
+	#endif
+		p = string + c_strlen(string);
+		c_memcpy(r, string, p - string);
+		r += p - string;
 	}
-	fprintf(stdout, "\n");
+	*r++ = '\n';
+	fwrite(buffer, 1, r - buffer, file);
+	c_free(buffer);
+}
+
+void xs_console_debug(xsMachine* the)
+{
+	fxPrint(the, stdout);
+}
+
+void xs_console_error(xsMachine* the)
+{
+	fxPrint(the, stderr);
+}
+
+void xs_console_info(xsMachine* the)
+{
+	fxPrint(the, stdout);
+}
+
+void xs_console_log(xsMachine* the)
+{
+	fxPrint(the, stdout);
+}
+
+void xs_console_warn(xsMachine* the)
+{
+	fxPrint(the, stderr);
+}
+
+void xs_print(xsMachine* the)
+{
+	fxPrint(the, stdout);
 }
 
 void xs_resetMeter(xsMachine* the)
@@ -704,12 +985,12 @@ void xs_setImmediate(xsMachine* the)
 
 void xs_setInterval(xsMachine* the)
 {
-	xsSetTimer(xsToNumber(xsArg(1)), 1);
+	xsSetTimer((xsToInteger(xsArgc) > 1) ? xsToNumber(xsArg(1)) : 0, 1);
 }
 
 void xs_setTimeout(xsMachine* the)
 {
-	xsSetTimer(xsToNumber(xsArg(1)), 0);
+	xsSetTimer((xsToInteger(xsArgc) > 1) ? xsToNumber(xsArg(1)) : 0, 0);
 }
 
 
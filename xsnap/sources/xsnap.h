@@ -21,6 +21,27 @@ struct xsSnapshotRecord {
 	void* slots;
 };
 
+#define xsSnapshotIndexLength 16
+
+typedef struct xsSnapshotAtomRecord xsSnapshotAtom;
+typedef struct xsSnapshotIndexRecord xsSnapshotIndex;
+
+struct xsSnapshotAtomRecord {
+	char type[4];
+	size_t offset;
+	size_t size;
+};
+
+struct xsSnapshotIndexRecord {
+	xsSnapshotAtom atoms[xsSnapshotIndexLength];
+	xsIntegerValue count;
+	xsBooleanValue indexed;
+	size_t position;
+	size_t next;
+	unsigned char header[8];
+	xsIntegerValue headerLength;
+};
+
 #define xsInitializeSharedCluster() \
 	fxInitializeSharedCluster()
 #define xsTerminateSharedCluster() \
@@ -57,6 +78,10 @@ struct xsSnapshotRecord {
 	fxGetCurrentMeter(_THE)
 #define xsSetCurrentMeter(_THE, _VALUE) \
 	fxSetCurrentMeter(_THE, _VALUE)
+#define xsSetMeterInterval(_THE, _INTERVAL) \
+	fxSetMeterInterval(_THE, _INTERVAL)
+#define xsChargeMeter(_THE, _COUNT) \
+	fxChargeMeter(_THE, _COUNT)
 
 #else
 	#define xsBeginMetering(_THE, _CALLBACK, _STEP)
@@ -65,12 +90,24 @@ struct xsSnapshotRecord {
 	#define xsMeterHostFunction(_COUNT) (void)(_COUNT)
 	#define xsGetCurrentMeter(_THE) 0
 	#define xsSetCurrentMeter(_THE, _VALUE)
+	#define xsSetMeterInterval(_THE, _INTERVAL)
+	#define xsChargeMeter(_THE, _COUNT) (void)(_COUNT)
 #endif
 
 #define xsReadSnapshot(_SNAPSHOT, _NAME, _CONTEXT) \
 	fxReadSnapshot(_SNAPSHOT, _NAME, _CONTEXT)
 #define xsWriteSnapshot(_THE, _SNAPSHOT) \
 	fxWriteSnapshot(_THE, _SNAPSHOT)
+#define xsIndexSnapshot(_INDEX, _ADDRESS, _SIZE) \
+	fxIndexSnapshot(_INDEX, _ADDRESS, _SIZE)
+#define xsWriteSnapshotIndex(_INDEX, _WRITE, _STREAM) \
+	fxWriteSnapshotIndex(_INDEX, _WRITE, _STREAM)
+#define xsReadSnapshotIndex(_STREAM, _INDEX) \
+	fxReadSnapshotIndex(_STREAM, _INDEX)
+#define xsFindSnapshotAtom(_INDEX, _TYPE) \
+	fxFindSnapshotAtom(_INDEX, _TYPE)
+#define xsReadSnapshotAtom(_STREAM, _ATOM, _OFFSET, _BUFFER, _SIZE) \
+	fxReadSnapshotAtom(_STREAM, _ATOM, _OFFSET, _BUFFER, _SIZE)
 	
 #define xsRunDebugger(_THE) \
 	fxRunDebugger(_THE)
@@ -85,6 +122,12 @@ struct xsSnapshotRecord {
 	fxClearTimer(the)
 #define xsSetTimer(_INTERVAL, _REPEAT) \
 	fxSetTimer(the, _INTERVAL, _REPEAT)
+#define xsUseVirtualTimers(_THE, _FLAG) \
+	fxUseVirtualTimers(_THE, _FLAG)
+#define xsAdvanceVirtualTimers(_THE, _DELTA) \
+	fxAdvanceVirtualTimers(_THE, _DELTA)
+#define xsCountTimers(_THE) \
+	fxCountTimers(_THE)
 	
 #define xsVersion(_BUFFER, _SIZE) \
 	fxVersion(_BUFFER, _SIZE)
@@ -110,10 +153,17 @@ mxImport void fxMeterHostFunction(xsMachine* the, xsUnsignedValue count);
 mxImport void fxPatchHostFunction(xsMachine* the, xsCallback patch);
 mxImport xsUnsignedValue fxGetCurrentMeter(xsMachine* the);
 mxImport void fxSetCurrentMeter(xsMachine* the, xsUnsignedValue value);
+mxImport void fxSetMeterInterval(xsMachine* the, xsUnsignedValue interval);
+mxImport void fxChargeMeter(xsMachine* the, xsUnsignedValue count);
 #endif
 
 mxImport xsMachine* fxReadSnapshot(xsSnapshot* snapshot, xsStringValue theName, void* theContext);
 mxImport int fxWriteSnapshot(xsMachine* the, xsSnapshot* snapshot);
+mxImport void fxIndexSnapshot(xsSnapshotIndex* index, void* address, size_t size);
+mxImport int fxWriteSnapshotIndex(xsSnapshotIndex* index, int (*write)(void* stream, void* address, size_t size), void* stream);
+mxImport int fxReadSnapshotIndex(void* stream, xsSnapshotIndex* index);
+mxImport xsSnapshotAtom* fxFindSnapshotAtom(xsSnapshotIndex* index, xsStringValue type);
+mxImport int fxReadSnapshotAtom(void* stream, xsSnapshotAtom* atom, size_t offset, void* buffer, size_t size);
 
 mxImport void fxRunDebugger(xsMachine* the);
 mxImport void fxRunModuleFile(xsMachine* the, xsStringValue path);
@@ -122,6 +172,9 @@ mxImport void fxRunLoop(xsMachine* the);
 
 mxImport void fxClearTimer(xsMachine* the);
 mxImport void fxSetTimer(xsMachine* the, xsNumberValue interval, xsBooleanValue repeat);
+mxImport void fxUseVirtualTimers(xsMachine* the, xsBooleanValue flag);
+mxImport void fxAdvanceVirtualTimers(xsMachine* the, xsNumberValue delta);
+mxImport xsIntegerValue fxCountTimers(xsMachine* the);
 
 #ifdef mxInstrument	
 mxImport void fxDescribeInstrumentation(xsMachine* the, xsIntegerValue count, xsStringValue* names, xsStringValue* units);
@@ -0,0 +1,434 @@
+#include "xsnap.h"
+#include <pthread.h>
+
+// Base64.encode and Base64.decode, with SSE4.1, AVX2 and NEON codecs. The
+// Base64 object is still installed by modBase64, then its functions are
+// replaced, at the same callback indices, so snapshots do not change.
+//
+// Only the common cases take the vectorized path: the encoding of a string
+// or an ArrayBuffer, and the decoding of a canonical string, padded to a
+// multiple of 4 characters, without whitespace. Everything else, including
+// every error, is handed to the modBase64 functions, so results are the same
+// byte for byte. Neither version meters by size, so computrons do not change
+// either.
+//
+// On x86 the codec is chosen at the first call from what the CPU supports,
+// once for all the machines of the process, whatever their threads.
+// On ARM64 NEON is always there. Elsewhere the codec is scalar.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define mxBase64X86 1
+	#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+	#define mxBase64NEON 1
+	#include <arm_neon.h>
+#endif
+#ifndef mxBase64X86
+	#define mxBase64X86 0
+#endif
+#ifndef mxBase64NEON
+	#define mxBase64NEON 0
+#endif
+
+extern void xs_base64_encode(xsMachine *the);
+extern void xs_base64_decode(xsMachine *the);
+extern void modInstallBase64(xsMachine *the);
+
+void fxInstallBase64(xsMachine* the);
+void xsnap_base64_encode(xsMachine* the);
+void xsnap_base64_decode(xsMachine* the);
+
+// The bulk codecs convert whole groups of 3 bytes or 4 characters, as many
+// as they can, and return how many bytes or characters they consumed. The
+// decoder stops before a group with an invalid character.
+typedef size_t (*txBase64Encoder)(const unsigned char* src, size_t size, char* dst);
+typedef size_t (*txBase64Decoder)(const char* src, size_t size, unsigned char* dst);
+
+static void fxBase64Initialize(void);
+static size_t fxBase64EncodeScalar(const unsigned char* src, size_t size, char* dst);
+static size_t fxBase64DecodeScalar(const char* src, size_t size, unsigned char* dst);
+
+static const char gxBase64Alphabet[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static signed char gxBase64Values[256];
+static txBase64Encoder gxBase64Encoder = NULL;
+static txBase64Decoder gxBase64Decoder = NULL;
+static pthread_once_t gxBase64Once = PTHREAD_ONCE_INIT;
+
+void fxInstallBase64(xsMachine* the)
+{
+	modInstallBase64(the);
+	xsBeginHost(the);
+	xsVars(2);
+	xsVar(0) = xsGet(xsGlobal, xsID("Base64"));
+	xsVar(1) = xsNewHostFunction(xsnap_base64_encode, 1);
+	xsSet(xsVar(0), xsID("encode"), xsVar(1));
+	xsVar(1) = xsNewHostFunction(xsnap_base64_decode, 1);
+	xsSet(xsVar(0), xsID("decode"), xsVar(1));
+	xsEndHost(the);
+}
+
+void xsnap_base64_encode(xsMachine* the)
+{
+	unsigned char* src;
+	char* dst;
+	size_t size, count;
+	if (xsToInteger(xsArgc) < 1) {
+		xs_base64_encode(the);
+		return;
+	}
+	if (xsTypeOf(xsArg(0)) == xsStringType)
+		size = c_strlen(xsToString(xsArg(0)));
+	else if (xsIsInstanceOf(xsArg(0), xsArrayBufferPrototype) && xsToArrayBuffer(xsArg(0)))
+		size = xsGetArrayBufferLength(xsArg(0));
+	else {
+		xs_base64_encode(the);
+		return;
+	}
+	pthread_once(&gxBase64Once, fxBase64Initialize);
+	xsResult = xsStringBuffer(NULL, (xsIntegerValue)((((size + 2) / 3) * 4) + 1));
+	// refresh pointers, allocating may have moved the chunks
+	if (xsTypeOf(xsArg(0)) == xsStringType)
+		src = (unsigned char*)xsToString(xsArg(0));
+	else
+		src = xsToArrayBuffer(xsArg(0));
+	dst = xsToString(xsResult);
+	count = (*gxBase64Encoder)(src, size, dst);
+	count += fxBase64EncodeScalar(src + count, size - count, dst + ((count / 3) * 4));
+	src += count;
+	dst += (count / 3) * 4;
+	size -= count;
+	if (size == 2) {
+		*dst++ = gxBase64Alphabet[src[0] >> 2];
+		*dst++ = gxBase64Alphabet[((src[0] & 0x03) << 4) | (src[1] >> 4)];
+		*dst++ = gxBase64Alphabet[(src[1] & 0x0F) << 2];
+		*dst++ = '=';
+	}
+	else if (size == 1) {
+		*dst++ = gxBase64Alphabet[src[0] >> 2];
+		*dst++ = gxBase64Alphabet[(src[0] & 0x03) << 4];
+		*dst++ = '=';
+		*dst++ = '=';
+	}
+	*dst = 0;
+}
+
+void xsnap_base64_decode(xsMachine* the)
+{
+	char* src;
+	unsigned char* dst;
+	size_t size, length, count;
+	signed char a, b, c, d;
+	if ((xsToInteger(xsArgc) < 1) || (xsTypeOf(xsArg(0)) != xsStringType)) {
+		xs_base64_decode(the);
+		return;
+	}
+	src = xsToString(xsArg(0));
+	size = c_strlen(src);
+	if ((size == 0) || (size & 3)) {
+		xs_base64_decode(the);
+		return;
+	}
+	pthread_once(&gxBase64Once, fxBase64Initialize);
+	// the last group is the only one that can be padded
+	a = gxBase64Values[(unsigned char)src[size - 4]];
+	b = gxBase64Values[(unsigned char)src[size - 3]];
+	c = (src[size - 2] == '=') ? 0 : gxBase64Values[(unsigned char)src[size - 2]];
+	d = (src[size - 1] == '=') ? 0 : gxBase64Values[(unsigned char)src[size - 1]];
+	if ((a < 0) || (b < 0) || (c < 0) || (d < 0) || ((src[size - 2] == '=') && (src[size - 1] != '='))) {
+		xs_base64_decode(the);
+		return;
+	}
+	length = (size / 4) * 3;
+	if (src[size - 1] == '=')
+		length--;
+	if (src[size - 2] == '=')
+		length--;
+	xsResult = xsArrayBuffer(NULL, (xsIntegerValue)length);
+	// refresh pointers, allocating may have moved the chunks
+	src = xsToString(xsArg(0));
+	dst = xsToArrayBuffer(xsResult);
+	size -= 4;
+	count = (*gxBase64Decoder)(src, size, dst);
+	count += fxBase64DecodeScalar(src + count, size - count, dst + ((count / 4) * 3));
+	if (count < size) {
+		xs_base64_decode(the);
+		return;
+	}
+	dst += (count / 4) * 3;
+	*dst++ = (unsigned char)((a << 2) | (b >> 4));
+	if (src[size + 2] != '=')
+		*dst++ = (unsigned char)((b << 4) | (c >> 2));
+	if (src[size + 3] != '=')
+		*dst = (unsigned char)((c << 6) | d);
+}
+
+static size_t fxBase64EncodeScalar(const unsigned char* src, size_t size, char* dst)
+{
+	size_t count = size - (size % 3), index;
+	for (index = 0; index < count; index += 3) {
+		unsigned int triplet = ((unsigned int)src[0] << 16) | ((unsigned int)src[1] << 8) | src[2];
+		dst[0] = gxBase64Alphabet[triplet >> 18];
+		dst[1] = gxBase64Alphabet[(triplet >> 12) & 0x3F];
+		dst[2] = gxBase64Alphabet[(triplet >> 6) & 0x3F];
+		dst[3] = gxBase64Alphabet[triplet & 0x3F];
+		src += 3;
+		dst += 4;
+	}
+	return count;
+}
+
+static size_t fxBase64DecodeScalar(const char* src, size_t size, unsigned char* dst)
+{
+	size_t count = size & ~(size_t)3, index;
+	for (index = 0; index < count; index += 4) {
+		signed char a = gxBase64Values[(unsigned char)src[0]];
+		signed char b = gxBase64Values[(unsigned char)src[1]];
+		signed char c = gxBase64Values[(unsigned char)src[2]];
+		signed char d = gxBase64Values[(unsigned char)src[3]];
+		if ((a | b | c | d) < 0)
+			break;
+		dst[0] = (unsigned char)((a << 2) | (b >> 4));
+		dst[1] = (unsigned char)((b << 4) | (c >> 2));
+		dst[2] = (unsigned char)((c << 6) | d);
+		src += 4;
+		dst += 3;
+	}
+	return index;
+}
+
+#if mxBase64X86
+
+// The SSE4.1 and AVX2 codecs follow Wojciech Muła and Daniel Lemire, "Faster
+// Base64 Encoding and Decoding Using AVX2 Instructions". Each lane of 32 bits
+// holds a group: shifts and multiplications spread 3 bytes into 4 indices,
+// or gather 4 values into 3 bytes.
+
+__attribute__((target("sse4.1")))
+static inline __m128i fxBase64EncodeSSE41Lane(__m128i in)
+{
+	__m128i t0, t1, t2, t3, indices, result, less;
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	indices = _mm_or_si128(t1, t3);
+	// 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+	result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+	result = _mm_shuffle_epi8(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0), result);
+	return _mm_add_epi8(result, indices);
+}
+
+__attribute__((target("sse4.1")))
+static size_t fxBase64EncodeSSE41(const unsigned char* src, size_t size, char* dst)
+{
+	size_t count = 0;
+	// 16 bytes are loaded for 12 bytes encoded
+	while (size - count >= 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + count));
+		_mm_storeu_si128((__m128i*)dst, fxBase64EncodeSSE41Lane(in));
+		count += 12;
+		dst += 16;
+	}
+	return count;
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i fxBase64DecodeSSE41Lane(__m128i in, int* valid)
+{
+	__m128i upper, lower, digit, plus, slash, shift, merged;
+	upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+	lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+	slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+	*valid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)))) == 0xFFFF;
+	shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+	shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+	in = _mm_add_epi8(in, shift);
+	merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("sse4.1")))
+static size_t fxBase64DecodeSSE41(const char* src, size_t size, unsigned char* dst)
+{
+	size_t count = 0;
+	// 16 bytes are stored for 12 bytes decoded, the next group has room for them
+	while (size - count >= 24) {
+		int valid;
+		__m128i out = fxBase64DecodeSSE41Lane(_mm_loadu_si128((const __m128i*)(src + count)), &valid);
+		if (!valid)
+			break;
+		_mm_storeu_si128((__m128i*)dst, out);
+		count += 16;
+		dst += 12;
+	}
+	return count;
+}
+
+__attribute__((target("avx2")))
+static size_t fxBase64EncodeAVX2(const unsigned char* src, size_t size, char* dst)
+{
+	size_t count = 0;
+	// 28 bytes are loaded for 24 bytes encoded
+	while (size - count >= 28) {
+		__m256i in, t0, t1, t2, t3, indices, result, less;
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + count))), _mm_loadu_si128((const __m128i*)(src + count + 12)), 1);
+		in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		indices = _mm256_or_si256(t1, t3);
+		result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		result = _mm256_shuffle_epi8(_mm256_setr_epi8(
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0), result);
+		_mm256_storeu_si256((__m256i*)dst, _mm256_add_epi8(result, indices));
+		count += 24;
+		dst += 32;
+	}
+	return count + fxBase64EncodeSSE41(src + count, size - count, dst);
+}
+
+__attribute__((target("avx2")))
+static size_t fxBase64DecodeAVX2(const char* src, size_t size, unsigned char* dst)
+{
+	size_t count = 0;
+	// 32 bytes are stored for 24 bytes decoded, the next groups have room for them
+	while (size - count >= 48) {
+		__m256i in, upper, lower, digit, plus, slash, shift, merged;
+		in = _mm256_loadu_si256((const __m256i*)(src + count));
+		upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+		lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+		digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+		plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+		slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+		if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)))) != -1)
+			break;
+		shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+		in = _mm256_add_epi8(in, shift);
+		merged = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+		merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+		merged = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i*)dst, merged);
+		count += 32;
+		dst += 24;
+	}
+	return count + fxBase64DecodeSSE41(src + count, size - count, dst);
+}
+
+#endif /* mxBase64X86 */
+
+#if mxBase64NEON
+
+// The NEON codecs deinterleave groups with vld3/vld4, so each register holds
+// one position of 16 groups, and look up the alphabet with vqtbl4.
+
+static size_t fxBase64EncodeNEON(const unsigned char* src, size_t size, char* dst)
+{
+	size_t count = 0;
+	uint8x16x4_t alphabet, indices, out;
+	alphabet.val[0] = vld1q_u8((const uint8_t*)gxBase64Alphabet);
+	alphabet.val[1] = vld1q_u8((const uint8_t*)gxBase64Alphabet + 16);
+	alphabet.val[2] = vld1q_u8((const uint8_t*)gxBase64Alphabet + 32);
+	alphabet.val[3] = vld1q_u8((const uint8_t*)gxBase64Alphabet + 48);
+	while (size - count >= 48) {
+		uint8x16x3_t in = vld3q_u8(src + count);
+		indices.val[0] = vshrq_n_u8(in.val[0], 2);
+		indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), vdupq_n_u8(0x3F));
+		indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), vdupq_n_u8(0x3F));
+		indices.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+		out.val[0] = vqtbl4q_u8(alphabet, indices.val[0]);
+		out.val[1] = vqtbl4q_u8(alphabet, indices.val[1]);
+		out.val[2] = vqtbl4q_u8(alphabet, indices.val[2]);
+		out.val[3] = vqtbl4q_u8(alphabet, indices.val[3]);
+		vst4q_u8((uint8_t*)dst, out);
+		count += 48;
+		dst += 64;
+	}
+	return count;
+}
+
+static inline uint8x16_t fxBase64DecodeNEONLane(uint8x16_t in, uint8x16_t* invalid)
+{
+	uint8x16_t upper = vandq_u8(vcgeq_u8(in, vdupq_n_u8('A')), vcleq_u8(in, vdupq_n_u8('Z')));
+	uint8x16_t lower = vandq_u8(vcgeq_u8(in, vdupq_n_u8('a')), vcleq_u8(in, vdupq_n_u8('z')));
+	uint8x16_t digit = vandq_u8(vcgeq_u8(in, vdupq_n_u8('0')), vcleq_u8(in, vdupq_n_u8('9')));
+	uint8x16_t plus = vceqq_u8(in, vdupq_n_u8('+'));
+	uint8x16_t slash = vceqq_u8(in, vdupq_n_u8('/'));
+	uint8x16_t shift = vandq_u8(upper, vdupq_n_u8((uint8_t)-'A'));
+	shift = vorrq_u8(shift, vandq_u8(lower, vdupq_n_u8((uint8_t)(26 - 'a'))));
+	shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8((uint8_t)(52 - '0'))));
+	shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8((uint8_t)(62 - '+'))));
+	shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8((uint8_t)(63 - '/'))));
+	*invalid = vorrq_u8(*invalid, vmvnq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash)))));
+	return vaddq_u8(in, shift);
+}
+
+static size_t fxBase64DecodeNEON(const char* src, size_t size, unsigned char* dst)
+{
+	size_t count = 0;
+	while (size - count >= 64) {
+		uint8x16x4_t in = vld4q_u8((const uint8_t*)src + count);
+		uint8x16x3_t out;
+		uint8x16_t invalid = vdupq_n_u8(0);
+		in.val[0] = fxBase64DecodeNEONLane(in.val[0], &invalid);
+		in.val[1] = fxBase64DecodeNEONLane(in.val[1], &invalid);
+		in.val[2] = fxBase64DecodeNEONLane(in.val[2], &invalid);
+		in.val[3] = fxBase64DecodeNEONLane(in.val[3], &invalid);
+		if (vmaxvq_u8(invalid))
+			break;
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+		vst3q_u8(dst, out);
+		count += 64;
+		dst += 48;
+	}
+	return count;
+}
+
+#endif /* mxBase64NEON */
+
+static void fxBase64Initialize(void)
+{
+	txBase64Decoder decoder = fxBase64DecodeScalar;
+	txBase64Encoder encoder = fxBase64EncodeScalar;
+	int index;
+	c_memset(gxBase64Values, -1, sizeof(gxBase64Values));
+	for (index = 0; index < 64; index++)
+		gxBase64Values[(unsigned char)gxBase64Alphabet[index]] = (signed char)index;
+#if mxBase64X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		decoder = fxBase64DecodeAVX2;
+		encoder = fxBase64EncodeAVX2;
+	}
+	else if (__builtin_cpu_supports("sse4.1")) {
+		decoder = fxBase64DecodeSSE41;
+		encoder = fxBase64EncodeSSE41;
+	}
+#elif mxBase64NEON
+	decoder = fxBase64DecodeNEON;
+	encoder = fxBase64EncodeNEON;
+#endif
+	gxBase64Decoder = decoder;
+	gxBase64Encoder = encoder;
+}
@@ -0,0 +1,591 @@
+#include "xsnap.h"
+#include <math.h>
+
+// Marshal.encode(value) and Marshal.decode(buffer) convert the values that
+// JSON represents, plus undefined, -0, NaN, the infinities and bigints, to
+// and from a compact binary format in an ArrayBuffer. Capdata goes to the
+// parent without the temporary strings of JSON.stringify and TextEncoder,
+// and comes back without the ones of TextDecoder and JSON.parse. The format
+// is documented in documentation/xsnap-worker.md#marshal.
+//
+// Like JSON.stringify, encode takes the enumerable own string-keyed
+// properties of objects, in the order of Object.keys, so getters and proxy
+// traps run. It does not call toJSON. Functions, symbols and values nested
+// deeper than mxMarshalDepth, which includes cycles, throw a TypeError.
+// Like JSON.parse, decode defines properties, so "__proto__" is an own
+// property, and throws a SyntaxError for malformed data.
+//
+// Strings are WTF-8: UTF-8, except that lone surrogates are kept as 3 bytes,
+// so every string survives the round trip.
+//
+// Both functions charge one computron per value and per 16 bytes, so the
+// meter depends only on the data. They charge as they go, after every value,
+// and let the meter abort them then, so a huge input cannot run unmetered.
+// Their buffers belong to a host object, whose destructor frees them if the
+// machine is aborted.
+
+#define mxMarshalDepth 4096
+
+enum {
+	mxMarshalUndefinedTag = 0,
+	mxMarshalNullTag,
+	mxMarshalFalseTag,
+	mxMarshalTrueTag,
+	mxMarshalIntegerTag,
+	mxMarshalNumberTag,
+	mxMarshalBigIntTag,
+	mxMarshalStringTag,
+	mxMarshalArrayTag,
+	mxMarshalObjectTag,
+};
+
+typedef struct {
+	unsigned char* data;
+	size_t length;
+	size_t size;
+} txMarshalBuffer;
+
+typedef struct {
+	xsIntegerValue index;
+	xsIntegerValue count;
+	xsBooleanValue array;
+} txMarshalFrame;
+
+typedef struct {
+	txMarshalFrame* frames;
+	xsIntegerValue depth;
+	xsIntegerValue size;
+	xsUnsignedValue count;
+	xsUnsignedValue metered;
+} txMarshalStack;
+
+typedef struct {
+	txMarshalBuffer buffer;
+	txMarshalStack stack;
+} txMarshal;
+
+void fxInstallMarshal(xsMachine* the);
+void xsnap_marshal_encode(xsMachine* the);
+void xsnap_marshal_decode(xsMachine* the);
+
+static txMarshal* fxNewMarshal(xsMachine* the);
+static void fxDeleteMarshal(void* it);
+static void fxMarshalMeter(xsMachine* the, txMarshalStack* stack, size_t length);
+static txMarshalFrame* fxMarshalPush(xsMachine* the, txMarshalStack* stack, xsIntegerValue count, xsBooleanValue array);
+static unsigned char* fxMarshalReserve(xsMachine* the, txMarshalBuffer* buffer, size_t size);
+static void fxMarshalSize(xsMachine* the, txMarshalBuffer* buffer, size_t size);
+static void fxMarshalString(xsMachine* the, txMarshalBuffer* buffer, xsStringValue string);
+static void fxMarshalValue(xsMachine* the, txMarshalBuffer* buffer, txMarshalStack* stack);
+
+static size_t fxDemarshalSize(xsMachine* the, unsigned char* data, size_t length, size_t* offset);
+static void fxDemarshalString(xsMachine* the, size_t offset, size_t size);
+static void fxDemarshalValue(xsMachine* the, size_t length, size_t* offset, txMarshalStack* stack);
+
+// encode: xsVar(0) is Object.keys, xsVar(1) the containers being encoded and
+// xsVar(2) their keys, by depth, xsVar(3) the value to encode, xsVar(5)
+// Array.isArray, so proxies of arrays are arrays, whatever the prototype.
+// decode: xsVar(0) is BigInt, xsVar(1) the containers being decoded and
+// xsVar(2) the pending keys, by depth, xsVar(3) the decoded value.
+// both: xsVar(6) is the host object that owns the buffers.
+#define mxMarshalVars 7
+
+void fxInstallMarshal(xsMachine* the)
+{
+	xsBeginHost(the);
+	xsVars(2);
+	xsVar(0) = xsNewObject();
+	xsVar(1) = xsNewHostFunction(xsnap_marshal_encode, 1);
+	xsDefine(xsVar(0), xsID("encode"), xsVar(1), xsDontEnum);
+	xsVar(1) = xsNewHostFunction(xsnap_marshal_decode, 1);
+	xsDefine(xsVar(0), xsID("decode"), xsVar(1), xsDontEnum);
+	xsDefine(xsGlobal, xsID("Marshal"), xsVar(0), xsDontEnum);
+	xsEndHost(the);
+}
+
+static txMarshal* fxNewMarshal(xsMachine* the)
+{
+	txMarshal* marshal;
+	xsVar(6) = xsNewHostObject(fxDeleteMarshal);
+	marshal = c_calloc(1, sizeof(txMarshal));
+	if (!marshal)
+		xsUnknownError("not enough memory");
+	xsSetHostData(xsVar(6), marshal);
+	return marshal;
+}
+
+static void fxDeleteMarshal(void* it)
+{
+	txMarshal* marshal = it;
+	if (marshal) {
+		c_free(marshal->stack.frames);
+		c_free(marshal->buffer.data);
+		c_free(marshal);
+	}
+}
+
+static void fxMarshalMeter(xsMachine* the, txMarshalStack* stack, size_t length)
+{
+	// what was done since the previous call: values, and bytes by 16
+	xsUnsignedValue count = stack->count + (xsUnsignedValue)(length >> 4);
+	xsChargeMeter(the, count - stack->metered);
+	stack->metered = count;
+}
+
+static txMarshalFrame* fxMarshalPush(xsMachine* the, txMarshalStack* stack, xsIntegerValue count, xsBooleanValue array)
+{
+	txMarshalFrame* frame;
+	if (stack->depth == stack->size) {
+		xsIntegerValue size = stack->size ? 2 * stack->size : 16;
+		if (size > mxMarshalDepth)
+			xsTypeError("Marshal: too deep or cyclic");
+		frame = c_realloc(stack->frames, size * sizeof(txMarshalFrame));
+		if (!frame)
+			xsUnknownError("not enough memory");
+		stack->frames = frame;
+		stack->size = size;
+	}
+	frame = stack->frames + stack->depth;
+	frame->index = 0;
+	frame->count = count;
+	frame->array = array;
+	stack->depth++;
+	return frame;
+}
+
+static unsigned char* fxMarshalReserve(xsMachine* the, txMarshalBuffer* buffer, size_t size)
+{
+	if (buffer->length + size > buffer->size) {
+		size_t total = buffer->size ? buffer->size : 1024;
+		unsigned char* data;
+		while (total < buffer->length + size)
+			total *= 2;
+		data = c_realloc(buffer->data, total);
+		if (!data)
+			xsUnknownError("not enough memory");
+		buffer->data = data;
+		buffer->size = total;
+	}
+	return buffer->data + buffer->length;
+}
+
+static void fxMarshalSize(xsMachine* the, txMarshalBuffer* buffer, size_t size)
+{
+	unsigned char* p = fxMarshalReserve(the, buffer, 10);
+	unsigned char* q = p;
+	while (size >= 0x80) {
+		*q++ = (unsigned char)(size | 0x80);
+		size >>= 7;
+	}
+	*q++ = (unsigned char)size;
+	buffer->length += q - p;
+}
+
+static void fxMarshalString(xsMachine* the, txMarshalBuffer* buffer, xsStringValue string)
+{
+	unsigned char* p = (unsigned char*)string;
+	unsigned char* q;
+	size_t length = c_strlen(string), size = length;
+	unsigned char c;
+	// CESU-8 to WTF-8: C0 80 becomes 00, and a surrogate pair, ED A0-AF xx
+	// ED B0-BF xx, becomes 4 bytes. Nothing else changes.
+	for (p = (unsigned char*)string; (c = *p); p++) {
+		if ((c == 0xC0) && (p[1] == 0x80))
+			size -= 1;
+		else if ((c == 0xED) && (p[1] >= 0xA0) && (p[1] < 0xB0) && (p[3] == 0xED) && (p[4] >= 0xB0)) {
+			size -= 2;
+			p += 5;
+		}
+	}
+	fxMarshalSize(the, buffer, size);
+	q = fxMarshalReserve(the, buffer, size);
+	buffer->length += size;
+	if (size == length) {
+		c_memcpy(q, string, length);
+		return;
+	}
+	for (p = (unsigned char*)string; (c = *p); p++) {
+		if ((c == 0xC0) && (p[1] == 0x80)) {
+			*q++ = 0;
+			p += 1;
+		}
+		else if ((c == 0xED) && (p[1] >= 0xA0) && (p[1] < 0xB0) && (p[3] == 0xED) && (p[4] >= 0xB0)) {
+			xsUnsignedValue character = 0x10000 + ((((p[1] & 0x0F) << 6) | (p[2] & 0x3F)) << 10) + (((p[4] & 0x0F) << 6) | (p[5] & 0x3F));
+			*q++ = (unsigned char)(0xF0 | (character >> 18));
+			*q++ = (unsigned char)(0x80 | ((character >> 12) & 0x3F));
+			*q++ = (unsigned char)(0x80 | ((character >> 6) & 0x3F));
+			*q++ = (unsigned char)(0x80 | (character & 0x3F));
+			p += 5;
+		}
+		else
+			*q++ = c;
+	}
+}
+
+// Encode xsVar(3): a primitive value is written, an object is written up to
+// its count of items and pushed, so its items are encoded next.
+static void fxMarshalValue(xsMachine* the, txMarshalBuffer* buffer, txMarshalStack* stack)
+{
+	unsigned char* p;
+	stack->count++;
+	switch (xsTypeOf(xsVar(3))) {
+	case xsUndefinedType:
+		*fxMarshalReserve(the, buffer, 1) = mxMarshalUndefinedTag;
+		buffer->length++;
+		break;
+	case xsNullType:
+		*fxMarshalReserve(the, buffer, 1) = mxMarshalNullTag;
+		buffer->length++;
+		break;
+	case xsBooleanType:
+		*fxMarshalReserve(the, buffer, 1) = xsTest(xsVar(3)) ? mxMarshalTrueTag : mxMarshalFalseTag;
+		buffer->length++;
+		break;
+	case xsIntegerType:
+	case xsNumberType: {
+		xsNumberValue number = xsToNumber(xsVar(3));
+		p = fxMarshalReserve(the, buffer, 9);
+		if ((number >= -2147483648.0) && (number <= 2147483647.0) && ((xsNumberValue)(xsIntegerValue)number == number) && ((number != 0) || !signbit(number))) {
+			xsUnsignedValue value = (xsUnsignedValue)(xsIntegerValue)number;
+			p[0] = mxMarshalIntegerTag;
+			p[1] = (unsigned char)value;
+			p[2] = (unsigned char)(value >> 8);
+			p[3] = (unsigned char)(value >> 16);
+			p[4] = (unsigned char)(value >> 24);
+			buffer->length += 5;
+		}
+		else {
+			uint64_t value;
+			int i;
+			// one NaN, so the bytes depend only on the value
+			if (isnan(number))
+				value = 0x7FF8000000000000ULL;
+			else
+				c_memcpy(&value, &number, 8);
+			p[0] = mxMarshalNumberTag;
+			for (i = 1; i <= 8; i++, value >>= 8)
+				p[i] = (unsigned char)value;
+			buffer->length += 9;
+		}
+		} break;
+	case xsStringType:
+	case xsStringXType:
+		*fxMarshalReserve(the, buffer, 1) = mxMarshalStringTag;
+		buffer->length++;
+		fxMarshalString(the, buffer, xsToString(xsVar(3)));
+		break;
+	case xsBigIntType:
+	case xsBigIntXType:
+		*fxMarshalReserve(the, buffer, 1) = mxMarshalBigIntTag;
+		buffer->length++;
+		fxMarshalString(the, buffer, xsToString(xsVar(3)));
+		break;
+	case xsReferenceType: {
+		xsIntegerValue count;
+		xsNumberValue length;
+		xsBooleanValue array;
+		if (xsIsInstanceOf(xsVar(3), xsFunctionPrototype))
+			xsTypeError("Marshal: cannot encode function");
+		array = xsTest(xsCallFunction1(xsVar(5), xsUndefined, xsVar(3)));
+		if (array)
+			length = xsToNumber(xsGet(xsVar(3), xsID("length")));
+		else {
+			xsVar(4) = xsCallFunction1(xsVar(0), xsUndefined, xsVar(3));
+			xsSetAt(xsVar(2), xsInteger(stack->depth), xsVar(4));
+			length = xsToNumber(xsGet(xsVar(4), xsID("length")));
+		}
+		// the items are indexed with integers
+		if (length > 2147483647.0)
+			xsRangeError("Marshal: array too long");
+		count = (length > 0) ? (xsIntegerValue)length : 0;
+		fxMarshalPush(the, stack, count, array);
+		xsSetAt(xsVar(1), xsInteger(stack->depth - 1), xsVar(3));
+		*fxMarshalReserve(the, buffer, 1) = array ? mxMarshalArrayTag : mxMarshalObjectTag;
+		buffer->length++;
+		fxMarshalSize(the, buffer, (size_t)count);
+		} break;
+	default:
+		xsTypeError("Marshal: cannot encode symbol");
+		break;
+	}
+}
+
+void xsnap_marshal_encode(xsMachine* the)
+{
+	txMarshal* marshal;
+	txMarshalBuffer* buffer;
+	txMarshalStack* stack;
+	xsVars(mxMarshalVars);
+	marshal = fxNewMarshal(the);
+	buffer = &marshal->buffer;
+	stack = &marshal->stack;
+	xsTry {
+		xsVar(0) = xsGet(xsGet(xsGlobal, xsID("Object")), xsID("keys"));
+		xsVar(5) = xsGet(xsGet(xsGlobal, xsID("Array")), xsID("isArray"));
+		xsVar(1) = xsNewArray(0);
+		xsVar(2) = xsNewArray(0);
+		xsVar(3) = (xsToInteger(xsArgc) > 0) ? xsArg(0) : xsUndefined;
+		fxMarshalValue(the, buffer, stack);
+		while (stack->depth > 0) {
+			txMarshalFrame* frame = stack->frames + stack->depth - 1;
+			xsIntegerValue index = frame->index;
+			if (index == frame->count) {
+				stack->depth--;
+				continue;
+			}
+			frame->index++;
+			if (frame->array)
+				xsVar(3) = xsGetAt(xsGetAt(xsVar(1), xsInteger(stack->depth - 1)), xsInteger(index));
+			else {
+				xsVar(4) = xsGetAt(xsGetAt(xsVar(2), xsInteger(stack->depth - 1)), xsInteger(index));
+				fxMarshalString(the, buffer, xsToString(xsVar(4)));
+				xsVar(3) = xsGetAt(xsGetAt(xsVar(1), xsInteger(stack->depth - 1)), xsVar(4));
+			}
+			fxMarshalValue(the, buffer, stack);
+			fxMarshalMeter(the, stack, buffer->length);
+		}
+		fxMarshalMeter(the, stack, buffer->length);
+		xsResult = xsArrayBuffer(buffer->data, (xsIntegerValue)buffer->length);
+	}
+	xsCatch {
+		xsSetHostData(xsVar(6), NULL);
+		fxDeleteMarshal(marshal);
+		xsThrow(xsException);
+	}
+	xsSetHostData(xsVar(6), NULL);
+	fxDeleteMarshal(marshal);
+}
+
+static size_t fxDemarshalSize(xsMachine* the, unsigned char* data, size_t length, size_t* offset)
+{
+	size_t size = 0;
+	int shift = 0;
+	for (;;) {
+		unsigned char c;
+		if ((*offset >= length) || (shift > 28))
+			xsSyntaxError("Marshal: invalid data");
+		c = data[(*offset)++];
+		size |= (size_t)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			break;
+		shift += 7;
+	}
+	return size;
+}
+
+// WTF-8 to CESU-8, into xsVar(3): the data is measured and validated, then
+// converted into a new string. The data is read again after the string is
+// allocated, since the ArrayBuffer can move.
+static void fxDemarshalString(xsMachine* the, size_t offset, size_t size)
+{
+	unsigned char* p = (unsigned char*)xsToArrayBuffer(xsArg(0)) + offset;
+	unsigned char* limit = p + size;
+	unsigned char* q;
+	size_t length = size;
+	while (p < limit) {
+		unsigned char c = *p;
+		if (c == 0) {
+			length += 1;
+			p += 1;
+		}
+		else if (c < 0x80)
+			p += 1;
+		else if ((c >= 0xC2) && (c <= 0xDF) && (limit - p >= 2) && ((p[1] & 0xC0) == 0x80))
+			p += 2;
+		else if ((c >= 0xE0) && (c <= 0xEF) && (limit - p >= 3) && ((p[1] & 0xC0) == 0x80) && ((p[2] & 0xC0) == 0x80) && ((c != 0xE0) || (p[1] >= 0xA0)))
+			p += 3;
+		else if ((c >= 0xF0) && (c <= 0xF4) && (limit - p >= 4) && ((p[1] & 0xC0) == 0x80) && ((p[2] & 0xC0) == 0x80) && ((p[3] & 0xC0) == 0x80)
+				&& ((c != 0xF0) || (p[1] >= 0x90)) && ((c != 0xF4) || (p[1] < 0x90))) {
+			length += 2;
+			p += 4;
+		}
+		else
+			xsSyntaxError("Marshal: invalid string");
+	}
+	if (length > 0x7FFFFFFF)
+		xsRangeError("Marshal: string too long");
+	xsVar(3) = xsStringBuffer(NULL, (xsIntegerValue)length);
+	p = (unsigned char*)xsToArrayBuffer(xsArg(0)) + offset;
+	q = (unsigned char*)xsToString(xsVar(3));
+	if (length == size)
+		c_memcpy(q, p, size);
+	else {
+		limit = p + size;
+		while (p < limit) {
+			unsigned char c = *p;
+			if (c == 0) {
+				*q++ = 0xC0;
+				*q++ = 0x80;
+				p += 1;
+			}
+			else if (c >= 0xF0) {
+				xsUnsignedValue character = ((c & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+				xsUnsignedValue high = 0xD800 + ((character - 0x10000) >> 10);
+				xsUnsignedValue low = 0xDC00 + ((character - 0x10000) & 0x3FF);
+				*q++ = 0xED;
+				*q++ = (unsigned char)(0x80 | ((high >> 6) & 0x3F));
+				*q++ = (unsigned char)(0x80 | (high & 0x3F));
+				*q++ = 0xED;
+				*q++ = (unsigned char)(0x80 | ((low >> 6) & 0x3F));
+				*q++ = (unsigned char)(0x80 | (low & 0x3F));
+				p += 4;
+			}
+			else
+				*q++ = *p++;
+		}
+	}
+	q = (unsigned char*)xsToString(xsVar(3));
+	q[length] = 0;
+}
+
+// Decode the next value into xsVar(3): a primitive value, or an object,
+// pushed if it has items, so they are decoded next.
+static void fxDemarshalValue(xsMachine* the, size_t length, size_t* offset, txMarshalStack* stack)
+{
+	unsigned char* data = (unsigned char*)xsToArrayBuffer(xsArg(0));
+	size_t size;
+	unsigned char tag;
+	stack->count++;
+	if (*offset >= length)
+		xsSyntaxError("Marshal: invalid data");
+	tag = data[(*offset)++];
+	switch (tag) {
+	case mxMarshalUndefinedTag:
+		xsVar(3) = xsUndefined;
+		break;
+	case mxMarshalNullTag:
+		xsVar(3) = xsNull;
+		break;
+	case mxMarshalFalseTag:
+		xsVar(3) = xsFalse;
+		break;
+	case mxMarshalTrueTag:
+		xsVar(3) = xsTrue;
+		break;
+	case mxMarshalIntegerTag: {
+		xsUnsignedValue value;
+		if (length - *offset < 4)
+			xsSyntaxError("Marshal: invalid data");
+		data += *offset;
+		value = data[0] | (data[1] << 8) | (data[2] << 16) | ((xsUnsignedValue)data[3] << 24);
+		*offset += 4;
+		xsVar(3) = xsInteger((xsIntegerValue)value);
+		} break;
+	case mxMarshalNumberTag: {
+		uint64_t value = 0;
+		xsNumberValue number;
+		int i;
+		if (length - *offset < 8)
+			xsSyntaxError("Marshal: invalid data");
+		data += *offset;
+		for (i = 7; i >= 0; i--)
+			value = (value << 8) | data[i];
+		*offset += 8;
+		c_memcpy(&number, &value, 8);
+		xsVar(3) = xsNumber(number);
+		} break;
+	case mxMarshalBigIntTag:
+	case mxMarshalStringTag:
+		size = fxDemarshalSize(the, data, length, offset);
+		if (size > length - *offset)
+			xsSyntaxError("Marshal: invalid data");
+		if (tag == mxMarshalBigIntTag) {
+			// decimal digits, with an optional minus sign, for BigInt
+			unsigned char* p = data + *offset;
+			unsigned char* limit = p + size;
+			if ((p < limit) && (*p == '-'))
+				p++;
+			if (p == limit)
+				xsSyntaxError("Marshal: invalid bigint");
+			for (; p < limit; p++) {
+				if ((*p < '0') || (*p > '9'))
+					xsSyntaxError("Marshal: invalid bigint");
+			}
+		}
+		fxDemarshalString(the, *offset, size);
+		*offset += size;
+		if (tag == mxMarshalBigIntTag)
+			xsVar(3) = xsCallFunction1(xsVar(0), xsUndefined, xsVar(3));
+		break;
+	case mxMarshalArrayTag:
+	case mxMarshalObjectTag:
+		size = fxDemarshalSize(the, data, length, offset);
+		// every item takes at least one byte
+		if (size > length - *offset)
+			xsSyntaxError("Marshal: invalid data");
+		if (tag == mxMarshalArrayTag)
+			xsVar(3) = xsNewArray((xsIntegerValue)size);
+		else
+			xsVar(3) = xsNewObject();
+		if (size > 0) {
+			fxMarshalPush(the, stack, (xsIntegerValue)size, tag == mxMarshalArrayTag);
+			xsSetAt(xsVar(1), xsInteger(stack->depth - 1), xsVar(3));
+		}
+		break;
+	default:
+		xsSyntaxError("Marshal: invalid data");
+		break;
+	}
+}
+
+void xsnap_marshal_decode(xsMachine* the)
+{
+	txMarshal* marshal;
+	txMarshalStack* stack;
+	size_t length, offset = 0;
+	xsVars(mxMarshalVars);
+	if ((xsToInteger(xsArgc) < 1) || !xsIsInstanceOf(xsArg(0), xsArrayBufferPrototype))
+		xsTypeError("Marshal: expected ArrayBuffer");
+	length = xsGetArrayBufferLength(xsArg(0));
+	marshal = fxNewMarshal(the);
+	stack = &marshal->stack;
+	xsTry {
+		xsVar(0) = xsGet(xsGlobal, xsID("BigInt"));
+		xsVar(1) = xsNewArray(0);
+		xsVar(2) = xsNewArray(0);
+		for (;;) {
+			txMarshalFrame* frame;
+			xsIntegerValue depth = stack->depth;
+			if ((depth > 0) && !stack->frames[depth - 1].array) {
+				// the key of the next property
+				unsigned char* data = (unsigned char*)xsToArrayBuffer(xsArg(0));
+				size_t size = fxDemarshalSize(the, data, length, &offset);
+				if (size > length - offset)
+					xsSyntaxError("Marshal: invalid data");
+				fxDemarshalString(the, offset, size);
+				offset += size;
+				xsSetAt(xsVar(2), xsInteger(depth - 1), xsVar(3));
+			}
+			fxDemarshalValue(the, length, &offset, stack);
+			fxMarshalMeter(the, stack, offset);
+			if (stack->depth > depth)
+				continue;
+			// a complete value: add it to its containers, as long as they complete
+			while (stack->depth > 0) {
+				frame = stack->frames + stack->depth - 1;
+				xsVar(4) = xsGetAt(xsVar(1), xsInteger(stack->depth - 1));
+				if (frame->array)
+					xsSetAt(xsVar(4), xsInteger(frame->index), xsVar(3));
+				else
+					xsDefineAt(xsVar(4), xsGetAt(xsVar(2), xsInteger(stack->depth - 1)), xsVar(3), xsDefault);
+				frame->index++;
+				if (frame->index < frame->count)
+					break;
+				xsVar(3) = xsVar(4);
+				stack->depth--;
+			}
+			if (stack->depth == 0)
+				break;
+		}
+		if (offset != length)
+			xsSyntaxError("Marshal: invalid data");
+		fxMarshalMeter(the, stack, length);
+		xsResult = xsVar(3);
+	}
+	xsCatch {
+		xsSetHostData(xsVar(6), NULL);
+		fxDeleteMarshal(marshal);
+		xsThrow(xsException);
+	}
+	xsSetHostData(xsVar(6), NULL);
+	fxDeleteMarshal(marshal);
+}
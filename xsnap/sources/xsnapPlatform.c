@@ -13,14 +13,33 @@ mxExport void fxRunLoop(txMachine* the);
 
 mxExport void fxClearTimer(txMachine* the);
 mxExport void fxSetTimer(txMachine* the, txNumber interval, txBoolean repeat);
+mxExport void fxUseVirtualTimers(txMachine* the, txBoolean flag);
+mxExport void fxAdvanceVirtualTimers(txMachine* the, txNumber delta);
+mxExport txInteger fxCountTimers(txMachine* the);
 
 mxExport void fxVersion(txString theBuffer, txSize theSize);
+
+mxExport size_t fxGetCommittedSpace(txMachine* the);
+mxExport void fxReleaseFreeChunks(txMachine* the, size_t keep);
+mxExport void fxReleaseFreeSlots(txMachine* the, size_t keep);
+mxExport void fxRightSizeCreation(txCreation* creation, size_t chunksSize, size_t heapSize, int headroom);
+mxExport void fxEnterMachineThread(txMachine* the);
+mxExport void* fxGetHostChunkOfSize(txMachine* the, txSlot* slot, txDestructor destructor, txSize size);
+mxExport int fxWriteHeapCensus(txMachine* the, void* stream);
+static void fxReconcileReleasedChunks(txMachine* the);
 #ifdef mxMetering
 mxExport txUnsigned fxGetCurrentMeter(txMachine* the);
 mxExport void fxSetCurrentMeter(txMachine* the, txUnsigned value);
+mxExport void fxSetMeterInterval(txMachine* the, txUnsigned interval);
+mxExport void fxChargeMeter(txMachine* the, txUnsigned count);
+mxExport void fxStartComputronProfiling(txMachine* the);
+mxExport txBoolean fxIsProfilingComputrons(txMachine* the);
+mxExport void fxSampleComputrons(txMachine* the, txUnsigned index);
+mxExport int fxStopComputronProfiling(txMachine* the, void* stream);
 #endif
 
 typedef struct sxJob txJob;
+typedef struct sxTimers txTimers;
 
 struct sxJob {
 	txJob* next;
@@ -30,10 +49,40 @@ struct sxJob {
 	txSlot function;
 	txSlot argument;
 	txNumber interval;
+	txUnsigned sequence;
+};
+
+// Immediates are queued in a FIFO ring, timeouts and intervals in a binary
+// min-heap ordered by due time then by sequence. Job records are pooled.
+// Cleared jobs stay queued, with job->the set to NULL, until they are popped.
+// With a virtual clock, time only moves when the host advances it: the loop
+// runs the jobs due up to virtualLimit, jumping from one due time to the next
+// instead of sleeping, then returns with later timeouts still queued. So the
+// callbacks that run, and their order, depend only on what the host did.
+struct sxTimers {
+	txJob** ring;
+	txInteger ringHead;
+	txInteger ringCount;
+	txInteger ringSize;
+	txJob** heap;
+	txInteger heapCount;
+	txInteger heapSize;
+	txJob* freeJobs;
+	txUnsigned sequence;
+	txBoolean virtual;
+	txNumber virtualTime;
+	txNumber virtualLimit;
 };
 
 static void fxDestroyTimer(void* data);
 static void fxMarkTimer(txMachine* the, void* it, txMarkRoot markRoot);
+static txTimers* fxGetTimers(txMachine* the);
+static txNumber fxGetTimersTime(txTimers* timers);
+static txBoolean fxLessJob(txJob* a, txJob* b);
+static txJob* fxPopJob(txTimers* timers, txNumber when);
+static void fxPushJob(txMachine* the, txTimers* timers, txJob* job);
+static void fxRecycleJob(txTimers* timers, txJob* job);
+static void fxWaitForJob(txTimers* timers, txNumber when);
 
 static txHostHooks gxTimerHooks = {
 	fxDestroyTimer,
@@ -70,18 +119,26 @@ void fxMarkTimer(txMachine* the, void* it, txMarkRoot markRoot)
 
 void fxSetTimer(txMachine* the, txNumber interval, txBoolean repeat)
 {
-	c_timeval tv;
-	txJob* job;
-	txJob** address = (txJob**)&(the->timerJobs);
-	while ((job = *address))
-		address = &(job->next);
-	job = *address = malloc(sizeof(txJob));
+	txTimers* timers = fxGetTimers(the);
+	txJob* job = timers->freeJobs;
+	if (job)
+		timers->freeJobs = job->next;
+	else {
+		job = c_malloc(sizeof(txJob));
+		if (!job)
+			fxAbort(the, XS_NOT_ENOUGH_MEMORY_EXIT);
+	}
 	c_memset(job, 0, sizeof(txJob));
 	job->the = the;
-	c_gettimeofday(&tv, NULL);
-	if (repeat)
+	if (!(interval > 0)) // including NaN
+		interval = 0;
+	if (repeat) {
+		// an interval that is never later than now would keep the loop busy
+		if (interval < 1)
+			interval = 1;
 		job->interval = interval;
-	job->when = ((txNumber)(tv.tv_sec) * 1000.0) + ((txNumber)(tv.tv_usec) / 1000.0) + interval;
+	}
+	job->when = fxGetTimersTime(timers) + interval;
 	fxNewHostObject(the, NULL);
     mxPull(job->self);
 	job->function = *mxArgv(0);
@@ -92,10 +149,175 @@ void fxSetTimer(txMachine* the, txNumber interval, txBoolean repeat)
 	fxSetHostData(the, &job->self, job);
 	fxSetHostHooks(the, &job->self, &gxTimerHooks);
 	fxRemember(the, &job->self);
+	fxPushJob(the, timers, job);
 	fxAccess(the, &job->self);
 	*mxResult = the->scratch;
 }
 
+void fxUseVirtualTimers(txMachine* the, txBoolean flag)
+{
+	fxGetTimers(the)->virtual = flag;
+}
+
+void fxAdvanceVirtualTimers(txMachine* the, txNumber delta)
+{
+	txTimers* timers = fxGetTimers(the);
+	if (delta > 0) // excluding NaN
+		timers->virtualLimit = timers->virtualTime + delta;
+}
+
+txInteger fxCountTimers(txMachine* the)
+{
+	// the jobs that are not cleared: snapshots cannot save them
+	txTimers* timers = the->timerJobs;
+	txInteger count = 0, index;
+	if (timers) {
+		for (index = 0; index < timers->ringCount; index++) {
+			if (timers->ring[(timers->ringHead + index) & (timers->ringSize - 1)]->the)
+				count++;
+		}
+		for (index = 0; index < timers->heapCount; index++) {
+			if (timers->heap[index]->the)
+				count++;
+		}
+	}
+	return count;
+}
+
+txTimers* fxGetTimers(txMachine* the)
+{
+	txTimers* timers = the->timerJobs;
+	if (!timers) {
+		timers = c_calloc(1, sizeof(txTimers));
+		if (!timers)
+			fxAbort(the, XS_NOT_ENOUGH_MEMORY_EXIT);
+		the->timerJobs = timers;
+	}
+	return timers;
+}
+
+txNumber fxGetTimersTime(txTimers* timers)
+{
+	if (timers->virtual)
+		return timers->virtualTime;
+#if mxWindows
+	return (txNumber)GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((txNumber)(ts.tv_sec) * 1000.0) + ((txNumber)(ts.tv_nsec) / 1000000.0);
+#endif
+}
+
+txBoolean fxLessJob(txJob* a, txJob* b)
+{
+	if (a->when < b->when)
+		return 1;
+	if (a->when > b->when)
+		return 0;
+	return a->sequence < b->sequence;
+}
+
+txJob* fxPopJob(txTimers* timers, txNumber when)
+{
+	// the first job due at when, in scheduling order, or NULL
+	txJob** heap = timers->heap;
+	txJob* immediate = (timers->ringCount) ? timers->ring[timers->ringHead] : C_NULL;
+	txJob* job;
+	txInteger count, index, child;
+	if (timers->heapCount && (heap[0]->when <= when) && (!immediate || (heap[0]->sequence < immediate->sequence))) {
+		job = heap[0];
+		count = --timers->heapCount;
+		if (count) {
+			txJob* last = heap[count];
+			index = 0;
+			while ((child = (2 * index) + 1) < count) {
+				if ((child + 1 < count) && fxLessJob(heap[child + 1], heap[child]))
+					child++;
+				if (!fxLessJob(heap[child], last))
+					break;
+				heap[index] = heap[child];
+				index = child;
+			}
+			heap[index] = last;
+		}
+		return job;
+	}
+	if (immediate) {
+		timers->ringHead = (timers->ringHead + 1) & (timers->ringSize - 1);
+		timers->ringCount--;
+		return immediate;
+	}
+	return C_NULL;
+}
+
+void fxPushJob(txMachine* the, txTimers* timers, txJob* job)
+{
+	txInteger index, parent, size;
+	job->sequence = timers->sequence++;
+	if ((job->interval == 0) && (job->when <= fxGetTimersTime(timers))) {
+		if (timers->ringCount == timers->ringSize) {
+			txJob** ring;
+			size = timers->ringSize ? 2 * timers->ringSize : 64;
+			ring = c_malloc(size * sizeof(txJob*));
+			if (!ring)
+				fxAbort(the, XS_NOT_ENOUGH_MEMORY_EXIT);
+			for (index = 0; index < timers->ringCount; index++)
+				ring[index] = timers->ring[(timers->ringHead + index) & (timers->ringSize - 1)];
+			c_free(timers->ring);
+			timers->ring = ring;
+			timers->ringHead = 0;
+			timers->ringSize = size;
+		}
+		timers->ring[(timers->ringHead + timers->ringCount) & (timers->ringSize - 1)] = job;
+		timers->ringCount++;
+		return;
+	}
+	if (timers->heapCount == timers->heapSize) {
+		txJob** heap;
+		size = timers->heapSize ? 2 * timers->heapSize : 64;
+		heap = c_realloc(timers->heap, size * sizeof(txJob*));
+		if (!heap)
+			fxAbort(the, XS_NOT_ENOUGH_MEMORY_EXIT);
+		timers->heap = heap;
+		timers->heapSize = size;
+	}
+	index = timers->heapCount++;
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!fxLessJob(job, timers->heap[parent]))
+			break;
+		timers->heap[index] = timers->heap[parent];
+		index = parent;
+	}
+	timers->heap[index] = job;
+}
+
+void fxRecycleJob(txTimers* timers, txJob* job)
+{
+	job->next = timers->freeJobs;
+	timers->freeJobs = job;
+}
+
+void fxWaitForJob(txTimers* timers, txNumber when)
+{
+	txNumber delay = timers->heap[0]->when - when;
+	if (timers->virtual) {
+		timers->virtualTime = timers->heap[0]->when;
+		return;
+	}
+#if mxWindows
+	Sleep((DWORD)c_ceil(delay));
+#else
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t)(delay / 1000.0);
+		ts.tv_nsec = (long)((delay - ((txNumber)ts.tv_sec * 1000.0)) * 1000000.0);
+		nanosleep(&ts, NULL);
+	}
+#endif
+}
+
 /* PLATFORM */
 
 static void fxFulfillModuleFile(txMachine* the);
@@ -211,6 +433,13 @@ static txSize fxRoundToPageSize(txMachine* the, txSize size)
 	return size;
 }
 
+static size_t fxRoundToPages(txMachine* the, size_t size)
+{
+	if (!gxPageSize)
+		fxRoundToPageSize(the, 0);
+	return (size + gxPageSize - 1) & ~((size_t)gxPageSize - 1);
+}
+
 static void adjustSpaceMeter(txMachine* the, txSize theSize)
 {
 	size_t previous = the->allocatedSpace;
@@ -230,6 +459,12 @@ void* fxAllocateChunks(txMachine* the, txSize size)
 	if (the->firstBlock) {
 		base = (txByte*)(the->firstBlock);
 		result = (txByte*)(the->firstBlock->limit);
+		if (the->releasedChunks) {
+			// XS grows the block when compaction was not enough, so it is
+			// about to use the released tail again.
+			the->committedSpace += (base + fxRoundToPages(the, (size_t)(result - base))) - (txByte*)(the->releasedChunks);
+			the->releasedChunks = C_NULL;
+		}
 	}
 	else
 #if mxWindows
@@ -250,6 +485,8 @@ void* fxAllocateChunks(txMachine* the, txSize size)
 		else if (mprotect(base + current, size - current, PROT_READ | PROT_WRITE))
 #endif
 			result = NULL;
+		else
+			the->committedSpace += size - current;
 	}
 	return result;
 }
@@ -267,12 +504,210 @@ txSlot* fxAllocateSlots(txMachine* the, txSize theCount)
 {
 	// fprintf(stderr, "fxAllocateSlots(%u) * %d = %ld\n", theCount, sizeof(txSlot), theCount * sizeof(txSlot));
 	adjustSpaceMeter(the, theCount * sizeof(txSlot));
+#if mxWindows
 	return (txSlot*)c_malloc(theCount * sizeof(txSlot));
+#else
+	{
+		// Each segment is mapped on its own so that fxReleaseFreeSlots can
+		// return it to the OS: the slot in front records the size of the
+		// mapping and the size charged to the space meter, the guard page
+		// behind prevents fxGrowSlots from merging the next segment into this
+		// one.
+		size_t size = fxRoundToPages(the, (size_t)(theCount + 1) * sizeof(txSlot)) + gxPageSize;
+		txByte* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (base == MAP_FAILED)
+			return C_NULL;
+		mprotect(base + size - gxPageSize, gxPageSize, PROT_NONE);
+		((size_t*)base)[0] = size;
+		((size_t*)base)[1] = (size_t)theCount * sizeof(txSlot);
+		the->committedSpace += size - gxPageSize;
+		return ((txSlot*)base) + 1;
+	}
+#endif
 }
 
 void fxFreeSlots(txMachine* the, void* theSlots)
 {
+#if mxWindows
 	c_free(theSlots);
+#else
+	txByte* base;
+	size_t size;
+	if (!theSlots)
+		return;
+	base = (txByte*)(((txSlot*)theSlots) - 1);
+	size = ((size_t*)base)[0];
+	the->committedSpace -= size - gxPageSize;
+	// so that releasing and growing again does not reach the allocation limit
+	the->allocatedSpace -= ((size_t*)base)[1];
+	munmap(base, size);
+#endif
+}
+
+size_t fxGetCommittedSpace(txMachine* the)
+{
+	fxReconcileReleasedChunks(the);
+	return the->committedSpace;
+}
+
+void fxReconcileReleasedChunks(txMachine* the)
+{
+	// Pages released by fxReleaseFreeChunks are committed again as soon as
+	// XS allocates chunks over them.
+	txByte* released = the->releasedChunks;
+	if (released && the->firstBlock) {
+		txByte* current = (txByte*)(the->firstBlock->current);
+		if (current > released) {
+			current = released + fxRoundToPages(the, (size_t)(current - released));
+			the->committedSpace += current - released;
+			the->releasedChunks = current;
+		}
+	}
+}
+
+void fxReleaseFreeChunks(txMachine* the, size_t keep)
+{
+	txByte* base;
+	txByte* from;
+	txByte* to;
+	if (!the->firstBlock)
+		return;
+	fxReconcileReleasedChunks(the);
+	base = (txByte*)(the->firstBlock);
+	from = (txByte*)(the->firstBlock->current);
+	to = (txByte*)(the->firstBlock->limit);
+	if ((size_t)(to - from) <= keep)
+		return;
+	from = base + fxRoundToPages(the, (size_t)(from - base) + keep);
+	to = base + fxRoundToPages(the, (size_t)(to - base));
+	if (the->releasedChunks && ((txByte*)the->releasedChunks < to))
+		to = the->releasedChunks;
+	if (from >= to)
+		return;
+	// The pages stay readable and writable, since XS owns everything up to
+	// the block limit, but the OS reclaims them and supplies zeroed pages
+	// when they are touched again.
+#if mxWindows
+	if (!VirtualAlloc(from, to - from, MEM_RESET, PAGE_READWRITE))
+		return;
+#elif mxLinux
+	if (madvise(from, to - from, MADV_DONTNEED))
+		return;
+#else
+	if (madvise(from, to - from, MADV_FREE))
+		return;
+#endif
+	the->committedSpace -= to - from;
+	the->releasedChunks = from;
+}
+
+typedef struct {
+	txSlot* heap;
+	txSlot* limit;
+	size_t freeCount;
+	txBoolean released;
+} txSegment;
+
+static int fxCompareSegments(const void* p, const void* q)
+{
+	txSlot* a = ((txSegment*)p)->heap;
+	txSlot* b = ((txSegment*)q)->heap;
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static txSegment* fxFindSegment(txSegment* segments, txInteger count, txSlot* slot)
+{
+	txInteger min = 0, max = count;
+	while (min < max) {
+		txInteger mid = (min + max) >> 1;
+		txSegment* segment = segments + mid;
+		if (slot < segment->heap)
+			max = mid;
+		else if (slot >= segment->limit)
+			min = mid + 1;
+		else
+			return segment;
+	}
+	return C_NULL;
+}
+
+void fxReleaseFreeSlots(txMachine* the, size_t keep)
+{
+#if mxWindows
+#else
+	txSegment* segments;
+	txSegment* segment;
+	txInteger count = 0, index;
+	txSlot* heap;
+	txSlot* slot;
+	txSlot** address;
+	size_t freeCount = 0, keepCount = keep / sizeof(txSlot);
+	txBoolean release = 0;
+
+	// The last segment is the initial one, it is never released.
+	heap = the->firstHeap;
+	while (heap && heap->next) {
+		count++;
+		heap = heap->next;
+	}
+	if (!count)
+		return;
+	segments = c_malloc(count * sizeof(txSegment));
+	if (!segments)
+		return;
+	heap = the->firstHeap;
+	for (index = 0; index < count; index++) {
+		segment = segments + index;
+		segment->heap = heap;
+		segment->limit = heap->value.reference;
+		segment->freeCount = 0;
+		segment->released = 0;
+		heap = heap->next;
+	}
+	c_qsort(segments, count, sizeof(txSegment), fxCompareSegments);
+
+	// A segment is empty when all of its slots are on the free list.
+	slot = the->freeHeap;
+	while (slot) {
+		freeCount++;
+		segment = fxFindSegment(segments, count, slot);
+		if (segment)
+			segment->freeCount++;
+		slot = slot->next;
+	}
+	for (index = 0; index < count; index++) {
+		size_t capacity;
+		segment = segments + index;
+		capacity = segment->limit - segment->heap - 1;
+		if ((segment->freeCount == capacity) && (freeCount - capacity >= keepCount)) {
+			segment->released = 1;
+			freeCount -= capacity;
+			release = 1;
+		}
+	}
+	if (release) {
+		address = &(the->freeHeap);
+		while ((slot = *address)) {
+			segment = fxFindSegment(segments, count, slot);
+			if (segment && segment->released)
+				*address = slot->next;
+			else
+				address = &(slot->next);
+		}
+		address = &(the->firstHeap);
+		while ((heap = *address)) {
+			segment = fxFindSegment(segments, count, heap + 1);
+			if (segment && segment->released) {
+				*address = heap->next;
+				the->maximumHeapCount -= segment->limit - segment->heap - 1;
+				fxFreeSlots(the, heap);
+			}
+			else
+				address = &(heap->next);
+		}
+	}
+	c_free(segments);
+#endif
 }
 
 void fxCreateMachinePlatform(txMachine* the)
@@ -296,6 +731,23 @@ void fxCreateMachinePlatform(txMachine* the)
 
 void fxDeleteMachinePlatform(txMachine* the)
 {
+	txTimers* timers = the->timerJobs;
+	if (timers) {
+		txJob* job;
+		while ((job = fxPopJob(timers, C_INFINITY)))
+			fxRecycleJob(timers, job);
+		while ((job = timers->freeJobs)) {
+			timers->freeJobs = job->next;
+			c_free(job);
+		}
+		c_free(timers->ring);
+		c_free(timers->heap);
+		c_free(timers);
+		the->timerJobs = C_NULL;
+	}
+#ifdef mxMetering
+	fxStopComputronProfiling(the, C_NULL);
+#endif
 }
 
 void fxQueuePromiseJobs(txMachine* the)
@@ -312,10 +764,9 @@ void fxRunDebugger(txMachine* the)
 
 void fxRunLoop(txMachine* the)
 {
-	c_timeval tv;
+	txTimers* timers = fxGetTimers(the);
 	txNumber when;
 	txJob* job;
-	txJob** address;
 	for (;;) {
 		while (the->promiseJobs) {
 			the->promiseJobs = 0;
@@ -325,55 +776,63 @@ void fxRunLoop(txMachine* the)
 		if (the->promiseJobs) {
 			continue;
 		}
-		c_gettimeofday(&tv, NULL);
-		when = ((txNumber)(tv.tv_sec) * 1000.0) + ((txNumber)(tv.tv_usec) / 1000.0);
-		address = (txJob**)&(the->timerJobs);
-		if (!*address)
+		if (!timers->ringCount && !timers->heapCount)
 			break;
-		while ((job = *address)) {
-			txMachine* the = job->the;
-			if (the) {
-				if (job->when <= when) {
-					fxBeginHost(the);
-					mxTry(the) {
-						mxPushUndefined();
-						mxPush(job->function);
-						mxCall();
-						mxPush(job->argument);
-						mxRunCount(1);
-						mxPop();
-						if (job->the) {
-							if (job->interval) {
-								job->when += job->interval;
-							}
-							else {
-								fxAccess(the, &job->self);
-								*mxResult = the->scratch;
-								fxForget(the, &job->self);
-								fxSetHostData(the, mxResult, NULL);
-								job->the = NULL;
-							}
-						}
-					}
-					mxCatch(the) {
-						fxAccess(the, &job->self);
-						*mxResult = the->scratch;
-						fxForget(the, &job->self);
-						fxSetHostData(the, mxResult, NULL);
-						job->the = NULL;
-						fxAbort(the, XS_UNHANDLED_EXCEPTION_EXIT);
-					}
-					fxEndHost(the);
-					break; // to run promise jobs queued by the timer in the same "tick"
+		when = fxGetTimersTime(timers);
+		job = fxPopJob(timers, when);
+		if (!job) {
+			// only timeouts are pending: drop cleared ones without waiting for them
+			job = timers->heap[0];
+			if (!job->the)
+				fxRecycleJob(timers, fxPopJob(timers, job->when));
+			else if (timers->virtual && (job->when > timers->virtualLimit))
+				break;
+			else
+				fxWaitForJob(timers, when);
+			continue;
+		}
+		if (!job->the) {
+			fxRecycleJob(timers, job);
+			continue;
+		}
+		fxBeginHost(the);
+		mxTry(the) {
+			mxPushUndefined();
+			mxPush(job->function);
+			mxCall();
+			mxPush(job->argument);
+			mxRunCount(1);
+			mxPop();
+			if (job->the) {
+				if (job->interval) {
+					job->when += job->interval;
+					fxPushJob(the, timers, job);
+				}
+				else {
+					fxAccess(the, &job->self);
+					*mxResult = the->scratch;
+					fxForget(the, &job->self);
+					fxSetHostData(the, mxResult, NULL);
+					job->the = NULL;
 				}
-				address = &(job->next);
-			}
-			else {
-				*address = job->next;
-				c_free(job);
 			}
+			if (!job->the)
+				fxRecycleJob(timers, job);
+		}
+		mxCatch(the) {
+			fxAccess(the, &job->self);
+			*mxResult = the->scratch;
+			fxForget(the, &job->self);
+			fxSetHostData(the, mxResult, NULL);
+			job->the = NULL;
+			fxRecycleJob(timers, job);
+			fxAbort(the, XS_UNHANDLED_EXCEPTION_EXIT);
 		}
+		fxEndHost(the);
+		// one job per "tick", to run the promise jobs it queued
 	}
+	if (timers->virtual && (timers->virtualTime < timers->virtualLimit))
+		timers->virtualTime = timers->virtualLimit;
 	fxCheckUnhandledRejections(the, 1);
 }
 
@@ -775,6 +1234,240 @@ void fxSetCurrentMeter(txMachine* the, txUnsigned value)
 {
 	the->meterIndex = value;
 }
+
+void fxSetMeterInterval(txMachine* the, txUnsigned interval)
+{
+	// not from the metering callback, which restores the interval it was called with
+	txUnsigned count = the->meterIndex + interval;
+	if (count < the->meterIndex)
+		count = 0xFFFFFFFF;
+	the->meterInterval = interval;
+	the->meterCount = count;
+}
+
+void fxChargeMeter(txMachine* the, txUnsigned count)
+{
+	// like fxMeterHostFunction, but the metering callback runs now if it is due,
+	// so a long host function can be aborted before it returns
+	the->meterIndex += count;
+	mxCheckMeter();
+}
+
+// Computron profiler: the metering callback calls fxSampleComputrons with the
+// meter index, and the computrons spent since the previous sample are charged
+// to the function running now, in the tree of the functions calling it. The
+// profile is written in the .cpuprofile format, with computrons for
+// microseconds: one sample per node, its time delta being the computrons the
+// node spent itself.
+
+typedef struct sxComputronNode txComputronNode;
+typedef struct sxComputronProfile txComputronProfile;
+
+struct sxComputronNode {
+	txComputronNode* firstChild;
+	txComputronNode* nextSibling;
+	txSlot* function;
+	txID name;
+	txInteger id;
+	txNumber computrons;
+};
+
+struct sxComputronProfile {
+	txComputronNode root;
+	txInteger nodeCount;
+	txUnsigned index;
+	txSlot** functions;
+	txInteger functionsSize;
+};
+
+static txComputronNode* fxFindComputronNode(txComputronProfile* profile, txComputronNode* parent, txSlot* function, txID name);
+static void fxFreeComputronNodes(txComputronNode* node);
+static void fxPrintComputronName(txMachine* the, FILE* stream, txID name);
+static void fxPrintComputronNodes(txMachine* the, FILE* stream, txComputronNode* node, txBoolean first);
+static txBoolean fxPrintComputronSamples(FILE* stream, txComputronNode* node, txBoolean first);
+static void fxPrintComputronDeltas(FILE* stream, txComputronNode* node, txNumber* delta, txBoolean* first);
+
+void fxStartComputronProfiling(txMachine* the)
+{
+	txComputronProfile* profile = the->computronProfile;
+	if (profile)
+		return;
+	profile = c_calloc(1, sizeof(txComputronProfile));
+	if (!profile)
+		fxAbort(the, XS_NOT_ENOUGH_MEMORY_EXIT);
+	profile->root.id = 1;
+	profile->root.name = XS_NO_ID;
+	profile->nodeCount = 1;
+	profile->index = the->meterIndex;
+	the->computronProfile = profile;
+}
+
+txBoolean fxIsProfilingComputrons(txMachine* the)
+{
+	return (the->computronProfile) ? 1 : 0;
+}
+
+void fxSampleComputrons(txMachine* the, txUnsigned index)
+{
+	txComputronProfile* profile = the->computronProfile;
+	txComputronNode* node;
+	txSlot* frame;
+	txInteger count = 0;
+	txNumber computrons;
+	if (!profile)
+		return;
+	// the meter index is reset at the beginning of every crank
+	computrons = (index >= profile->index) ? index - profile->index : index;
+	profile->index = index;
+	if (!computrons)
+		return;
+	for (frame = the->frame; frame && frame->next; frame = frame->next) {
+		txSlot* function = frame + 3; // mxFunction of the frame
+		if ((function->kind != XS_REFERENCE_KIND) || !mxIsFunction(function->value.reference))
+			continue;
+		if (count == profile->functionsSize) {
+			txInteger size = profile->functionsSize ? 2 * profile->functionsSize : 64;
+			txSlot** functions = c_realloc(profile->functions, size * sizeof(txSlot*));
+			if (!functions)
+				return;
+			profile->functions = functions;
+			profile->functionsSize = size;
+		}
+		profile->functions[count++] = function->value.reference;
+	}
+	node = &profile->root;
+	while (count > 0) {
+		txSlot* function = profile->functions[--count];
+		node = fxFindComputronNode(profile, node, function, mxFunctionInstanceCode(function)->ID);
+		if (!node)
+			return;
+	}
+	node->computrons += computrons;
+}
+
+int fxStopComputronProfiling(txMachine* the, void* stream)
+{
+	txComputronProfile* profile = the->computronProfile;
+	txNumber delta = 0, total = 0;
+	txBoolean first = 1;
+	int error = 0;
+	if (!profile)
+		return 0;
+	if (stream) {
+		fprintf(stream, "{\"nodes\":[");
+		fxPrintComputronNodes(the, stream, &profile->root, 1);
+		fprintf(stream, "],\"startTime\":0,\"endTime\":");
+		fxPrintComputronDeltas(C_NULL, &profile->root, &total, &first);
+		fprintf(stream, "%.0f,\"samples\":[", total);
+		if (fxPrintComputronSamples(stream, &profile->root, 1))
+			fprintf(stream, "1");
+		fprintf(stream, "],\"timeDeltas\":[0");
+		first = 1;
+		fxPrintComputronDeltas(stream, &profile->root, &delta, &first);
+		fprintf(stream, "]}\n");
+		if (ferror(stream))
+			error = errno ? errno : EIO;
+	}
+	fxFreeComputronNodes(profile->root.firstChild);
+	c_free(profile->functions);
+	c_free(profile);
+	the->computronProfile = C_NULL;
+	return error;
+}
+
+txComputronNode* fxFindComputronNode(txComputronProfile* profile, txComputronNode* parent, txSlot* function, txID name)
+{
+	txComputronNode** address = &parent->firstChild;
+	txComputronNode* node;
+	// a collected function can be reused for another one: check its name too
+	while ((node = *address)) {
+		if ((node->function == function) && (node->name == name))
+			return node;
+		address = &node->nextSibling;
+	}
+	node = c_calloc(1, sizeof(txComputronNode));
+	if (!node)
+		return C_NULL;
+	node->function = function;
+	node->name = name;
+	node->id = ++profile->nodeCount;
+	*address = node;
+	return node;
+}
+
+void fxFreeComputronNodes(txComputronNode* node)
+{
+	while (node) {
+		txComputronNode* next = node->nextSibling;
+		fxFreeComputronNodes(node->firstChild);
+		c_free(node);
+		node = next;
+	}
+}
+
+void fxPrintComputronName(txMachine* the, FILE* stream, txID name)
+{
+	txString string = (name != XS_NO_ID) ? fxGetKeyName(the, name) : C_NULL;
+	if (!string || !*string) {
+		fprintf(stream, "(anonymous)");
+		return;
+	}
+	while (*string) {
+		unsigned char c = (unsigned char)*string++;
+		if ((c == '"') || (c == '\\'))
+			fprintf(stream, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(stream, "\\u%04x", c);
+		else
+			fputc(c, stream);
+	}
+}
+
+void fxPrintComputronNodes(txMachine* the, FILE* stream, txComputronNode* node, txBoolean first)
+{
+	txComputronNode* child;
+	fprintf(stream, "%s{\"id\":%d,\"callFrame\":{\"functionName\":\"", first ? "" : ",", (int)node->id);
+	if (node->id == 1)
+		fprintf(stream, "(root)");
+	else
+		fxPrintComputronName(the, stream, node->name);
+	fprintf(stream, "\",\"scriptId\":\"0\",\"url\":\"\",\"lineNumber\":-1,\"columnNumber\":-1},\"hitCount\":%d,\"children\":[", (node->computrons > 0) ? 1 : 0);
+	for (child = node->firstChild; child; child = child->nextSibling)
+		fprintf(stream, "%s%d", (child == node->firstChild) ? "" : ",", (int)child->id);
+	fprintf(stream, "]}");
+	for (child = node->firstChild; child; child = child->nextSibling)
+		fxPrintComputronNodes(the, stream, child, 0);
+}
+
+txBoolean fxPrintComputronSamples(FILE* stream, txComputronNode* node, txBoolean first)
+{
+	txComputronNode* child;
+	if (node->computrons > 0) {
+		fprintf(stream, "%s%d", first ? "" : ",", (int)node->id);
+		first = 0;
+	}
+	for (child = node->firstChild; child; child = child->nextSibling)
+		first = fxPrintComputronSamples(stream, child, first);
+	return first;
+}
+
+void fxPrintComputronDeltas(FILE* stream, txComputronNode* node, txNumber* delta, txBoolean* first)
+{
+	// the time delta of a sample is the time spent by the previous sample
+	txComputronNode* child;
+	if (node->computrons > 0) {
+		if (stream) {
+			if (!*first)
+				fprintf(stream, ",%.0f", *delta);
+			*delta = node->computrons;
+		}
+		else
+			*delta += node->computrons;
+		*first = 0;
+	}
+	for (child = node->firstChild; child; child = child->nextSibling)
+		fxPrintComputronDeltas(stream, child, delta, first);
+}
 #endif
 
 txSize fxGetCurrentHeapCount(txMachine* the)
@@ -782,7 +1475,57 @@ txSize fxGetCurrentHeapCount(txMachine* the)
 	return the->currentHeapCount;
 }
 
+size_t fxGetCurrentHeapSize(txMachine* the)
+{
+	return (size_t)the->currentChunksSize + ((size_t)the->currentHeapCount * sizeof(txSlot));
+}
+
+void fxRightSizeCreation(txCreation* creation, size_t chunksSize, size_t heapSize, int headroom)
+{
+	// chunksSize and heapSize are the sizes of the BLOC and HEAP atoms, without headers
+	size_t heapCount = heapSize / sizeof(txSlot);
+	size_t size = chunksSize + (chunksSize / 100) * headroom;
+	size_t count = heapCount + (heapCount / 100) * headroom;
+	if (size < (size_t)creation->incrementalChunkSize)
+		size = creation->incrementalChunkSize;
+	if (size < (size_t)creation->initialChunkSize)
+		creation->initialChunkSize = (txSize)size;
+	if (count < (size_t)creation->incrementalHeapCount)
+		count = creation->incrementalHeapCount;
+	if (count < (size_t)creation->initialHeapCount)
+		creation->initialHeapCount = (txSize)count;
+}
+
+void fxEnterMachineThread(txMachine* the)
+{
+	// the native stack limit was computed on the thread that created the machine
+#ifdef mxBoundsCheck
+	the->cStackLimit = fxCStackLimit();
+#endif
+}
+
+void* fxGetHostChunkOfSize(txMachine* the, txSlot* slot, txDestructor destructor, txSize size)
+{
+	// unlike xsGetHostChunk, never throws: NULL unless the slot is a host object
+	// with a chunk of at least size bytes, without hooks, and with that destructor
+	txSlot* host;
+	txByte* data;
+	if (slot->kind != XS_REFERENCE_KIND)
+		return C_NULL;
+	host = slot->value.reference->next;
+	if (!host || (host->kind != XS_HOST_KIND) || !(host->flag & XS_HOST_CHUNK_FLAG) || (host->flag & XS_HOST_HOOKS_FLAG))
+		return C_NULL;
+	if (host->value.host.variant.destructor != destructor)
+		return C_NULL;
+	data = host->value.host.data;
+	if (!data || ((((txChunk*)(data - sizeof(txChunk)))->size - (txSize)sizeof(txChunk)) < size))
+		return C_NULL;
+	return data;
+}
+
 extern void fxDumpSnapshot(txMachine* the, txSnapshot* snapshot);
+extern void fxCensusSnapshot(txMachine* the, txSnapshot* snapshot, void* stream);
+extern int fxDiffSnapshots(txString pathA, txString pathB, void* stream, txBoolean* differ);
 
 typedef void (*txDumpChunk)(FILE* file, txByte* data, txSize size);
 
@@ -1497,5 +2240,1298 @@ void fxDumpSlotTable(FILE* file, txByte* buffer, txSize size)
 	}
 }
 
+// Snapshot comparison: both snapshots are read once, atom by atom, chunk by
+// chunk and slot by slot, in bounded memory, and the first differences of
+// every atom are reported. Slots and chunks are matched by position, not by
+// structure: snapshots of the same computation have the same layout, so the
+// first differing slot or chunk is where the heaps diverge, but one extra slot
+// shifts every slot after it, so the later differences mean little. Key
+// names are then read from the KEYS, HEAP and BLOC atoms by seeking. For the
+// first differing slot of the HEAP atom, the instance that owns it and a path
+// to that instance from the global object are found by scanning HEAP again:
+// the slot whose next is a property is the previous property, or the instance
+// at the head of the list, and a property that refers to an instance is one
+// step closer to the global. The global is the last slot of the STAC atom.
+
+#define mxDiffCount 10
+#define mxDiffBufferSize 65536
+#define mxDiffNameSize 64
+#define mxDiffOwnerLength 4096
+#define mxDiffPathLength 16
+#define mxDiffReferenceCount 16
+
+typedef struct sxDiff txDiff;
+typedef struct sxDiffAtom txDiffAtom;
+typedef struct sxDiffFile txDiffFile;
+
+struct sxDiff {
+	size_t offset;
+	size_t detail;
+	txSlot slots[2];
+};
+
+struct sxDiffAtom {
+	char types[2][4];
+	txSize sizes[2];
+	size_t count;
+	size_t recorded;
+	txDiff diffs[mxDiffCount];
+};
+
+struct sxDiffFile {
+	FILE* file;
+	long block;
+	long heap;
+	size_t heapCount;
+	long keys;
+	size_t keyCount;
+	long stack;
+	size_t stackCount;
+	txByte* buffer;
+};
+
+static void fxDiffBytes(txDiffFile* files, txDiffAtom* atom, size_t size, int* error);
+static void fxDiffChunks(txDiffFile* files, txDiffAtom* atom, size_t size, int* error);
+static txBoolean fxDiffKeyName(txDiffFile* file, txID id, char* name);
+static size_t fxDiffOwner(txDiffFile* file, size_t address);
+static void fxDiffPath(txDiffFile* file, size_t address, FILE* stream);
+static txBoolean fxDiffReadSlot(txDiffFile* file, size_t address, txSlot* slot);
+static size_t fxDiffScanSlots(txDiffFile* file, size_t address, txBoolean reference, size_t from);
+static txDiff* fxDiffRecord(txDiffAtom* atom, size_t offset);
+static void fxDiffSkip(txDiffFile* file, size_t size, int* error);
+static void fxDiffSlots(txDiffFile* files, txDiffAtom* atom, size_t size, int* error);
+static void fxDiffTable(txDiffFile* files, txDiffAtom* atom, size_t size, int* error);
+static void fxPrintDiffs(txDiffFile* files, txDiffAtom* atoms, txInteger atomCount, FILE* stream);
+
+int fxDiffSnapshots(txString pathA, txString pathB, void* stream, txBoolean* differ)
+{
+	txDiffFile files[2];
+	txDiffAtom* atoms = C_NULL;
+	txInteger atomCount = 0, index;
+	int error = 0;
+	*differ = 0;
+	c_memset(files, 0, sizeof(files));
+	files[0].file = fopen(pathA, "rb");
+	files[1].file = fopen(pathB, "rb");
+	files[0].buffer = c_malloc(mxDiffBufferSize);
+	files[1].buffer = c_malloc(mxDiffBufferSize);
+	// a snapshot has ten atoms
+	atoms = c_calloc(16, sizeof(txDiffAtom));
+	if (!files[0].file || !files[1].file)
+		error = errno;
+	else if (!files[0].buffer || !files[1].buffer || !atoms)
+		error = ENOMEM;
+	while (!error && (atomCount < 16)) {
+		Atom headers[2];
+		txDiffAtom* atom = atoms + atomCount;
+		size_t size;
+		txBoolean done[2];
+		for (index = 0; index < 2; index++) {
+			done[index] = (fread(&headers[index], sizeof(Atom), 1, files[index].file) != 1);
+			if (!done[index]) {
+				c_memcpy(atom->types[index], &headers[index].atomType, 4);
+				atom->sizes[index] = ntohl(headers[index].atomSize);
+			}
+			else
+				c_memcpy(atom->types[index], "----", 4);
+		}
+		if (done[0] && done[1])
+			break;
+		atomCount++;
+		if (done[0] || done[1] || (headers[0].atomType != headers[1].atomType)) {
+			// the snapshots cannot be compared further
+			atom->count = 1;
+			break;
+		}
+		if (atom->sizes[0] != atom->sizes[1])
+			atom->count++;
+		if (atomCount == 1)
+			continue; // XS_M, the container
+		size = (atom->sizes[0] < atom->sizes[1]) ? atom->sizes[0] : atom->sizes[1];
+		size = (size > 8) ? size - 8 : 0;
+		for (index = 0; index < 2; index++) {
+			long position = ftell(files[index].file);
+			if (!c_strncmp(atom->types[0], "BLOC", 4))
+				files[index].block = position;
+			else if (!c_strncmp(atom->types[0], "HEAP", 4)) {
+				files[index].heap = position;
+				files[index].heapCount = (atom->sizes[index] - 8) / sizeof(txSlot);
+			}
+			else if (!c_strncmp(atom->types[0], "KEYS", 4)) {
+				files[index].keys = position;
+				files[index].keyCount = (atom->sizes[index] - 8) / sizeof(txSlot*);
+			}
+			else if (!c_strncmp(atom->types[0], "STAC", 4)) {
+				files[index].stack = position;
+				files[index].stackCount = (atom->sizes[index] - 8) / sizeof(txSlot);
+			}
+		}
+		if (!c_strncmp(atom->types[0], "BLOC", 4))
+			fxDiffChunks(files, atom, size, &error);
+		else if (!c_strncmp(atom->types[0], "HEAP", 4) || !c_strncmp(atom->types[0], "STAC", 4))
+			fxDiffSlots(files, atom, size, &error);
+		else if (!c_strncmp(atom->types[0], "KEYS", 4) || !c_strncmp(atom->types[0], "NAME", 4) || !c_strncmp(atom->types[0], "SYMB", 4))
+			fxDiffTable(files, atom, size, &error);
+		else
+			fxDiffBytes(files, atom, size, &error);
+		// the rest of the longer atom
+		for (index = 0; index < 2; index++)
+			fxDiffSkip(files + index, atom->sizes[index] - 8 - size, &error);
+	}
+	if (!error) {
+		for (index = 0; index < atomCount; index++) {
+			if (atoms[index].count)
+				*differ = 1;
+		}
+		fxPrintDiffs(files, atoms, atomCount, stream);
+		if (ferror((FILE*)stream))
+			error = errno ? errno : EIO;
+	}
+	for (index = 0; index < 2; index++) {
+		if (files[index].file)
+			fclose(files[index].file);
+		c_free(files[index].buffer);
+	}
+	c_free(atoms);
+	return error;
+}
 
+void fxDiffBytes(txDiffFile* files, txDiffAtom* atom, size_t size, int* error)
+{
+	size_t offset = 0;
+	while (!*error && (offset < size)) {
+		size_t length = size - offset, index;
+		if (length > mxDiffBufferSize)
+			length = mxDiffBufferSize;
+		if ((fread(files[0].buffer, length, 1, files[0].file) != 1) || (fread(files[1].buffer, length, 1, files[1].file) != 1)) {
+			*error = EIO;
+			return;
+		}
+		for (index = 0; index < length; index++) {
+			if (files[0].buffer[index] != files[1].buffer[index]) {
+				fxDiffRecord(atom, offset + index);
+				break;
+			}
+		}
+		offset += length;
+	}
+}
 
+void fxDiffChunks(txDiffFile* files, txDiffAtom* atom, size_t size, int* error)
+{
+	// chunks are compared as long as their sizes are the same
+	size_t offset = 0;
+	while (!*error && (offset + sizeof(txChunk) <= size)) {
+		txChunk chunks[2];
+		size_t chunkSize, position;
+		txDiff* diff;
+		txBoolean differs = 0;
+		if ((fread(&chunks[0], sizeof(txChunk), 1, files[0].file) != 1) || (fread(&chunks[1], sizeof(txChunk), 1, files[1].file) != 1)) {
+			*error = EIO;
+			return;
+		}
+		offset += sizeof(txChunk);
+		chunkSize = chunks[0].size;
+		if ((chunks[0].size != chunks[1].size) || (chunkSize < sizeof(txChunk)) || (offset - sizeof(txChunk) + chunkSize > size)) {
+			diff = fxDiffRecord(atom, offset);
+			if (diff) {
+				diff->slots[0].value.integer = chunks[0].size;
+				diff->slots[1].value.integer = chunks[1].size;
+			}
+			break;
+		}
+		chunkSize -= sizeof(txChunk);
+		position = 0;
+		while (position < chunkSize) {
+			size_t length = chunkSize - position, index;
+			if (length > mxDiffBufferSize)
+				length = mxDiffBufferSize;
+			if ((fread(files[0].buffer, length, 1, files[0].file) != 1) || (fread(files[1].buffer, length, 1, files[1].file) != 1)) {
+				*error = EIO;
+				return;
+			}
+			for (index = 0; !differs && (index < length); index++) {
+				if (files[0].buffer[index] != files[1].buffer[index]) {
+					diff = fxDiffRecord(atom, offset);
+					if (diff) {
+						diff->slots[0].value.integer = chunks[0].size;
+						diff->slots[1].value.integer = chunks[1].size;
+						diff->detail = position + index;
+					}
+					differs = 1;
+				}
+			}
+			position += length;
+		}
+		offset += chunkSize;
+	}
+	fxDiffSkip(files, size - offset, error);
+	fxDiffSkip(files + 1, size - offset, error);
+}
+
+txBoolean fxDiffKeyName(txDiffFile* file, txID id, char* name)
+{
+	txSlot* address;
+	txSlot key;
+	size_t length;
+	if ((id == XS_NO_ID) || !file->keys || !file->heap || ((txInteger)id < 0) || ((size_t)id >= file->keyCount))
+		return 0;
+	if (fseek(file->file, file->keys + (long)(id * sizeof(txSlot*)), SEEK_SET) || (fread(&address, sizeof(txSlot*), 1, file->file) != 1))
+		return 0;
+	if (!address || ((size_t)address > file->heapCount))
+		return 0;
+	if (fseek(file->file, file->heap + (long)(((size_t)address - 1) * sizeof(txSlot)), SEEK_SET) || (fread(&key, sizeof(txSlot), 1, file->file) != 1))
+		return 0;
+	// static strings are not in the snapshot
+	if ((key.kind != XS_KEY_KIND) || !key.value.key.string)
+		return 0;
+	if (fseek(file->file, file->block + (long)(size_t)key.value.key.string, SEEK_SET))
+		return 0;
+	length = fread(name, 1, mxDiffNameSize - 1, file->file);
+	name[length] = 0;
+	return 1;
+}
+
+size_t fxDiffOwner(txDiffFile* file, size_t address)
+{
+	// the instance at the head of the list the slot is in, or 0
+	txSlot slot;
+	size_t length = 0;
+	while (fxDiffReadSlot(file, address, &slot)) {
+		if (slot.kind == XS_INSTANCE_KIND)
+			return address;
+		if (++length > mxDiffOwnerLength)
+			break;
+		address = fxDiffScanSlots(file, address, 0, 0);
+	}
+	return 0;
+}
+
+void fxDiffPath(txDiffFile* file, size_t address, FILE* stream)
+{
+	char names[mxDiffPathLength][mxDiffNameSize];
+	size_t owners[mxDiffPathLength + 1];
+	size_t global = 0;
+	txSlot slot;
+	txInteger length = 0, index;
+	if (file->stack && file->stackCount) {
+		// mxGlobal is the top of the stack
+		if (!fseek(file->file, file->stack + (long)((file->stackCount - 1) * sizeof(txSlot)), SEEK_SET) && (fread(&slot, sizeof(txSlot), 1, file->file) == 1) && (slot.kind == XS_REFERENCE_KIND))
+			global = (size_t)slot.value.reference;
+	}
+	owners[0] = address;
+	while (global && (address != global) && (length < mxDiffPathLength)) {
+		// the first property that refers to the instance from an instance not on the path yet
+		size_t property = 0, owner = 0;
+		txInteger count = 0;
+		while ((count++ < mxDiffReferenceCount) && (property = fxDiffScanSlots(file, address, 1, property))) {
+			owner = fxDiffOwner(file, property);
+			for (index = 0; owner && (index <= length); index++) {
+				if (owners[index] == owner)
+					owner = 0;
+			}
+			if (owner)
+				break;
+		}
+		if (!owner || !fxDiffReadSlot(file, property, &slot))
+			break;
+		if (!fxDiffKeyName(file, slot.ID, names[length]))
+			c_strcpy(names[length], "?");
+		length++;
+		owners[length] = address = owner;
+	}
+	if (global && (address == global)) {
+		fprintf(stream, " globalThis");
+		while (length > 0)
+			fprintf(stream, ".%s", names[--length]);
+	}
+	else
+		fprintf(stream, " not reachable from globalThis");
+}
+
+txBoolean fxDiffReadSlot(txDiffFile* file, size_t address, txSlot* slot)
+{
+	// heap addresses start at 1, as in references
+	if (!address || (address > file->heapCount) || !file->heap)
+		return 0;
+	if (fseek(file->file, file->heap + (long)((address - 1) * sizeof(txSlot)), SEEK_SET) || (fread(slot, sizeof(txSlot), 1, file->file) != 1))
+		return 0;
+	return 1;
+}
+
+size_t fxDiffScanSlots(txDiffFile* file, size_t address, txBoolean reference, size_t from)
+{
+	// the first slot after from whose next is address, or the first property that refers to address
+	size_t count = mxDiffBufferSize / sizeof(txSlot), index = from;
+	if (!file->heap || fseek(file->file, file->heap + (long)(from * sizeof(txSlot)), SEEK_SET))
+		return 0;
+	while (index < file->heapCount) {
+		txSlot* slots = (txSlot*)file->buffer;
+		size_t length = file->heapCount - index, which;
+		if (length > count)
+			length = count;
+		if (fread(slots, sizeof(txSlot), length, file->file) != length)
+			return 0;
+		for (which = 0; which < length; which++) {
+			txSlot* slot = slots + which;
+			if (reference) {
+				if ((slot->kind == XS_REFERENCE_KIND) && (slot->ID != XS_NO_ID) && ((size_t)slot->value.reference == address))
+					return index + which + 1;
+			}
+			else if ((size_t)slot->next == address)
+				return index + which + 1;
+		}
+		index += length;
+	}
+	return 0;
+}
+
+txDiff* fxDiffRecord(txDiffAtom* atom, size_t offset)
+{
+	txDiff* diff = C_NULL;
+	if (atom->recorded < mxDiffCount) {
+		diff = atom->diffs + atom->recorded++;
+		diff->offset = offset;
+	}
+	atom->count++;
+	return diff;
+}
+
+void fxDiffSkip(txDiffFile* file, size_t size, int* error)
+{
+	while (!*error && size) {
+		size_t length = (size > mxDiffBufferSize) ? mxDiffBufferSize : size;
+		if (fread(file->buffer, length, 1, file->file) != 1)
+			*error = EIO;
+		size -= length;
+	}
+}
+
+void fxDiffSlots(txDiffFile* files, txDiffAtom* atom, size_t size, int* error)
+{
+	size_t count = size / sizeof(txSlot), index;
+	txSlot slots[2];
+	for (index = 0; index < count; index++) {
+		if ((fread(&slots[0], sizeof(txSlot), 1, files[0].file) != 1) || (fread(&slots[1], sizeof(txSlot), 1, files[1].file) != 1)) {
+			*error = EIO;
+			return;
+		}
+		if (c_memcmp(&slots[0], &slots[1], sizeof(txSlot))) {
+			txDiff* diff = fxDiffRecord(atom, index);
+			if (diff) {
+				diff->slots[0] = slots[0];
+				diff->slots[1] = slots[1];
+			}
+		}
+	}
+	fxDiffSkip(files, size - (count * sizeof(txSlot)), error);
+	fxDiffSkip(files + 1, size - (count * sizeof(txSlot)), error);
+}
+
+void fxDiffTable(txDiffFile* files, txDiffAtom* atom, size_t size, int* error)
+{
+	size_t count = size / sizeof(txSlot*), index;
+	txSlot* addresses[2];
+	for (index = 0; index < count; index++) {
+		if ((fread(&addresses[0], sizeof(txSlot*), 1, files[0].file) != 1) || (fread(&addresses[1], sizeof(txSlot*), 1, files[1].file) != 1)) {
+			*error = EIO;
+			return;
+		}
+		if (addresses[0] != addresses[1]) {
+			txDiff* diff = fxDiffRecord(atom, index);
+			if (diff) {
+				diff->slots[0].value.reference = addresses[0];
+				diff->slots[1].value.reference = addresses[1];
+			}
+		}
+	}
+	fxDiffSkip(files, size - (count * sizeof(txSlot*)), error);
+	fxDiffSkip(files + 1, size - (count * sizeof(txSlot*)), error);
+}
+
+void fxPrintDiffs(txDiffFile* files, txDiffAtom* atoms, txInteger atomCount, FILE* stream)
+{
+	char name[mxDiffNameSize];
+	txInteger index, which;
+	size_t recorded;
+	for (index = 0; index < atomCount; index++) {
+		txDiffAtom* atom = atoms + index;
+		char* type = atom->types[0];
+		if (c_strncmp(atom->types[0], atom->types[1], 4)) {
+			fprintf(stream, "%4.4s %d %4.4s %d different atoms\n", atom->types[0], atom->sizes[0], atom->types[1], atom->sizes[1]);
+			continue;
+		}
+		fprintf(stream, "%4.4s %d %d", type, atom->sizes[0], atom->sizes[1]);
+		if (atom->count)
+			fprintf(stream, " %zu difference%s", atom->count, (atom->count == 1) ? "" : "s");
+		fprintf(stream, "\n");
+		for (recorded = 0; recorded < atom->recorded; recorded++) {
+			txDiff* diff = atom->diffs + recorded;
+			if (!c_strncmp(type, "BLOC", 4)) {
+				fprintf(stream, "\t<%8.8zu> %8d %8d", diff->offset, diff->slots[0].value.integer, diff->slots[1].value.integer);
+				if (diff->slots[0].value.integer == diff->slots[1].value.integer)
+					fprintf(stream, " at %zu", diff->detail);
+				fprintf(stream, "\n");
+			}
+			else if (!c_strncmp(type, "HEAP", 4) || !c_strncmp(type, "STAC", 4)) {
+				// heap addresses start at 1, as in references
+				if (!c_strncmp(type, "HEAP", 4))
+					fprintf(stream, "\t[%8.8zu]\n", diff->offset + 1);
+				else
+					fprintf(stream, "\t %8.8zu\n", diff->offset);
+				for (which = 0; which < 2; which++) {
+					txSlot* slot = &diff->slots[which];
+					fprintf(stream, "\t\t");
+					fxDumpSlotAddress(stream, slot->next);
+					fprintf(stream, " ");
+					fxDumpSlot(stream, slot);
+					if (fxDiffKeyName(files + which, slot->ID, name))
+						fprintf(stream, " \"%s\"", name);
+					fprintf(stream, "\n");
+				}
+				if (!c_strncmp(type, "HEAP", 4) && !recorded) {
+					// where the heaps diverge, in both snapshots
+					for (which = 0; which < 2; which++) {
+						size_t owner = fxDiffOwner(files + which, diff->offset + 1);
+						fprintf(stream, "\t\tin ");
+						if (owner) {
+							fxDumpSlotAddress(stream, (void*)owner);
+							fxDiffPath(files + which, owner, stream);
+						}
+						else
+							fprintf(stream, "no instance");
+						fprintf(stream, "\n");
+					}
+				}
+			}
+			else if (!c_strncmp(type, "KEYS", 4) || !c_strncmp(type, "NAME", 4) || !c_strncmp(type, "SYMB", 4)) {
+				fprintf(stream, "\t%6.6zu ", diff->offset);
+				fxDumpSlotAddress(stream, diff->slots[0].value.reference);
+				fprintf(stream, " ");
+				fxDumpSlotAddress(stream, diff->slots[1].value.reference);
+				if (!c_strncmp(type, "KEYS", 4)) {
+					for (which = 0; which < 2; which++) {
+						if (fxDiffKeyName(files + which, (txID)diff->offset, name))
+							fprintf(stream, " \"%s\"", name);
+					}
+				}
+				fprintf(stream, "\n");
+			}
+			else
+				fprintf(stream, "\tat %zu\n", diff->offset);
+		}
+	}
+}
+
+// Snapshot index: an INDX atom, after the XS_M container, gives the type,
+// the offset and the size of every atom, as big-endian 32-bit type and
+// 64-bit offset and size. A copy of its header ends the INDX atom, so
+// readers find it from the end of the file. XS reads the container and
+// ignores what follows. Writers feed fxIndexSnapshot with the bytes they
+// write, then write the index with fxWriteSnapshotIndex. Without an index,
+// fxReadSnapshotIndex seeks from atom header to atom header.
+
+#define mxSnapshotIndexEntrySize 20
+#define mxSnapshotIndexLength 16
+
+// same layouts as xsSnapshotAtom and xsSnapshotIndex in xsnap.h
+typedef struct sxSnapshotAtom txSnapshotAtom;
+typedef struct sxSnapshotIndex txSnapshotIndex;
+
+struct sxSnapshotAtom {
+	char type[4];
+	size_t offset;
+	size_t size;
+};
+
+struct sxSnapshotIndex {
+	txSnapshotAtom atoms[mxSnapshotIndexLength];
+	txInteger count;
+	txBoolean indexed;
+	size_t position;
+	size_t next;
+	txByte header[8];
+	txInteger headerLength;
+};
+
+extern void fxIndexSnapshot(txSnapshotIndex* index, void* address, size_t size);
+extern int fxWriteSnapshotIndex(txSnapshotIndex* index, int (*write)(void* stream, void* address, size_t size), void* stream);
+extern int fxReadSnapshotIndex(void* stream, txSnapshotIndex* index);
+extern txSnapshotAtom* fxFindSnapshotAtom(txSnapshotIndex* index, txString type);
+extern int fxReadSnapshotAtom(void* stream, txSnapshotAtom* atom, size_t offset, void* buffer, size_t size);
+
+static void fxReadSnapshotIndexEntry(txSnapshotAtom* atom, txByte* buffer);
+static int fxScanSnapshotIndex(FILE* file, txSnapshotIndex* index);
+
+static txU4 fxSnapshotIndexRead4(txByte* buffer)
+{
+	return ((txU4)buffer[0] << 24) | ((txU4)buffer[1] << 16) | ((txU4)buffer[2] << 8) | (txU4)buffer[3];
+}
+
+static void fxSnapshotIndexWrite4(txByte* buffer, txU4 value)
+{
+	buffer[0] = (txByte)(value >> 24);
+	buffer[1] = (txByte)(value >> 16);
+	buffer[2] = (txByte)(value >> 8);
+	buffer[3] = (txByte)value;
+}
+
+void fxIndexSnapshot(txSnapshotIndex* index, void* address, size_t size)
+{
+	txByte* p = address;
+	txByte* q = p + size;
+	while (p < q) {
+		if (index->position < index->next) {
+			size_t skip = index->next - index->position;
+			if (skip > (size_t)(q - p))
+				skip = q - p;
+			p += skip;
+			index->position += skip;
+			continue;
+		}
+		index->header[index->headerLength++] = *p++;
+		index->position++;
+		if (index->headerLength == 8) {
+			txSnapshotAtom* atom = &index->atoms[index->count];
+			c_memcpy(atom->type, index->header + 4, 4);
+			atom->offset = index->position - 8;
+			atom->size = fxSnapshotIndexRead4(index->header);
+			index->headerLength = 0;
+			index->count++;
+			if ((index->count == mxSnapshotIndexLength) || (atom->size < 8))
+				index->next = (size_t)-1;
+			else if (index->count == 1)
+				index->next = index->position; // XS_M, the container
+			else if (atom->offset + atom->size >= index->atoms[0].offset + index->atoms[0].size)
+				index->next = (size_t)-1;
+			else
+				index->next = atom->offset + atom->size;
+		}
+	}
+}
+
+int fxWriteSnapshotIndex(txSnapshotIndex* index, int (*write)(void* stream, void* address, size_t size), void* stream)
+{
+	size_t size = 8 + (index->count * mxSnapshotIndexEntrySize) + 8;
+	txByte* buffer;
+	txByte* p;
+	txInteger i;
+	int error;
+	if ((index->count == 0) || (index->headerLength != 0))
+		return EINVAL;
+	buffer = c_malloc(size);
+	if (!buffer)
+		return ENOMEM;
+	p = buffer;
+	fxSnapshotIndexWrite4(p, (txU4)size);
+	c_memcpy(p + 4, "INDX", 4);
+	p += 8;
+	for (i = 0; i < index->count; i++) {
+		txSnapshotAtom* atom = &index->atoms[i];
+		c_memcpy(p, atom->type, 4);
+		fxSnapshotIndexWrite4(p + 4, (txU4)((txU8)atom->offset >> 32));
+		fxSnapshotIndexWrite4(p + 8, (txU4)atom->offset);
+		fxSnapshotIndexWrite4(p + 12, (txU4)((txU8)atom->size >> 32));
+		fxSnapshotIndexWrite4(p + 16, (txU4)atom->size);
+		p += mxSnapshotIndexEntrySize;
+	}
+	c_memcpy(p, buffer, 8);
+	error = (*write)(stream, buffer, size);
+	c_free(buffer);
+	return error;
+}
+
+int fxReadSnapshotIndex(void* stream, txSnapshotIndex* index)
+{
+	FILE* file = stream;
+	txByte footer[8];
+	txByte* buffer = C_NULL;
+	size_t size, count;
+	long end;
+	int error = 0;
+	c_memset(index, 0, sizeof(txSnapshotIndex));
+	if (fseek(file, 0, SEEK_END) || ((end = ftell(file)) < 0))
+		return errno;
+	if ((end < 16) || fseek(file, -8, SEEK_END) || (fread(footer, 8, 1, file) != 1) || c_memcmp(footer + 4, "INDX", 4))
+		return fxScanSnapshotIndex(file, index);
+	size = fxSnapshotIndexRead4(footer);
+	count = (size - 16) / mxSnapshotIndexEntrySize;
+	if ((size < 16 + mxSnapshotIndexEntrySize) || ((long)size > end) || ((size - 16) % mxSnapshotIndexEntrySize) || (count > mxSnapshotIndexLength))
+		return fxScanSnapshotIndex(file, index);
+	buffer = c_malloc(size);
+	if (!buffer)
+		return ENOMEM;
+	if (fseek(file, end - (long)size, SEEK_SET) || (fread(buffer, size, 1, file) != 1))
+		error = ferror(file) ? errno : EINVAL;
+	else if (c_memcmp(buffer, footer, 8))
+		error = fxScanSnapshotIndex(file, index);
+	else {
+		txByte* p = buffer + 8;
+		for (index->count = 0; index->count < (txInteger)count; index->count++) {
+			fxReadSnapshotIndexEntry(&index->atoms[index->count], p);
+			p += mxSnapshotIndexEntrySize;
+		}
+		index->indexed = 1;
+	}
+	c_free(buffer);
+	return error;
+}
+
+void fxReadSnapshotIndexEntry(txSnapshotAtom* atom, txByte* buffer)
+{
+	c_memcpy(atom->type, buffer, 4);
+	atom->offset = (size_t)(((txU8)fxSnapshotIndexRead4(buffer + 4) << 32) | fxSnapshotIndexRead4(buffer + 8));
+	atom->size = (size_t)(((txU8)fxSnapshotIndexRead4(buffer + 12) << 32) | fxSnapshotIndexRead4(buffer + 16));
+}
+
+int fxScanSnapshotIndex(FILE* file, txSnapshotIndex* index)
+{
+	txByte header[8];
+	size_t offset = 0, end = 8;
+	clearerr(file);
+	if (fseek(file, 0, SEEK_SET))
+		return errno;
+	index->count = 0;
+	index->indexed = 0;
+	while ((offset < end) && (index->count < mxSnapshotIndexLength)) {
+		txSnapshotAtom* atom = &index->atoms[index->count];
+		if (fread(header, 8, 1, file) != 1)
+			return ferror(file) ? errno : EINVAL;
+		c_memcpy(atom->type, header + 4, 4);
+		atom->offset = offset;
+		atom->size = fxSnapshotIndexRead4(header);
+		if (atom->size < 8)
+			return EINVAL;
+		index->count++;
+		if (index->count == 1) {
+			// XS_M, the container
+			end = atom->size;
+			offset = 8;
+		}
+		else {
+			offset += atom->size;
+			if (fseek(file, (long)offset, SEEK_SET))
+				return errno;
+		}
+	}
+	return 0;
+}
+
+txSnapshotAtom* fxFindSnapshotAtom(txSnapshotIndex* index, txString type)
+{
+	txInteger i;
+	for (i = 1; i < index->count; i++) {
+		if (!c_strncmp(index->atoms[i].type, type, 4))
+			return &index->atoms[i];
+	}
+	return C_NULL;
+}
+
+int fxReadSnapshotAtom(void* stream, txSnapshotAtom* atom, size_t offset, void* buffer, size_t size)
+{
+	FILE* file = stream;
+	if ((atom->size < 8) || (offset > atom->size - 8) || (size > atom->size - 8 - offset))
+		return EINVAL;
+	if (size == 0)
+		return 0;
+	clearerr(file);
+	if (fseek(file, (long)(atom->offset + 8 + offset), SEEK_SET))
+		return errno;
+	if (fread(buffer, size, 1, file) != 1)
+		return ferror(file) ? errno : EINVAL;
+	return 0;
+}
+
+// Heap census: counts and shallow bytes of instances by kind and by
+// constructor, strings, the largest strings and arrays, and keys, as JSON.
+// The same walker reads a live machine and a snapshot. In a snapshot, slot
+// addresses are offsets in the HEAP atom and chunk addresses are offsets in
+// the BLOC atom. Strings are shared, so they are counted once, in strings,
+// and not in the bytes of the instances that reference them.
+
+#define mxCensusTop 10
+#define mxCensusConstructors 100
+#define mxCensusPreview 64
+
+#define mxCensusSlot(CENSUS, SLOT) ((CENSUS)->heap ? (CENSUS)->heap + (size_t)(SLOT) : (txSlot*)(SLOT))
+#define mxCensusChunk(CENSUS, ADDRESS) ((CENSUS)->block ? (CENSUS)->block + (size_t)(ADDRESS) : (txByte*)(ADDRESS))
+#define mxCensusChunkSize(DATA) ((size_t)(((txChunk*)((DATA) - sizeof(txChunk)))->size))
+// neither an address nor an offset
+#define mxCensusNullPrototype ((void*)~(size_t)0)
+
+enum {
+	mxCensusObject = 0,
+	mxCensusArguments,
+	mxCensusArray,
+	mxCensusArrayBuffer,
+	mxCensusBigInt,
+	mxCensusBoolean,
+	mxCensusDataView,
+	mxCensusDate,
+	mxCensusError,
+	mxCensusFinalizationRegistry,
+	mxCensusFunction,
+	mxCensusGlobal,
+	mxCensusHost,
+	mxCensusMap,
+	mxCensusModule,
+	mxCensusNumber,
+	mxCensusPromise,
+	mxCensusProxy,
+	mxCensusRegExp,
+	mxCensusSet,
+	mxCensusString,
+	mxCensusSymbol,
+	mxCensusTypedArray,
+	mxCensusWeakMap,
+	mxCensusWeakRef,
+	mxCensusWeakSet,
+	mxCensusKindCount
+};
+
+static char* gxCensusKindNames[mxCensusKindCount] = {
+	"Object",
+	"Arguments",
+	"Array",
+	"ArrayBuffer",
+	"BigInt",
+	"Boolean",
+	"DataView",
+	"Date",
+	"Error",
+	"FinalizationRegistry",
+	"Function",
+	"Global",
+	"Host",
+	"Map",
+	"Module",
+	"Number",
+	"Promise",
+	"Proxy",
+	"RegExp",
+	"Set",
+	"String",
+	"Symbol",
+	"TypedArray",
+	"WeakMap",
+	"WeakRef",
+	"WeakSet",
+};
+
+typedef struct sxCensus txCensus;
+typedef struct sxCensusEntry txCensusEntry;
+typedef struct sxCensusItem txCensusItem;
+typedef struct sxCensusTable txCensusTable;
+
+struct sxCensusEntry {
+	void* key;
+	size_t count;
+	size_t bytes;
+};
+
+struct sxCensusItem {
+	void* address;
+	size_t weight;
+	size_t bytes;
+	txSlot* prototype;
+};
+
+struct sxCensusTable {
+	txCensusEntry* entries;
+	size_t count;
+	size_t size;
+};
+
+struct sxCensus {
+	txMachine* the;
+	txSlot* heap;
+	txByte* block;
+	txSlot** keys;
+	txInteger keyCount;
+	int error;
+	size_t slotCount;
+	size_t chunksSize;
+	txCensusEntry kinds[mxCensusKindCount];
+	txCensusTable constructors;
+	txCensusTable strings;
+	size_t stringsSize;
+	txCensusItem largestStrings[mxCensusTop];
+	txCensusItem largestArrays[mxCensusTop];
+	size_t keysCount;
+	size_t keysSize;
+};
+
+static void fxCensusArray(txCensus* census, txSlot* property);
+static size_t fxCensusChunks(txCensus* census, txSlot* property);
+static txString fxCensusConstructorName(txCensus* census, txSlot* prototype);
+static txCensusEntry* fxCensusEntry(txCensus* census, txCensusTable* table, void* key);
+static void fxCensusHeap(txCensus* census, txSlot* slot, txSlot* limit);
+static void fxCensusInstance(txCensus* census, txSlot* instance);
+static txInteger fxCensusKind(txCensus* census, txSlot* instance);
+static txString fxCensusKeyName(txCensus* census, txID id);
+static void fxCensusKeys(txCensus* census, txSlot** keys, txInteger count);
+static void fxCensusRank(txCensusItem* items, void* address, size_t weight, size_t bytes, txSlot* prototype);
+static void fxCensusString(txCensus* census, txString address);
+static int fxCompareCensusEntries(const void* p, const void* q);
+static void fxDeleteCensus(txCensus* census);
+static int fxPrintCensus(txCensus* census, FILE* stream);
+static void fxPrintCensusString(FILE* stream, txString string, size_t limit);
+
+int fxWriteHeapCensus(txMachine* the, void* stream)
+{
+	txCensus census;
+	txSlot* heap;
+	int error;
+	c_memset(&census, 0, sizeof(txCensus));
+	census.the = the;
+	fxCollectGarbage(the);
+	census.slotCount = the->currentHeapCount;
+	census.chunksSize = the->currentChunksSize;
+	heap = the->firstHeap;
+	while (heap) {
+		fxCensusHeap(&census, heap + 1, heap->value.reference);
+		heap = heap->next;
+	}
+	fxCensusKeys(&census, the->keyArray, the->keyIndex);
+	error = census.error;
+	if (!error)
+		error = fxPrintCensus(&census, stream);
+	fxDeleteCensus(&census);
+	return error;
+}
+
+void fxCensusSnapshot(txMachine* the, txSnapshot* snapshot, void* stream)
+{
+	Atom atom;
+	txCensus census;
+	txByte* buffer = C_NULL;
+	txSize size;
+	txInteger index;
+
+	c_memset(&census, 0, sizeof(txCensus));
+	census.the = the;
+	mxTry(the) {
+		// XS_M, then VERS, SIGN and CREA, which the census does not need
+		mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+		for (index = 0; index < 3; index++) {
+			mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+			size = ntohl(atom.atomSize) - 8;
+			buffer = c_malloc(size + 1);
+			mxThrowIf(buffer == C_NULL);
+			mxThrowIf((*snapshot->read)(snapshot->stream, buffer, size));
+			c_free(buffer);
+			buffer = C_NULL;
+		}
+
+		mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+		size = ntohl(atom.atomSize) - 8;
+		census.block = c_malloc(size + 1);
+		mxThrowIf(census.block == C_NULL);
+		mxThrowIf((*snapshot->read)(snapshot->stream, census.block, size));
+		census.chunksSize = size;
+
+		// slot offsets start at 1
+		mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+		size = ntohl(atom.atomSize) - 8;
+		census.heap = c_malloc(sizeof(txSlot) + size);
+		mxThrowIf(census.heap == C_NULL);
+		c_memset(census.heap, 0, sizeof(txSlot));
+		mxThrowIf((*snapshot->read)(snapshot->stream, census.heap + 1, size));
+		census.slotCount = size / sizeof(txSlot);
+
+		mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+		size = ntohl(atom.atomSize) - 8;
+		buffer = c_malloc(size + 1);
+		mxThrowIf(buffer == C_NULL);
+		mxThrowIf((*snapshot->read)(snapshot->stream, buffer, size));
+		c_free(buffer);
+		buffer = C_NULL;
+
+		mxThrowIf((*snapshot->read)(snapshot->stream, &atom, sizeof(Atom)));
+		size = ntohl(atom.atomSize) - 8;
+		census.keys = c_malloc(size + 1);
+		mxThrowIf(census.keys == C_NULL);
+		mxThrowIf((*snapshot->read)(snapshot->stream, census.keys, size));
+		census.keyCount = size / sizeof(txSlot*);
+
+		fxCensusHeap(&census, census.heap + 1, census.heap + 1 + census.slotCount);
+		fxCensusKeys(&census, census.keys, census.keyCount);
+		mxThrowIf(census.error);
+		mxThrowIf(fxPrintCensus(&census, stream));
+		fxDeleteCensus(&census);
+	}
+	mxCatch(the) {
+		if (buffer)
+			c_free(buffer);
+		fxDeleteCensus(&census);
+	}
+}
+
+void fxCensusArray(txCensus* census, txSlot* property)
+{
+	// strings in array items are not heap slots
+	txByte* data;
+	txSlot* item;
+	size_t count;
+	if (!property->value.array.address)
+		return;
+	data = mxCensusChunk(census, property->value.array.address);
+	item = (txSlot*)data;
+	count = (mxCensusChunkSize(data) - sizeof(txChunk)) / sizeof(txSlot);
+	while (count) {
+		if (item->kind == XS_STRING_KIND)
+			fxCensusString(census, item->value.string);
+		count--;
+		item++;
+	}
+}
+
+size_t fxCensusChunks(txCensus* census, txSlot* property)
+{
+	size_t size = 0;
+	switch (property->kind) {
+	case XS_ARGUMENTS_SLOPPY_KIND:
+	case XS_ARGUMENTS_STRICT_KIND:
+	case XS_ARRAY_KIND:
+	case XS_STACK_KIND:
+		if (property->value.array.address) {
+			size = mxCensusChunkSize(mxCensusChunk(census, property->value.array.address));
+			fxCensusArray(census, property);
+		}
+		break;
+	case XS_ARRAY_BUFFER_KIND:
+		if (property->value.arrayBuffer.address)
+			size = mxCensusChunkSize(mxCensusChunk(census, property->value.arrayBuffer.address));
+		break;
+	case XS_BIGINT_KIND:
+		if (property->value.bigint.data)
+			size = mxCensusChunkSize(mxCensusChunk(census, property->value.bigint.data));
+		break;
+	case XS_CODE_KIND:
+		size = mxCensusChunkSize(mxCensusChunk(census, property->value.code.address));
+		break;
+	case XS_GLOBAL_KIND:
+	case XS_MAP_KIND:
+	case XS_SET_KIND:
+		size = mxCensusChunkSize(mxCensusChunk(census, property->value.table.address));
+		break;
+	case XS_HOST_KIND:
+		if (property->value.host.data && (property->flag & XS_HOST_CHUNK_FLAG))
+			size = mxCensusChunkSize(mxCensusChunk(census, property->value.host.data));
+		break;
+	case XS_REGEXP_KIND:
+		if (property->value.regexp.code)
+			size += mxCensusChunkSize(mxCensusChunk(census, property->value.regexp.code));
+		if (property->value.regexp.data)
+			size += mxCensusChunkSize(mxCensusChunk(census, property->value.regexp.data));
+		break;
+	default:
+		break;
+	}
+	return size;
+}
+
+txString fxCensusConstructorName(txCensus* census, txSlot* prototype)
+{
+	txSlot* address = mxCensusSlot(census, prototype)->next;
+	while (address) {
+		txSlot* property = mxCensusSlot(census, address);
+		if ((property->ID == mxID(_constructor)) && (property->kind == XS_REFERENCE_KIND)) {
+			txSlot* function = mxCensusSlot(census, property->value.reference);
+			txString name = C_NULL;
+			if (function->next)
+				name = fxCensusKeyName(census, mxCensusSlot(census, function->next)->ID);
+			return (name && *name) ? name : C_NULL;
+		}
+		address = property->next;
+	}
+	return C_NULL;
+}
+
+txCensusEntry* fxCensusEntry(txCensus* census, txCensusTable* table, void* key)
+{
+	// open addressing, at most half full
+	txCensusEntry* entry;
+	size_t mask, index;
+	if (2 * (table->count + 1) > table->size) {
+		size_t size = table->size ? 2 * table->size : 1024;
+		txCensusEntry* entries = c_calloc(size, sizeof(txCensusEntry));
+		if (!entries) {
+			census->error = ENOMEM;
+			return C_NULL;
+		}
+		for (index = 0; index < table->size; index++) {
+			entry = table->entries + index;
+			if (entry->key) {
+				size_t slot = ((size_t)entry->key * 2654435761u) & (size - 1);
+				while (entries[slot].key)
+					slot = (slot + 1) & (size - 1);
+				entries[slot] = *entry;
+			}
+		}
+		c_free(table->entries);
+		table->entries = entries;
+		table->size = size;
+	}
+	mask = table->size - 1;
+	index = ((size_t)key * 2654435761u) & mask;
+	for (;;) {
+		entry = table->entries + index;
+		if (entry->key == key)
+			return entry;
+		if (!entry->key) {
+			entry->key = key;
+			table->count++;
+			return entry;
+		}
+		index = (index + 1) & mask;
+	}
+}
+
+void fxCensusHeap(txCensus* census, txSlot* slot, txSlot* limit)
+{
+	while (slot < limit) {
+		if (slot->kind == XS_INSTANCE_KIND)
+			fxCensusInstance(census, slot);
+		else if (slot->kind == XS_STRING_KIND)
+			fxCensusString(census, slot->value.string);
+		slot++;
+	}
+}
+
+void fxCensusInstance(txCensus* census, txSlot* instance)
+{
+	txInteger kind = fxCensusKind(census, instance);
+	txSlot* prototype = instance->value.instance.prototype;
+	txSlot* address = instance->next;
+	size_t bytes = sizeof(txSlot);
+	txCensusEntry* entry;
+	while (address) {
+		txSlot* property = mxCensusSlot(census, address);
+		bytes += sizeof(txSlot) + fxCensusChunks(census, property);
+		address = property->next;
+	}
+	census->kinds[kind].count++;
+	census->kinds[kind].bytes += bytes;
+	entry = fxCensusEntry(census, &census->constructors, prototype ? (void*)prototype : mxCensusNullPrototype);
+	if (entry) {
+		entry->count++;
+		entry->bytes += bytes;
+	}
+	if (kind == mxCensusArray) {
+		txSlot* array = mxCensusSlot(census, instance->next);
+		fxCensusRank(census->largestArrays, instance, array->value.array.length, bytes, prototype);
+	}
+}
+
+txInteger fxCensusKind(txCensus* census, txSlot* instance)
+{
+	txSlot* property;
+	if (!instance->next)
+		return mxCensusObject;
+	property = mxCensusSlot(census, instance->next);
+	switch (property->kind) {
+	case XS_ARGUMENTS_SLOPPY_KIND:
+	case XS_ARGUMENTS_STRICT_KIND: return mxCensusArguments;
+	case XS_ARRAY_KIND: return mxCensusArray;
+	case XS_ARRAY_BUFFER_KIND: return mxCensusArrayBuffer;
+	case XS_CALLBACK_KIND:
+	case XS_CALLBACK_X_KIND:
+	case XS_CODE_KIND:
+	case XS_CODE_X_KIND: return mxCensusFunction;
+	case XS_DATA_VIEW_KIND: return mxCensusDataView;
+	case XS_DATE_KIND: return mxCensusDate;
+	case XS_ERROR_KIND: return mxCensusError;
+	case XS_FINALIZATION_REGISTRY_KIND: return mxCensusFinalizationRegistry;
+	case XS_GLOBAL_KIND: return mxCensusGlobal;
+	case XS_HOST_KIND: return mxCensusHost;
+	case XS_MAP_KIND: return mxCensusMap;
+	case XS_MODULE_KIND:
+	case XS_PROGRAM_KIND: return mxCensusModule;
+	case XS_PROMISE_KIND: return mxCensusPromise;
+	case XS_PROXY_KIND: return mxCensusProxy;
+	case XS_REGEXP_KIND: return mxCensusRegExp;
+	case XS_SET_KIND: return mxCensusSet;
+	case XS_TYPED_ARRAY_KIND: return mxCensusTypedArray;
+	case XS_WEAK_MAP_KIND: return mxCensusWeakMap;
+	case XS_WEAK_REF_KIND: return mxCensusWeakRef;
+	case XS_WEAK_SET_KIND: return mxCensusWeakSet;
+	default: break;
+	}
+	// primitive wrappers, not ordinary properties with primitive values
+	if (property->flag & XS_INTERNAL_FLAG) {
+		switch (property->kind) {
+		case XS_BIGINT_KIND: return mxCensusBigInt;
+		case XS_BOOLEAN_KIND: return mxCensusBoolean;
+		case XS_INTEGER_KIND:
+		case XS_NUMBER_KIND: return mxCensusNumber;
+		case XS_STRING_KIND:
+		case XS_STRING_X_KIND: return mxCensusString;
+		case XS_SYMBOL_KIND: return mxCensusSymbol;
+		default: break;
+		}
+	}
+	return mxCensusObject;
+}
+
+txString fxCensusKeyName(txCensus* census, txID id)
+{
+	txSlot* key;
+	if (id == XS_NO_ID)
+		return C_NULL;
+	if (!census->heap)
+		return fxGetKeyName(census->the, id);
+	if (((txInteger)id < 0) || ((txInteger)id >= census->keyCount) || !census->keys[id])
+		return C_NULL;
+	key = mxCensusSlot(census, census->keys[id]);
+	// static strings are not in the snapshot
+	if ((key->kind != XS_KEY_KIND) || !key->value.key.string)
+		return C_NULL;
+	return (txString)mxCensusChunk(census, key->value.key.string);
+}
+
+void fxCensusKeys(txCensus* census, txSlot** keys, txInteger count)
+{
+	txInteger index;
+	for (index = 0; index < count; index++) {
+		txSlot* key;
+		if (!keys[index])
+			continue;
+		key = mxCensusSlot(census, keys[index]);
+		census->keysCount++;
+		if ((key->kind == XS_KEY_KIND) && key->value.key.string)
+			census->keysSize += mxCensusChunkSize(mxCensusChunk(census, key->value.key.string));
+	}
+}
+
+void fxCensusRank(txCensusItem* items, void* address, size_t weight, size_t bytes, txSlot* prototype)
+{
+	txInteger index = mxCensusTop - 1;
+	if (weight <= items[index].weight)
+		return;
+	while ((index > 0) && (weight > items[index - 1].weight)) {
+		items[index] = items[index - 1];
+		index--;
+	}
+	items[index].address = address;
+	items[index].weight = weight;
+	items[index].bytes = bytes;
+	items[index].prototype = prototype;
+}
+
+void fxCensusString(txCensus* census, txString address)
+{
+	txCensusEntry* entry;
+	size_t bytes;
+	txString string;
+	if (!address)
+		return;
+	entry = fxCensusEntry(census, &census->strings, address);
+	if (!entry || entry->count++)
+		return;
+	string = (txString)mxCensusChunk(census, address);
+	bytes = mxCensusChunkSize((txByte*)string);
+	census->stringsSize += bytes;
+	fxCensusRank(census->largestStrings, string, bytes, bytes, C_NULL);
+}
+
+int fxCompareCensusEntries(const void* p, const void* q)
+{
+	size_t a = ((txCensusEntry*)p)->bytes;
+	size_t b = ((txCensusEntry*)q)->bytes;
+	return (a > b) ? -1 : (a < b) ? 1 : 0;
+}
+
+void fxDeleteCensus(txCensus* census)
+{
+	c_free(census->constructors.entries);
+	c_free(census->strings.entries);
+	// only set for a snapshot
+	c_free(census->keys);
+	c_free(census->heap);
+	c_free(census->block);
+	c_memset(census, 0, sizeof(txCensus));
+}
+
+int fxPrintCensus(txCensus* census, FILE* stream)
+{
+	txCensusTable* constructors = &census->constructors;
+	txCensusEntry* entry;
+	txInteger index;
+	size_t count = 0, size;
+	txBoolean first = 1;
+	fprintf(stream, "{\"heap\":{\"slots\":%zu,\"slotBytes\":%zu,\"chunkBytes\":%zu},\"kinds\":{",
+		census->slotCount, census->slotCount * sizeof(txSlot), census->chunksSize);
+	for (index = 0; index < mxCensusKindCount; index++) {
+		entry = census->kinds + index;
+		if (!entry->count)
+			continue;
+		fprintf(stream, "%s\"%s\":{\"count\":%zu,\"bytes\":%zu}", first ? "" : ",", gxCensusKindNames[index], entry->count, entry->bytes);
+		first = 0;
+	}
+	fprintf(stream, "},\"constructors\":[");
+	for (size = 0; size < constructors->size; size++) {
+		if (constructors->entries[size].key)
+			constructors->entries[count++] = constructors->entries[size];
+	}
+	c_qsort(constructors->entries, count, sizeof(txCensusEntry), fxCompareCensusEntries);
+	if (count > mxCensusConstructors)
+		count = mxCensusConstructors;
+	for (size = 0; size < count; size++) {
+		entry = constructors->entries + size;
+		fprintf(stream, "%s{\"name\":", size ? "," : "");
+		if (entry->key == mxCensusNullPrototype)
+			fprintf(stream, "\"(null prototype)\"");
+		else
+			fxPrintCensusString(stream, fxCensusConstructorName(census, entry->key), mxCensusPreview);
+		fprintf(stream, ",\"count\":%zu,\"bytes\":%zu}", entry->count, entry->bytes);
+	}
+	fprintf(stream, "],\"strings\":{\"count\":%zu,\"bytes\":%zu,\"largest\":[", census->strings.count, census->stringsSize);
+	for (index = 0; (index < mxCensusTop) && census->largestStrings[index].weight; index++) {
+		txCensusItem* item = census->largestStrings + index;
+		fprintf(stream, "%s{\"length\":%zu,\"bytes\":%zu,\"value\":", index ? "," : "", c_strlen(item->address), item->bytes);
+		fxPrintCensusString(stream, item->address, mxCensusPreview);
+		fprintf(stream, "}");
+	}
+	fprintf(stream, "]},\"arrays\":{\"largest\":[");
+	for (index = 0; (index < mxCensusTop) && census->largestArrays[index].weight; index++) {
+		txCensusItem* item = census->largestArrays + index;
+		fprintf(stream, "%s{\"length\":%zu,\"bytes\":%zu,\"constructor\":", index ? "," : "", item->weight, item->bytes);
+		if (item->prototype)
+			fxPrintCensusString(stream, fxCensusConstructorName(census, item->prototype), mxCensusPreview);
+		else
+			fprintf(stream, "\"(null prototype)\"");
+		fprintf(stream, "}");
+	}
+	fprintf(stream, "]},\"keys\":{\"count\":%zu,\"bytes\":%zu}}\n", census->keysCount, census->keysSize);
+	if (ferror(stream))
+		return errno ? errno : EIO;
+	return 0;
+}
+
+void fxPrintCensusString(FILE* stream, txString string, size_t limit)
+{
+	size_t length;
+	if (!string) {
+		fprintf(stream, "\"(anonymous)\"");
+		return;
+	}
+	length = c_strlen(string);
+	if (length > limit) {
+		// do not cut a UTF-8 sequence
+		length = limit;
+		while ((length > 0) && ((string[length] & 0xC0) == 0x80))
+			length--;
+	}
+	fputc('"', stream);
+	while (length--) {
+		unsigned char c = (unsigned char)*string++;
+		if ((c == '"') || (c == '\\'))
+			fprintf(stream, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(stream, "\\u%04x", c);
+		else
+			fputc(c, stream);
+	}
+	fputc('"', stream);
+}
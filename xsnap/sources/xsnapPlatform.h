@@ -78,7 +78,10 @@
 	void* waiterData; \
 	void* waiterLink; \
 	size_t allocationLimit; \
-	size_t allocatedSpace;
+	size_t allocatedSpace; \
+	size_t committedSpace; \
+	void* releasedChunks; \
+	void* computronProfile;
 #else
 #define mxMachinePlatform \
 	txSocket connection; \
@@ -89,7 +92,10 @@
 	void* waiterData; \
 	void* waiterLink; \
 	size_t allocationLimit; \
-	size_t allocatedSpace;
+	size_t allocatedSpace; \
+	size_t committedSpace; \
+	void* releasedChunks; \
+	void* computronProfile;
 #endif
 
 #define mxUseDefaultBuildKeys 1
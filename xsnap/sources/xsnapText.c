@@ -0,0 +1,555 @@
+#include "xsnap.h"
+#include "xsmc.h"
+#include <pthread.h>
+
+// TextDecoder.prototype.decode and TextEncoder.prototype.encode, with SSE4.1,
+// AVX2 and NEON scanners. Like Base64, the objects are still installed by the
+// modules, then the functions are replaced, at the same callback indices.
+//
+// XS strings are CESU-8: characters outside the BMP are surrogate pairs of
+// 3 bytes each, and U+0000 is C0 80. So most valid UTF-8 is already an XS
+// string, and most XS strings are already UTF-8. The scanners validate
+// blocks of 16 or 32 bytes at once, skipping runs of ASCII, then the bytes
+// are copied in bulk, and only 4-byte sequences and surrogate pairs are
+// converted one by one.
+//
+// Only the common cases take that path: decoding valid UTF-8 without BOM or
+// U+0000, without options and without bytes left by a streaming call, and
+// encoding a string without U+0000 or lone surrogates. Everything else,
+// including every error in fatal mode, is handed to the module functions,
+// so results are the same. Neither version meters by size.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define mxTextX86 1
+	#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+	#define mxTextNEON 1
+	#include <arm_neon.h>
+#endif
+#ifndef mxTextX86
+	#define mxTextX86 0
+#endif
+#ifndef mxTextNEON
+	#define mxTextNEON 0
+#endif
+
+extern void xs_textdecoder_decode(xsMachine *the);
+extern void xs_textencoder_encode(xsMachine *the);
+extern void modInstallTextDecoder(xsMachine *the);
+extern void modInstallTextEncoder(xsMachine *the);
+extern void* fxGetHostChunkOfSize(xsMachine* the, xsSlot* slot, xsDestructor destructor, xsIntegerValue size);
+
+void fxInstallText(xsMachine* the);
+void xsnap_textdecoder_decode(xsMachine* the);
+void xsnap_textencoder_encode(xsMachine* the);
+
+// mirrors modTextDecoderRecord in textdecoder.c
+typedef struct {
+	uint8_t ignoreBOM;
+	uint8_t fatal;
+	uint8_t bufferLength;
+	uint8_t buffer[12];
+} txTextDecoderRecord;
+
+// The decoding scanners validate UTF-8 from the start, block by block, and
+// return how many bytes they accepted, stopping before a block with an
+// error or U+0000. They count the bytes of 4-byte sequences in *wide. The
+// encoding scanners return the offset of the first C0 or ED byte.
+typedef size_t (*txUTF8Scanner)(const uint8_t* src, size_t size, size_t* wide);
+typedef size_t (*txCESU8Scanner)(const uint8_t* src, size_t size);
+
+static void fxTextInitialize(void);
+static size_t fxScanCESU8Scalar(const uint8_t* src, size_t size);
+static size_t fxScanUTF8Scalar(const uint8_t* src, size_t size, size_t* wide);
+static int fxValidateUTF8(const uint8_t* src, size_t size, size_t* wide);
+
+static txUTF8Scanner gxUTF8Scanner = NULL;
+static txCESU8Scanner gxCESU8Scanner = NULL;
+// the scanners are chosen once for all the machines, whatever their threads
+static pthread_once_t gxTextOnce = PTHREAD_ONCE_INIT;
+
+void fxInstallText(xsMachine* the)
+{
+	modInstallTextDecoder(the);
+	modInstallTextEncoder(the);
+	xsBeginHost(the);
+	xsVars(2);
+	xsVar(0) = xsGet(xsGlobal, xsID("TextDecoder"));
+	xsVar(0) = xsGet(xsVar(0), xsID("prototype"));
+	xsVar(1) = xsNewHostFunction(xsnap_textdecoder_decode, 1);
+	xsSet(xsVar(0), xsID("decode"), xsVar(1));
+	xsVar(0) = xsGet(xsGlobal, xsID("TextEncoder"));
+	xsVar(0) = xsGet(xsVar(0), xsID("prototype"));
+	xsVar(1) = xsNewHostFunction(xsnap_textencoder_encode, 1);
+	xsSet(xsVar(0), xsID("encode"), xsVar(1));
+	xsEndHost(the);
+}
+
+void xsnap_textdecoder_decode(xsMachine* the)
+{
+	uint8_t* src;
+	uint8_t* dst;
+	xsUnsignedValue size;
+	size_t wide;
+	txTextDecoderRecord* record;
+	if ((xsToInteger(xsArgc) != 1) || (xsTypeOf(xsArg(0)) != xsReferenceType)) {
+		xs_textdecoder_decode(the);
+		return;
+	}
+	// let the module throw its own errors
+	{
+		xsTry {
+			xsmcGetBufferReadable(xsArg(0), (void **)&src, &size);
+		}
+		xsCatch {
+			src = NULL;
+		}
+	}
+	if ((src == NULL) || (size >= 0x7FFFFFFF / 2)) {
+		xs_textdecoder_decode(the);
+		return;
+	}
+	pthread_once(&gxTextOnce, fxTextInitialize);
+	if (((size >= 3) && (src[0] == 0xEF) && (src[1] == 0xBB) && (src[2] == 0xBF)) || !fxValidateUTF8(src, size, &wide)) {
+		xs_textdecoder_decode(the);
+		return;
+	}
+	// the module TextDecoder is a host object with a record and no destructor,
+	// anything else is left to the module
+	record = fxGetHostChunkOfSize(the, &xsThis, NULL, sizeof(txTextDecoderRecord));
+	if (!record || record->bufferLength) {
+		xs_textdecoder_decode(the);
+		return;
+	}
+	// every 4-byte sequence becomes a surrogate pair of 6 bytes
+	xsResult = xsStringBuffer(NULL, (xsIntegerValue)(size + (wide / 2)));
+	// refresh pointers, allocating may have moved the chunks
+	xsmcGetBufferReadable(xsArg(0), (void **)&src, &size);
+	dst = (uint8_t*)xsToString(xsResult);
+	if (wide == 0) {
+		c_memcpy(dst, src, size);
+		dst += size;
+	}
+	else {
+		uint8_t* limit = src + size;
+		while (src < limit) {
+			uint8_t* lead = src;
+			uint32_t character;
+			while ((lead < limit) && (*lead < 0xF0))
+				lead++;
+			c_memcpy(dst, src, lead - src);
+			dst += lead - src;
+			if (lead == limit)
+				break;
+			character = ((uint32_t)(lead[0] & 0x07) << 18) | ((uint32_t)(lead[1] & 0x3F) << 12) | ((uint32_t)(lead[2] & 0x3F) << 6) | (lead[3] & 0x3F);
+			character -= 0x10000;
+			dst[0] = 0xED;
+			dst[1] = (uint8_t)(0xA0 | ((character >> 16) & 0x0F));
+			dst[2] = (uint8_t)(0x80 | ((character >> 10) & 0x3F));
+			dst[3] = 0xED;
+			dst[4] = (uint8_t)(0xB0 | ((character >> 6) & 0x0F));
+			dst[5] = (uint8_t)(0x80 | (character & 0x3F));
+			dst += 6;
+			src = lead + 4;
+		}
+	}
+	dst[0] = 0;
+}
+
+void xsnap_textencoder_encode(xsMachine* the)
+{
+	uint8_t* src;
+	uint8_t* dst;
+	size_t size, offset, index, length;
+	if ((xsToInteger(xsArgc) < 1) || (xsTypeOf(xsArg(0)) != xsStringType)) {
+		xs_textencoder_encode(the);
+		return;
+	}
+	pthread_once(&gxTextOnce, fxTextInitialize);
+	src = (uint8_t*)xsToString(xsArg(0));
+	size = c_strlen((char*)src);
+	offset = (*gxCESU8Scanner)(src, size);
+	offset += fxScanCESU8Scalar(src + offset, size - offset);
+	// from the first C0 or ED byte, only surrogate pairs can be converted
+	length = size;
+	for (index = offset; index < size; index++) {
+		if (src[index] == 0xC0) {
+			xs_textencoder_encode(the);
+			return;
+		}
+		if ((src[index] == 0xED) && (src[index + 1] >= 0xA0)) {
+			if ((src[index + 1] < 0xB0) && (src[index + 3] == 0xED) && (src[index + 4] >= 0xB0)) {
+				length -= 2;
+				index += 5;
+			}
+			else {
+				xs_textencoder_encode(the);
+				return;
+			}
+		}
+	}
+	xsResult = xsArrayBuffer(NULL, (xsIntegerValue)length);
+	// refresh pointers, allocating may have moved the chunks
+	src = (uint8_t*)xsToString(xsArg(0));
+	dst = xsToArrayBuffer(xsResult);
+	c_memcpy(dst, src, offset);
+	dst += offset;
+	for (index = offset; index < size; index++) {
+		if ((src[index] == 0xED) && (src[index + 1] >= 0xA0)) {
+			uint32_t high = ((uint32_t)(src[index + 1] & 0x0F) << 6) | (src[index + 2] & 0x3F);
+			uint32_t low = ((uint32_t)(src[index + 4] & 0x0F) << 6) | (src[index + 5] & 0x3F);
+			uint32_t character = 0x10000 + (high << 10) + low;
+			dst[0] = (uint8_t)(0xF0 | (character >> 18));
+			dst[1] = (uint8_t)(0x80 | ((character >> 12) & 0x3F));
+			dst[2] = (uint8_t)(0x80 | ((character >> 6) & 0x3F));
+			dst[3] = (uint8_t)(0x80 | (character & 0x3F));
+			dst += 4;
+			index += 5;
+		}
+		else
+			*dst++ = src[index];
+	}
+	xsResult = xsNew1(xsGlobal, xsID("Uint8Array"), xsResult);
+}
+
+// The scanners stop at a block boundary, maybe in the middle of a sequence,
+// so validation resumes from its lead byte, and the scalar code checks the
+// rest.
+static int fxValidateUTF8(const uint8_t* src, size_t size, size_t* wide)
+{
+	size_t offset, index;
+	*wide = 0;
+	offset = (*gxUTF8Scanner)(src, size, wide);
+	for (index = 1; (index <= 3) && (index <= offset); index++) {
+		uint8_t byte = src[offset - index];
+		if (byte < 0x80)
+			break;
+		if (byte >= 0xC0) {
+			offset -= index;
+			if (byte >= 0xF0)
+				*wide -= 4;
+			break;
+		}
+	}
+	return fxScanUTF8Scalar(src + offset, size - offset, wide) == size - offset;
+}
+
+static size_t fxScanCESU8Scalar(const uint8_t* src, size_t size)
+{
+	size_t index;
+	for (index = 0; index < size; index++) {
+		if ((src[index] == 0xC0) || (src[index] == 0xED))
+			break;
+	}
+	return index;
+}
+
+static size_t fxScanUTF8Scalar(const uint8_t* src, size_t size, size_t* wide)
+{
+	size_t index = 0;
+	while (index < size) {
+		uint8_t byte = src[index];
+		size_t length;
+		if (byte == 0)
+			break;
+		if (byte < 0x80) {
+			index++;
+			continue;
+		}
+		if (byte < 0xC2)
+			break;
+		if (byte < 0xE0)
+			length = 2;
+		else if (byte < 0xF0)
+			length = 3;
+		else if (byte < 0xF5)
+			length = 4;
+		else
+			break;
+		if (size - index < length)
+			break;
+		if ((src[index + 1] & 0xC0) != 0x80)
+			break;
+		if (((byte == 0xE0) && (src[index + 1] < 0xA0)) || ((byte == 0xED) && (src[index + 1] >= 0xA0)))
+			break;
+		if (((byte == 0xF0) && (src[index + 1] < 0x90)) || ((byte == 0xF4) && (src[index + 1] >= 0x90)))
+			break;
+		if ((length > 2) && ((src[index + 2] & 0xC0) != 0x80))
+			break;
+		if ((length > 3) && ((src[index + 3] & 0xC0) != 0x80))
+			break;
+		if (length == 4)
+			*wide += 4;
+		index += length;
+	}
+	return index;
+}
+
+// The vectorized validation follows John Keiser and Daniel Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte": three table
+// lookups, on the high and low nibbles of each byte and the high nibble of
+// the next, classify every pair of bytes, then the third and fourth bytes
+// of longer sequences are checked against the lead bytes 2 and 3 bytes
+// before. A block of ASCII only checks that no sequence was left incomplete.
+
+#define mxTooShort (1 << 0)
+#define mxTooLong (1 << 1)
+#define mxOverlong3 (1 << 2)
+#define mxTooLarge (1 << 3)
+#define mxSurrogate (1 << 4)
+#define mxOverlong2 (1 << 5)
+#define mxTooLarge1000 (1 << 6)
+#define mxOverlong4 (1 << 6)
+#define mxTwoConts (1 << 7)
+#define mxCarry (mxTooShort | mxTooLong | mxTwoConts)
+
+#if mxTextX86 || mxTextNEON
+
+static const uint8_t gxUTF8Byte1High[16] = {
+	mxTooLong, mxTooLong, mxTooLong, mxTooLong, mxTooLong, mxTooLong, mxTooLong, mxTooLong,
+	mxTwoConts, mxTwoConts, mxTwoConts, mxTwoConts,
+	mxTooShort | mxOverlong2,
+	mxTooShort,
+	mxTooShort | mxOverlong3 | mxSurrogate,
+	mxTooShort | mxTooLarge | mxTooLarge1000 | mxOverlong4,
+};
+
+static const uint8_t gxUTF8Byte1Low[16] = {
+	mxCarry | mxOverlong3 | mxOverlong2 | mxOverlong4,
+	mxCarry | mxOverlong2,
+	mxCarry,
+	mxCarry,
+	mxCarry | mxTooLarge,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000 | mxSurrogate,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+	mxCarry | mxTooLarge | mxTooLarge1000,
+};
+
+static const uint8_t gxUTF8Byte2High[16] = {
+	mxTooShort, mxTooShort, mxTooShort, mxTooShort, mxTooShort, mxTooShort, mxTooShort, mxTooShort,
+	mxTooLong | mxOverlong2 | mxTwoConts | mxOverlong3 | mxTooLarge1000 | mxOverlong4,
+	mxTooLong | mxOverlong2 | mxTwoConts | mxOverlong3 | mxTooLarge,
+	mxTooLong | mxOverlong2 | mxTwoConts | mxSurrogate | mxTooLarge,
+	mxTooLong | mxOverlong2 | mxTwoConts | mxSurrogate | mxTooLarge,
+	mxTooShort, mxTooShort, mxTooShort, mxTooShort,
+};
+
+// the largest bytes that do not start a sequence longer than the block
+static const uint8_t gxUTF8Incomplete[32] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+#endif
+
+#if mxTextX86
+
+__attribute__((target("sse4.1")))
+static inline __m128i fxUTF8ErrorsSSE41(__m128i input, __m128i previous)
+{
+	__m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+	__m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+	__m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+	__m128i byte1High = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)gxUTF8Byte1High), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+	__m128i byte1Low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)gxUTF8Byte1Low), _mm_and_si128(prev1, nibble));
+	__m128i byte2High = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)gxUTF8Byte2High), _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+	__m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+	__m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+	__m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+	__m128i must = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+	return _mm_xor_si128(must, special);
+}
+
+__attribute__((target("sse4.1")))
+static size_t fxScanUTF8SSE41(const uint8_t* src, size_t size, size_t* wide)
+{
+	__m128i previous = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	__m128i limit = _mm_loadu_si128((const __m128i*)(gxUTF8Incomplete + 16));
+	size_t count = 0;
+	while (size - count >= 16) {
+		__m128i input = _mm_loadu_si128((const __m128i*)(src + count));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(input, zero)))
+			break;
+		if (_mm_movemask_epi8(input) == 0) {
+			if (!_mm_testz_si128(incomplete, incomplete))
+				break;
+		}
+		else {
+			__m128i errors = fxUTF8ErrorsSSE41(input, previous);
+			if (!_mm_testz_si128(errors, errors))
+				break;
+			incomplete = _mm_subs_epu8(input, limit);
+			*wide += 4 * (16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(input, _mm_set1_epi8((char)0xEF)), zero))));
+		}
+		previous = input;
+		count += 16;
+	}
+	return count;
+}
+
+__attribute__((target("sse4.1")))
+static size_t fxScanCESU8SSE41(const uint8_t* src, size_t size)
+{
+	__m128i c0 = _mm_set1_epi8((char)0xC0);
+	__m128i ed = _mm_set1_epi8((char)0xED);
+	size_t count = 0;
+	while (size - count >= 16) {
+		__m128i input = _mm_loadu_si128((const __m128i*)(src + count));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(input, c0), _mm_cmpeq_epi8(input, ed)));
+		if (mask)
+			return count + __builtin_ctz(mask);
+		count += 16;
+	}
+	return count;
+}
+
+__attribute__((target("avx2")))
+static size_t fxScanUTF8AVX2(const uint8_t* src, size_t size, size_t* wide)
+{
+	__m256i previous = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	__m256i zero = _mm256_setzero_si256();
+	__m256i nibble = _mm256_set1_epi8(0x0F);
+	__m256i limit = _mm256_loadu_si256((const __m256i*)gxUTF8Incomplete);
+	__m256i table1High = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gxUTF8Byte1High));
+	__m256i table1Low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gxUTF8Byte1Low));
+	__m256i table2High = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gxUTF8Byte2High));
+	size_t count = 0;
+	while (size - count >= 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i*)(src + count));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(input, zero)))
+			break;
+		if (_mm256_movemask_epi8(input) == 0) {
+			if (!_mm256_testz_si256(incomplete, incomplete))
+				break;
+		}
+		else {
+			__m256i shifted = _mm256_permute2x128_si256(previous, input, 0x21);
+			__m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+			__m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+			__m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+			__m256i byte1High = _mm256_shuffle_epi8(table1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+			__m256i byte1Low = _mm256_shuffle_epi8(table1Low, _mm256_and_si256(prev1, nibble));
+			__m256i byte2High = _mm256_shuffle_epi8(table2High, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+			__m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+			__m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+			__m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+			__m256i must = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+			__m256i errors = _mm256_xor_si256(must, special);
+			if (!_mm256_testz_si256(errors, errors))
+				break;
+			incomplete = _mm256_subs_epu8(input, limit);
+			*wide += 4 * (32 - __builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(input, _mm256_set1_epi8((char)0xEF)), zero))));
+		}
+		previous = input;
+		count += 32;
+	}
+	return count;
+}
+
+__attribute__((target("avx2")))
+static size_t fxScanCESU8AVX2(const uint8_t* src, size_t size)
+{
+	__m256i c0 = _mm256_set1_epi8((char)0xC0);
+	__m256i ed = _mm256_set1_epi8((char)0xED);
+	size_t count = 0;
+	while (size - count >= 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i*)(src + count));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(input, c0), _mm256_cmpeq_epi8(input, ed)));
+		if (mask)
+			return count + __builtin_ctz(mask);
+		count += 32;
+	}
+	return count;
+}
+
+#endif /* mxTextX86 */
+
+#if mxTextNEON
+
+static size_t fxScanUTF8NEON(const uint8_t* src, size_t size, size_t* wide)
+{
+	uint8x16_t previous = vdupq_n_u8(0);
+	uint8x16_t incomplete = vdupq_n_u8(0);
+	uint8x16_t limit = vld1q_u8(gxUTF8Incomplete + 16);
+	uint8x16_t table1High = vld1q_u8(gxUTF8Byte1High);
+	uint8x16_t table1Low = vld1q_u8(gxUTF8Byte1Low);
+	uint8x16_t table2High = vld1q_u8(gxUTF8Byte2High);
+	size_t count = 0;
+	while (size - count >= 16) {
+		uint8x16_t input = vld1q_u8(src + count);
+		if (vminvq_u8(input) == 0)
+			break;
+		if (vmaxvq_u8(input) < 0x80) {
+			if (vmaxvq_u8(incomplete))
+				break;
+		}
+		else {
+			uint8x16_t prev1 = vextq_u8(previous, input, 15);
+			uint8x16_t prev2 = vextq_u8(previous, input, 14);
+			uint8x16_t prev3 = vextq_u8(previous, input, 13);
+			uint8x16_t byte1High = vqtbl1q_u8(table1High, vshrq_n_u8(prev1, 4));
+			uint8x16_t byte1Low = vqtbl1q_u8(table1Low, vandq_u8(prev1, vdupq_n_u8(0x0F)));
+			uint8x16_t byte2High = vqtbl1q_u8(table2High, vshrq_n_u8(input, 4));
+			uint8x16_t special = vandq_u8(vandq_u8(byte1High, byte1Low), byte2High);
+			uint8x16_t third = vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80));
+			uint8x16_t fourth = vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80));
+			uint8x16_t must = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+			if (vmaxvq_u8(veorq_u8(must, special)))
+				break;
+			incomplete = vqsubq_u8(input, limit);
+			*wide += 4 * vaddvq_u8(vshrq_n_u8(vcgeq_u8(input, vdupq_n_u8(0xF0)), 7));
+		}
+		previous = input;
+		count += 16;
+	}
+	return count;
+}
+
+static size_t fxScanCESU8NEON(const uint8_t* src, size_t size)
+{
+	size_t count = 0;
+	while (size - count >= 16) {
+		uint8x16_t input = vld1q_u8(src + count);
+		uint8x16_t found = vorrq_u8(vceqq_u8(input, vdupq_n_u8(0xC0)), vceqq_u8(input, vdupq_n_u8(0xED)));
+		if (vmaxvq_u8(found))
+			return count + fxScanCESU8Scalar(src + count, 16);
+		count += 16;
+	}
+	return count;
+}
+
+#endif /* mxTextNEON */
+
+static void fxTextInitialize(void)
+{
+	txUTF8Scanner utf8 = fxScanUTF8Scalar;
+	txCESU8Scanner cesu8 = fxScanCESU8Scalar;
+#if mxTextX86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		utf8 = fxScanUTF8AVX2;
+		cesu8 = fxScanCESU8AVX2;
+	}
+	else if (__builtin_cpu_supports("sse4.1")) {
+		utf8 = fxScanUTF8SSE41;
+		cesu8 = fxScanCESU8SSE41;
+	}
+#elif mxTextNEON
+	utf8 = fxScanUTF8NEON;
+	cesu8 = fxScanCESU8NEON;
+#endif
+	gxUTF8Scanner = utf8;
+	gxCESU8Scanner = cesu8;
+}
@@ -0,0 +1,336 @@
+#include "xsnapTranscript.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_MSC_VER)
+	#define mxTranscriptPosix 0
+#else
+	#define mxTranscriptPosix 1
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+// The writer appends records through stdio, so a record costs a copy, not a
+// system call. The reader maps the file, or reads it at once, then indexes
+// the records in one pass. A record that was cut short, by a worker that
+// was killed while writing, ends the transcript.
+
+static size_t fxTranscriptRead4(unsigned char* buffer)
+{
+	return ((size_t)buffer[0] << 24) | ((size_t)buffer[1] << 16) | ((size_t)buffer[2] << 8) | (size_t)buffer[3];
+}
+
+static void fxTranscriptWrite4(unsigned char* buffer, size_t value)
+{
+	buffer[0] = (unsigned char)(value >> 24);
+	buffer[1] = (unsigned char)(value >> 16);
+	buffer[2] = (unsigned char)(value >> 8);
+	buffer[3] = (unsigned char)value;
+}
+
+int fxOpenTranscriptWriter(TranscriptWriter* writer, char* path)
+{
+	unsigned char version[4];
+	long position;
+	memset(writer, 0, sizeof(TranscriptWriter));
+	writer->file = fopen(path, "ab");
+	if (!writer->file) {
+		// later writes fail with the same error instead of using the file
+		writer->error = errno ? errno : EIO;
+		return writer->error;
+	}
+	// a new transcript starts with its header, an old one is appended to
+	if (fseek(writer->file, 0, SEEK_END) || ((position = ftell(writer->file)) < 0)) {
+		writer->error = errno;
+		return writer->error;
+	}
+	if (position == 0) {
+		fxTranscriptWrite4(version, TRANSCRIPT_VERSION);
+		fxWriteTranscript(writer, TRANSCRIPT_SIGNATURE, version, sizeof(version));
+	}
+	return writer->error;
+}
+
+int fxWriteTranscript(TranscriptWriter* writer, char* type, void* data, size_t length)
+{
+	unsigned char header[8];
+	if (writer->error)
+		return writer->error;
+	if (length > 0xFFFFFFFF - sizeof(header)) {
+		writer->error = EFBIG;
+		return writer->error;
+	}
+	fxTranscriptWrite4(header, length + sizeof(header));
+	memcpy(header + 4, type, 4);
+	if ((fwrite(header, sizeof(header), 1, writer->file) != 1) || (length && (fwrite(data, length, 1, writer->file) != 1)))
+		writer->error = errno ? errno : EIO;
+	else
+		writer->count++;
+	return writer->error;
+}
+
+int fxCloseTranscriptWriter(TranscriptWriter* writer)
+{
+	if (writer->file) {
+		if (fclose(writer->file) && !writer->error)
+			writer->error = errno;
+		writer->file = NULL;
+	}
+	return writer->error;
+}
+
+int fxOpenTranscriptReader(TranscriptReader* reader, char* path)
+{
+	unsigned char* p;
+	unsigned char* q;
+	size_t capacity = 0;
+	memset(reader, 0, sizeof(TranscriptReader));
+#if mxTranscriptPosix
+	{
+		struct stat a_stat;
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return errno;
+		if (fstat(fd, &a_stat)) {
+			close(fd);
+			return errno;
+		}
+		reader->size = (size_t)a_stat.st_size;
+		if (reader->size) {
+			reader->base = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (reader->base == MAP_FAILED) {
+				reader->base = NULL;
+				close(fd);
+				return errno;
+			}
+			reader->mapped = 1;
+		}
+		close(fd);
+	}
+#else
+	{
+		FILE* file = fopen(path, "rb");
+		long size;
+		if (!file)
+			return errno;
+		if (fseek(file, 0, SEEK_END) || ((size = ftell(file)) < 0) || fseek(file, 0, SEEK_SET)) {
+			fclose(file);
+			return errno;
+		}
+		reader->size = (size_t)size;
+		reader->base = malloc(reader->size ? reader->size : 1);
+		if (!reader->base) {
+			fclose(file);
+			return ENOMEM;
+		}
+		if (reader->size && (fread(reader->base, reader->size, 1, file) != 1)) {
+			fclose(file);
+			fxCloseTranscriptReader(reader);
+			return EIO;
+		}
+		fclose(file);
+	}
+#endif
+	p = reader->base;
+	q = p + reader->size;
+	if ((reader->size < 12) || (fxTranscriptRead4(p) != 12) || memcmp(p + 4, TRANSCRIPT_SIGNATURE, 4) || (fxTranscriptRead4(p + 8) != TRANSCRIPT_VERSION)) {
+		fxCloseTranscriptReader(reader);
+		return EINVAL;
+	}
+	p += 12;
+	while (q - p >= 8) {
+		size_t size = fxTranscriptRead4(p);
+		TranscriptRecord* record;
+		if ((size < 8) || (size > (size_t)(q - p)))
+			break;
+		if (reader->count == capacity) {
+			TranscriptRecord* records;
+			capacity = capacity ? 2 * capacity : 1024;
+			records = realloc(reader->records, capacity * sizeof(TranscriptRecord));
+			if (!records) {
+				fxCloseTranscriptReader(reader);
+				return ENOMEM;
+			}
+			reader->records = records;
+		}
+		record = reader->records + reader->count;
+		memcpy(record->type, p + 4, 4);
+		record->length = size - 8;
+		record->data = p + 8;
+		reader->count++;
+		p += size;
+	}
+	return 0;
+}
+
+TranscriptRecord* fxReadTranscript(TranscriptReader* reader)
+{
+	if (reader->current < reader->count)
+		return reader->records + reader->current++;
+	return NULL;
+}
+
+void fxCloseTranscriptReader(TranscriptReader* reader)
+{
+	if (reader->base) {
+	#if mxTranscriptPosix
+		if (reader->mapped)
+			munmap(reader->base, reader->size);
+	#else
+		free(reader->base);
+	#endif
+	}
+	free(reader->records);
+	memset(reader, 0, sizeof(TranscriptReader));
+}
+
+#if mxTranscriptPosix
+
+// The ring buffer has one producer, the thread that records, and one
+// consumer, the writer thread: the producer owns head, the consumer owns
+// tail, and neither takes a lock. The consumer drains all that is buffered
+// at once, so a burst of records costs one write. When the buffer is empty,
+// the consumer waits for the producer to signal, which it only does when the
+// consumer is waiting.
+
+static void fxCopyTranscriptRecord(TranscriptRecorder* recorder, size_t* head, void* data, size_t length)
+{
+	size_t offset = *head % recorder->capacity;
+	size_t size = recorder->capacity - offset;
+	if (size > length)
+		size = length;
+	memcpy(recorder->buffer + offset, data, size);
+	memcpy(recorder->buffer, (unsigned char*)data + size, length - size);
+	*head += length;
+}
+
+static void fxPushTranscriptRecord(TranscriptRecorder* recorder, size_t* head, char* type, void* data, size_t length)
+{
+	unsigned char header[8];
+	fxTranscriptWrite4(header, length + sizeof(header));
+	memcpy(header + 4, type, 4);
+	fxCopyTranscriptRecord(recorder, head, header, sizeof(header));
+	fxCopyTranscriptRecord(recorder, head, data, length);
+}
+
+static void* fxDrainTranscript(void* it)
+{
+	TranscriptRecorder* recorder = it;
+	FILE* file = recorder->writer.file;
+	for (;;) {
+		int stopping = __atomic_load_n(&recorder->stopping, __ATOMIC_SEQ_CST);
+		size_t head = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+		size_t tail = recorder->tail;
+		if (head == tail) {
+			if (stopping)
+				break;
+			pthread_mutex_lock(&recorder->mutex);
+			__atomic_store_n(&recorder->waiting, 1, __ATOMIC_SEQ_CST);
+			if ((__atomic_load_n(&recorder->head, __ATOMIC_SEQ_CST) == tail) && !__atomic_load_n(&recorder->stopping, __ATOMIC_SEQ_CST))
+				pthread_cond_wait(&recorder->condition, &recorder->mutex);
+			__atomic_store_n(&recorder->waiting, 0, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&recorder->mutex);
+			continue;
+		}
+		if (!recorder->writer.error) {
+			size_t offset = tail % recorder->capacity;
+			size_t size = recorder->capacity - offset;
+			if (size > head - tail)
+				size = head - tail;
+			if ((fwrite(recorder->buffer + offset, size, 1, file) != 1)
+					|| ((head - tail > size) && (fwrite(recorder->buffer, head - tail - size, 1, file) != 1))
+					|| fflush(file))
+				recorder->writer.error = errno ? errno : EIO;
+		}
+		// after a write error, records are consumed and lost
+		__atomic_store_n(&recorder->tail, head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+int fxStartTranscriptRecorder(TranscriptRecorder* recorder, char* path, size_t capacity)
+{
+	int error;
+	memset(recorder, 0, sizeof(TranscriptRecorder));
+	if (capacity < 16)
+		return EINVAL;
+	error = fxOpenTranscriptWriter(&recorder->writer, path);
+	if (error) {
+		fxCloseTranscriptWriter(&recorder->writer);
+		return error;
+	}
+	recorder->capacity = capacity;
+	recorder->buffer = malloc(capacity);
+	if (!recorder->buffer) {
+		fxCloseTranscriptWriter(&recorder->writer);
+		return ENOMEM;
+	}
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->condition, NULL);
+	error = pthread_create(&recorder->thread, NULL, fxDrainTranscript, recorder);
+	if (error) {
+		pthread_cond_destroy(&recorder->condition);
+		pthread_mutex_destroy(&recorder->mutex);
+		free(recorder->buffer);
+		recorder->buffer = NULL;
+		fxCloseTranscriptWriter(&recorder->writer);
+		return error;
+	}
+	return 0;
+}
+
+int fxRecordTranscript(TranscriptRecorder* recorder, char* type, void* data, size_t length)
+{
+	size_t head = recorder->head;
+	size_t tail = __atomic_load_n(&recorder->tail, __ATOMIC_ACQUIRE);
+	size_t room = recorder->capacity - (head - tail);
+	size_t dropped = recorder->dropped - recorder->reported;
+	size_t size = 8 + length;
+	if (dropped)
+		size += 12;
+	if ((length > 0xFFFFFFFF - 8) || (size > room)) {
+		recorder->dropped++;
+		return 0;
+	}
+	if (dropped) {
+		unsigned char count[4];
+		fxTranscriptWrite4(count, (dropped > 0xFFFFFFFF) ? 0xFFFFFFFF : dropped);
+		fxPushTranscriptRecord(recorder, &head, TRANSCRIPT_DROPPED, count, sizeof(count));
+		recorder->reported = recorder->dropped;
+	}
+	fxPushTranscriptRecord(recorder, &head, type, data, length);
+	__atomic_store_n(&recorder->head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&recorder->waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&recorder->mutex);
+		pthread_cond_signal(&recorder->condition);
+		pthread_mutex_unlock(&recorder->mutex);
+	}
+	return 1;
+}
+
+int fxStopTranscriptRecorder(TranscriptRecorder* recorder)
+{
+	if (!recorder->buffer)
+		return 0;
+	pthread_mutex_lock(&recorder->mutex);
+	__atomic_store_n(&recorder->stopping, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&recorder->condition);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+	if (recorder->dropped != recorder->reported) {
+		unsigned char count[4];
+		size_t dropped = recorder->dropped - recorder->reported;
+		fxTranscriptWrite4(count, (dropped > 0xFFFFFFFF) ? 0xFFFFFFFF : dropped);
+		fxWriteTranscript(&recorder->writer, TRANSCRIPT_DROPPED, count, sizeof(count));
+		recorder->reported = recorder->dropped;
+	}
+	pthread_cond_destroy(&recorder->condition);
+	pthread_mutex_destroy(&recorder->mutex);
+	free(recorder->buffer);
+	recorder->buffer = NULL;
+	return fxCloseTranscriptWriter(&recorder->writer);
+}
+
+#endif
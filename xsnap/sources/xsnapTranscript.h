@@ -0,0 +1,88 @@
+#ifndef __XSNAPTRANSCRIPT__
+#define __XSNAPTRANSCRIPT__
+
+#include <stddef.h>
+#include <stdio.h>
+#if !defined(_MSC_VER)
+	#include <pthread.h>
+#endif
+
+// A transcript is one append-only file of records, like snapshot atoms: the
+// size of the record, including its 8-byte header, as a big-endian 32-bit
+// integer, its 4-character type, then its data. The first record is the
+// header of the transcript.
+
+#define TRANSCRIPT_SIGNATURE "XSTR"
+#define TRANSCRIPT_VERSION 1
+
+#define TRANSCRIPT_ARGUMENTS "ARGS"	// the command line of the worker
+#define TRANSCRIPT_COMMAND "CMND"	// the argument of issueCommand
+#define TRANSCRIPT_DELIVERY "DLVR"	// the argument of handleCommand
+#define TRANSCRIPT_DROPPED "DROP"	// the number of records the recorder dropped here
+#define TRANSCRIPT_EVALUATE "EVAL"	// a script to evaluate
+#define TRANSCRIPT_REPLY "RPLY"		// the result of issueCommand
+#define TRANSCRIPT_SNAPSHOT "SNAP"	// the path of a snapshot to write
+
+typedef struct {
+	FILE* file;
+	size_t count;
+	int error;
+} TranscriptWriter;
+
+typedef struct {
+	char type[4];
+	size_t length;
+	unsigned char* data;
+} TranscriptRecord;
+
+typedef struct {
+	unsigned char* base;
+	size_t size;
+	int mapped;
+	TranscriptRecord* records;
+	size_t count;
+	size_t current;
+} TranscriptReader;
+
+#if !defined(_MSC_VER)
+// The recorder copies records into a ring buffer, that a thread drains into
+// the transcript. Records that do not fit are dropped and counted.
+typedef struct {
+	TranscriptWriter writer;
+	unsigned char* buffer;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+	size_t dropped;
+	size_t reported;
+	int waiting;
+	int stopping;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+} TranscriptRecorder;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int fxOpenTranscriptWriter(TranscriptWriter* writer, char* path);
+extern int fxWriteTranscript(TranscriptWriter* writer, char* type, void* data, size_t length);
+extern int fxCloseTranscriptWriter(TranscriptWriter* writer);
+
+extern int fxOpenTranscriptReader(TranscriptReader* reader, char* path);
+extern TranscriptRecord* fxReadTranscript(TranscriptReader* reader);
+extern void fxCloseTranscriptReader(TranscriptReader* reader);
+
+#if !defined(_MSC_VER)
+extern int fxStartTranscriptRecorder(TranscriptRecorder* recorder, char* path, size_t capacity);
+extern int fxRecordTranscript(TranscriptRecorder* recorder, char* type, void* data, size_t length);
+extern int fxStopTranscriptRecorder(TranscriptRecorder* recorder);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XSNAPTRANSCRIPT__ */